@@ -53,6 +53,7 @@ rm -rf $RPM_BUILD_ROOT%{_datadir}/doc/%{name}
 %doc doc/*.css
 %config(noreplace) /etc/%{name}.xml
 %{_bindir}/icecast
+%{_bindir}/icecast-logconv
 %{_prefix}/share/icecast/*
 
 %changelog
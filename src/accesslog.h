@@ -0,0 +1,59 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* accesslog.h
+**
+** layout of the binary access log, shared with icecast-logconv
+**
+** The file is a sequence of chunks, each complete in itself so the log can be
+** cycled or cut at any chunk boundary. A chunk is the header, then the
+** strings, each a 16 bit length and the bytes (no nul), numbered from 1 in
+** order. After padding to 8 bytes come the records, which refer to the
+** strings by number, 0 meaning not present. Values are in host byte order,
+** a reader on a different order sees the magic swapped.
+*/
+#ifndef __ACCESSLOG_H__
+#define __ACCESSLOG_H__
+
+#include <stdint.h>
+
+#define ACCESSLOG_MAGIC         0x4c414349  /* "ICAL" little endian */
+#define ACCESSLOG_VERSION       1
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t strings;
+    uint32_t records;
+    uint32_t length;        /* whole chunk, including this header */
+} accesslog_chunk_t;
+
+#define ACCESSLOG_IP            0
+#define ACCESSLOG_USER          1
+#define ACCESSLOG_METHOD        2
+#define ACCESSLOG_URI           3
+#define ACCESSLOG_PROTOCOL      4   /* eg HTTP/1.1 */
+#define ACCESSLOG_REFERRER      5
+#define ACCESSLOG_AGENT         6
+#define ACCESSLOG_FIELDS        7
+
+typedef struct
+{
+    int64_t  time;          /* of the disconnect */
+    uint64_t sent_bytes;
+    uint32_t duration;      /* seconds connected */
+    int16_t  status;
+    uint16_t field [ACCESSLOG_FIELDS];
+} accesslog_record_t;
+
+#endif  /* __ACCESSLOG_H__ */
@@ -237,12 +237,38 @@ static void auth_client_free (auth_client *auth_user)
 }
 
 
+/* Called by an authenticator once a request it returned AUTH_PENDING for
+ * has finished, this is run from the auth thread.
+ */
+void auth_client_complete (auth_client *auth_user, auth_result result)
+{
+    if (auth_user->complete)
+        auth_user->complete (auth_user, result);
+    auth_client_free (auth_user);
+}
+
+
+static void new_listener_complete (auth_client *auth_user, auth_result result)
+{
+    switch (result)
+    {
+        case AUTH_OK:
+        case AUTH_FAILED:
+            auth_postprocess_listener (auth_user);
+            break;
+        default:
+            break;
+    }
+}
+
+
 /* wrapper function for auth thread to authenticate new listener
  * connection details
  */
-static void auth_new_listener (auth_client *auth_user)
+static int auth_new_listener (auth_client *auth_user)
 {
     client_t *client = auth_user->client;
+    auth_result result = AUTH_OK;
 
     /* make sure there is still a client at this point, a slow backend request
      * can be avoided if client has disconnected */
@@ -250,26 +276,23 @@ static void auth_new_listener (auth_client *auth_user)
     {
         DEBUG1 ("dropping listener #%" PRIu64 " connection", client->connection.id);
         client->respcode = 400;
-        return;
+        return 0;
     }
+    auth_user->complete = new_listener_complete;
     if (auth_user->auth->authenticate)
     {
-        switch (auth_user->auth->authenticate (auth_user))
-        {
-            case AUTH_OK:
-            case AUTH_FAILED:
-                break;
-            default:
-                return;
-        }
+        result = auth_user->auth->authenticate (auth_user);
+        if (result == AUTH_PENDING)
+            return 1;
     }
-    auth_postprocess_listener (auth_user);
+    new_listener_complete (auth_user, result);
+    return 0;
 }
 
 
 /* wrapper function for auth thread to drop listener connections
  */
-static void auth_remove_listener (auth_client *auth_user)
+static int auth_remove_listener (auth_client *auth_user)
 {
     if (auth_user->auth->release_listener)
         auth_user->auth->release_listener (auth_user);
@@ -287,19 +310,17 @@ static void auth_remove_listener (auth_client *auth_user)
             client_destroy (auth_user->client);
         auth_user->client = NULL;
     }
+    return 0;
 }
 
 
 /* Called from auth thread to process any request for source client
  * authentication. Only applies to source clients, not relays.
  */
-static void stream_auth_callback (auth_client *auth_user)
+static void stream_auth_complete (auth_client *auth_user, auth_result result)
 {
     client_t *client = auth_user->client;
 
-    if (auth_user->auth->stream_auth)
-        auth_user->auth->stream_auth (auth_user);
-
     if (client->flags & CLIENT_AUTHENTICATED)
         auth_postprocess_source (auth_user);
     else
@@ -307,10 +328,23 @@ static void stream_auth_callback (auth_client *auth_user)
 }
 
 
+static int stream_auth_callback (auth_client *auth_user)
+{
+    auth_user->complete = stream_auth_complete;
+    if (auth_user->auth->stream_auth)
+    {
+        if (auth_user->auth->stream_auth (auth_user) == AUTH_PENDING)
+            return 1;
+    }
+    stream_auth_complete (auth_user, AUTH_OK);
+    return 0;
+}
+
+
 /* Callback from auth thread to handle a stream start event, this applies
  * to both source clients and relays.
  */
-static void stream_start_callback (auth_client *auth_user)
+static int stream_start_callback (auth_client *auth_user)
 {
     auth_t *auth = auth_user->auth;
 
@@ -324,13 +358,14 @@ static void stream_start_callback (auth_client *auth_user)
         free (client);
         auth_user->client = NULL;
     }
+    return 0;
 }
 
 
 /* Callback from auth thread to handle a stream start event, this applies
  * to both source clients and relays.
  */
-static void stream_end_callback (auth_client *auth_user)
+static int stream_end_callback (auth_client *auth_user)
 {
     auth_t *auth = auth_user->auth;
 
@@ -344,6 +379,7 @@ static void stream_end_callback (auth_client *auth_user)
         free (client);
         auth_user->client = NULL;
     }
+    return 0;
 }
 
 
@@ -352,6 +388,7 @@ static void *auth_run_thread (void *arg)
 {
     auth_thread_t *handler = arg;
     auth_t *auth = handler->auth;
+    int outstanding = 0;
 
     DEBUG2 ("Authentication thread %d started for %s", handler->id, auth->mount);
     thread_rwlock_rlock (&auth_lock);
@@ -359,7 +396,7 @@ static void *auth_run_thread (void *arg)
     while (1)
     {
         thread_mutex_lock (&auth->lock);
-        if (auth->head)
+        if (auth->head && (auth->run_requests == NULL || outstanding < auth->max_outstanding))
         {
             auth_client *auth_user = auth->head;
 
@@ -375,13 +412,28 @@ static void *auth_run_thread (void *arg)
             auth_user->thread_data = handler->data;
             auth_user->handler = handler->id;
 
-            if (auth_user->process)
-                auth_user->process (auth_user);
-
-            auth_client_free (auth_user);
+            if (auth_user->process && auth_user->process (auth_user))
+                outstanding++;  /* completed later by run_requests */
+            else
+                auth_client_free (auth_user);
 
             continue;
         }
+        if (auth->run_requests)
+        {
+            /* wait on outstanding requests, picking up any newly queued ones
+             * as the wait is short */
+            thread_mutex_unlock (&auth->lock);
+            outstanding = auth->run_requests (auth, handler->data, 10);
+            if (outstanding)
+                continue;
+            thread_mutex_lock (&auth->lock);
+            if (auth->head)
+            {
+                thread_mutex_unlock (&auth->lock);
+                continue;
+            }
+        }
         handler->thread = NULL;
         break;
     }
@@ -794,6 +846,8 @@ static int get_authenticator (auth_t *auth, config_options_t *options)
     }
     if (auth->handlers < 1) auth->handlers = 3;
     if (auth->handlers > 100) auth->handlers = 100;
+    if (auth->run_requests)
+        auth->handlers = 1;     /* one thread runs all the requests */
     return 0;
 }
 
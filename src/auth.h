@@ -32,7 +32,8 @@ typedef enum
     AUTH_FAILED,
     AUTH_USERADDED,
     AUTH_USEREXISTS,
-    AUTH_USERDELETED
+    AUTH_USERDELETED,
+    AUTH_PENDING
 } auth_result;
 
 typedef struct auth_client_tag
@@ -44,7 +45,8 @@ typedef struct auth_client_tag
     client_t    *client;
     struct auth_tag *auth;
     void        *thread_data;
-    void        (*process)(struct auth_client_tag *auth_user);
+    int         (*process)(struct auth_client_tag *auth_user);
+    void        (*complete)(struct auth_client_tag *auth_user, auth_result result);
     struct auth_client_tag *next;
 } auth_client;
 
@@ -58,7 +60,7 @@ typedef struct auth_tag
     auth_result (*release_listener)(auth_client *auth_user);
 
     /* auth handler for authenicating a connecting source client */
-    void (*stream_auth)(auth_client *auth_user);
+    auth_result (*stream_auth)(auth_client *auth_user);
 
     /* auth handler for source startup, no client passed as it may disappear */
     void (*stream_start)(auth_client *auth_user);
@@ -75,6 +77,11 @@ typedef struct auth_tag
     /* call to freeup any per auth thread data */
     void (*release_thread_data)(struct auth_tag *self, void *data);
 
+    /* for authenticators that return AUTH_PENDING and complete the requests
+     * later from the auth thread. Progress the outstanding requests, waiting
+     * up to the ms given for activity, returns the number still outstanding */
+    int (*run_requests)(struct auth_tag *self, void *data, int wait_ms);
+
     auth_result (*adduser)(struct auth_tag *auth, const char *username, const char *password);
     auth_result (*deleteuser)(struct auth_tag *auth, const char *username);
     auth_result (*listuser)(struct auth_tag *auth, xmlNodePtr srcnode);
@@ -82,6 +89,7 @@ typedef struct auth_tag
     mutex_t lock;
 
     int refcount;
+    int max_outstanding;
     short handlers;
     short flags;
 
@@ -129,6 +137,9 @@ int auth_stream_authenticate (client_t *client, const char *mount, struct _mount
 
 void auth_check_http (client_t *client);
 
+/* called by the authenticator when a request it returned AUTH_PENDING for is done */
+void auth_client_complete (auth_client *auth_user, auth_result result);
+
 #endif
 
 
@@ -40,27 +40,90 @@
 static auth_result htpasswd_adduser (auth_t *auth, const char *username, const char *password);
 static auth_result htpasswd_deleteuser(auth_t *auth, const char *username);
 static auth_result htpasswd_userlist(auth_t *auth, xmlNodePtr srcnode);
-static int _free_user (void *key);
+
+/* Verification takes no lock. The users are held in an open addressed table
+ * that is not changed once published. When the file changes a new table is
+ * built by a thread of its own and swapped in when complete, logins carry on
+ * with the previous one meanwhile. The replaced table is kept on a retired
+ * list for HTPASSWD_GRACE seconds before being freed, far longer than any
+ * lookup can take.
+ */
+#define HTPASSWD_GRACE      30
+
+/* ways of checking the file for changes */
+#define HTPASSWD_CHECK      0       /* reload in the background if changed */
+#define HTPASSWD_WAIT       1       /* reload now if changed */
+#define HTPASSWD_FORCE      2       /* reload now */
+
+#ifdef __GNUC__
+#define htpasswd_publish(p,v)   __atomic_store_n (&(p), (v), __ATOMIC_RELEASE)
+#define htpasswd_fetch(p)       __atomic_load_n (&(p), __ATOMIC_ACQUIRE)
+#else
+#define htpasswd_publish(p,v)   ((p) = (v))
+#define htpasswd_fetch(p)       (p)
+#endif
 
 typedef struct
 {
-    char *name;
-    char *pass;
+    const char *name;           /* NULL for an unused slot */
+    const char *pass;
+    uint32_t hash;
+    int has_digest;             /* pass is a md5 hash in hex */
+    unsigned char digest [HASH_LEN];
 } htpasswd_user;
 
+typedef struct htpasswd_table
+{
+    struct htpasswd_table *retired_next;
+    time_t retired;
+    unsigned int count, mask;
+    char *text;                 /* file contents, names and passwords refer to this */
+    htpasswd_user slots [];
+} htpasswd_table;
+
 typedef struct {
     char *filename;
-    rwlock_t file_rwlock;
-    avl_tree *users;
+    rwlock_t file_rwlock;       /* serialises changes to the file */
+    htpasswd_table *users;
+    htpasswd_table *retired;
+    mutex_t reload_lock;        /* for what follows */
     time_t mtime;
+    time_t checked;
+    int reloading;
+    thread_type *reload_thread;
 } htpasswd_auth_state;
 
+
+static void htpasswd_table_free (htpasswd_table *table)
+{
+    if (table == NULL)
+        return;
+    free (table->text);
+    free (table);
+}
+
+
 static void htpasswd_clear(auth_t *self) {
     htpasswd_auth_state *state = self->state;
+    thread_type *reload;
+
+    thread_mutex_lock (&state->reload_lock);
+    reload = state->reload_thread;
+    state->reload_thread = NULL;
+    thread_mutex_unlock (&state->reload_lock);
+    if (reload)
+        thread_join (reload);
+
+    while (state->retired)
+    {
+        htpasswd_table *table = state->retired;
+        state->retired = table->retired_next;
+        htpasswd_table_free (table);
+    }
+    htpasswd_table_free (state->users);
     free(state->filename);
-    if (state->users)
-        avl_tree_free (state->users, _free_user);
     thread_rwlock_destroy(&state->file_rwlock);
+    thread_mutex_destroy (&state->reload_lock);
     free(state);
 }
 
@@ -81,97 +144,241 @@ static char *get_hash(const char *data, size_t len)
 }
 
 
-static int compare_users (void *arg, void *a, void *b)
+static uint32_t htpasswd_hash (const char *name)
 {
-    htpasswd_user *user1 = (htpasswd_user *)a;
-    htpasswd_user *user2 = (htpasswd_user *)b;
+    uint32_t hash = 2166136261u;
 
-    return strcmp (user1->name, user2->name);
+    while (*name)
+        hash = (hash ^ (unsigned char)*name++) * 16777619u;
+    return hash;
 }
 
 
-static int _free_user (void *key)
+/* the hash as util_bin_to_hex writes it, anything else never matches */
+static int htpasswd_digest (const char *hex, unsigned char *digest)
 {
-    htpasswd_user *user = (htpasswd_user *)key;
+    int i;
 
-    free (user->name); /* ->pass is part of same buffer */
-    free (user);
-    return 1;
+    for (i = 0; i < HASH_LEN*2; i++)
+    {
+        int c = hex[i], v;
+
+        if (c >= '0' && c <= '9')
+            v = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            v = c - 'a' + 10;
+        else
+            return 0;
+        if (i & 1)
+            digest [i>>1] |= v;
+        else
+            digest [i>>1] = v << 4;
+    }
+    return hex[i] == '\0';
 }
 
 
-static void htpasswd_recheckfile (htpasswd_auth_state *htpasswd)
+static htpasswd_user *htpasswd_find (htpasswd_table *table, const char *name)
 {
-    FILE *passwdfile;
-    avl_tree *new_users;
-    int num = 0;
-    struct stat file_stat;
-    char *sep;
-    char line [MAX_LINE_LEN];
+    uint32_t hash;
+    unsigned int i;
 
-    if (htpasswd->filename == NULL)
-        return;
-    if (stat (htpasswd->filename, &file_stat) != 0)
+    if (table == NULL || name == NULL)
+        return NULL;
+    hash = htpasswd_hash (name);
+    for (i = hash & table->mask; table->slots[i].name; i = (i+1) & table->mask)
     {
-        const char *msg = strerror (errno);
-        WARN2 ("failed to check status of %s (%s)", htpasswd->filename, msg ? msg : "unknown");
+        if (table->slots[i].hash == hash && strcmp (table->slots[i].name, name) == 0)
+            return &table->slots[i];
+    }
+    return NULL;
+}
 
-        /* Create a dummy users tree for things to use later */
-        thread_rwlock_wlock (&htpasswd->file_rwlock);
-        if(!htpasswd->users)
-            htpasswd->users = avl_tree_new(compare_users, NULL);
-        thread_rwlock_unlock (&htpasswd->file_rwlock);
 
-        return;
-    }
+/* read the whole file and index the users, returns NULL on failure */
+static htpasswd_table *htpasswd_load (const char *filename)
+{
+    FILE *passwdfile = fopen (filename, "rb");
+    htpasswd_table *table;
+    struct stat file_stat;
+    char *text, *line, *eol;
+    unsigned int lines = 1, slots = 16, num = 0;
+    size_t len;
 
-    if (file_stat.st_mtime == htpasswd->mtime)
-    {
-        /* common case, no update to file */
-        return;
-    }
-    INFO1 ("re-reading htpasswd file \"%s\"", htpasswd->filename);
-    passwdfile = fopen (htpasswd->filename, "rb");
-    if (passwdfile == NULL)
+    if (passwdfile == NULL || fstat (fileno (passwdfile), &file_stat) != 0)
     {
-        WARN2("Failed to open authentication database \"%s\": %s", 
-                htpasswd->filename, strerror(errno));
-        return;
+        WARN2("Failed to open authentication database \"%s\": %s",
+                filename, strerror(errno));
+        if (passwdfile)
+            fclose (passwdfile);
+        return NULL;
     }
-    htpasswd->mtime = file_stat.st_mtime;
-
-    new_users = avl_tree_new (compare_users, NULL);
-
-    while (get_line(passwdfile, line, MAX_LINE_LEN))
+    len = file_stat.st_size;
+    text = malloc (len + 1);
+    if (text == NULL)
+        abort();
+    len = fread (text, 1, len, passwdfile);
+    fclose (passwdfile);
+    text [len] = '\0';
+
+    for (line = text; (line = strchr (line, '\n')); line++)
+        lines++;
+    while (slots < lines * 2)
+        slots <<= 1;
+    table = calloc (1, sizeof (htpasswd_table) + slots * sizeof (htpasswd_user));
+    if (table == NULL)
+        abort();
+    table->text = text;
+    table->mask = slots - 1;
+
+    for (line = text; line; line = eol)
     {
-        int len;
         htpasswd_user *entry;
+        char *sep;
+        uint32_t hash;
+        unsigned int i;
 
         num++;
-        if(!line[0] || line[0] == '#')
+        eol = strchr (line, '\n');
+        if (eol)
+        {
+            if (eol > line && eol[-1] == '\r')
+                eol[-1] = '\0';
+            *eol++ = '\0';
+        }
+        if (!line[0] || line[0] == '#')
             continue;
 
         sep = strrchr (line, ':');
         if (sep == NULL)
         {
-            WARN2("No separator on line %d (%s)", num, htpasswd->filename);
+            WARN2("No separator on line %d (%s)", num, filename);
             continue;
         }
-        entry = calloc (1, sizeof (htpasswd_user));
-        len = strlen (line) + 1;
-        entry->name = malloc (len);
-        *sep = 0;
-        memcpy (entry->name, line, len);
-        entry->pass = entry->name + (sep-line) + 1;
-        avl_insert (new_users, entry);
+        *sep = '\0';
+        hash = htpasswd_hash (line);
+        for (i = hash & table->mask; table->slots[i].name; i = (i+1) & table->mask)
+        {
+            if (table->slots[i].hash == hash && strcmp (table->slots[i].name, line) == 0)
+                break;
+        }
+        entry = &table->slots[i];
+        if (entry->name)
+            continue;       /* first one listed is used */
+        entry->name = line;
+        entry->pass = sep + 1;
+        entry->hash = hash;
+        entry->has_digest = htpasswd_digest (entry->pass, entry->digest);
+        table->count++;
     }
-    fclose (passwdfile);
+    return table;
+}
+
+
+/* load the file and swap the new table in */
+static void htpasswd_reload (htpasswd_auth_state *htpasswd)
+{
+    htpasswd_table *table = htpasswd_load (htpasswd->filename), *old, **prev;
+    time_t now = time (NULL);
 
-    thread_rwlock_wlock (&htpasswd->file_rwlock);
-    if (htpasswd->users)
-        avl_tree_free (htpasswd->users, _free_user);
-    htpasswd->users = new_users;
-    thread_rwlock_unlock (&htpasswd->file_rwlock);
+    thread_mutex_lock (&htpasswd->reload_lock);
+    if (table)
+    {
+        old = htpasswd->users;
+        htpasswd_publish (htpasswd->users, table);
+        if (old)
+        {
+            old->retired = now;
+            old->retired_next = htpasswd->retired;
+            htpasswd->retired = old;
+        }
+        INFO2 ("loaded %u users from \"%s\"", table->count, htpasswd->filename);
+    }
+    /* free what has been retired long enough for any lookup to have finished */
+    prev = &htpasswd->retired;
+    while ((old = *prev))
+    {
+        if (old->retired + HTPASSWD_GRACE <= now)
+        {
+            *prev = old->retired_next;
+            htpasswd_table_free (old);
+            continue;
+        }
+        prev = &old->retired_next;
+    }
+    thread_mutex_unlock (&htpasswd->reload_lock);
+}
+
+
+static void *htpasswd_reload_thread (void *arg)
+{
+    htpasswd_auth_state *htpasswd = arg;
+
+    htpasswd_reload (htpasswd);
+    thread_mutex_lock (&htpasswd->reload_lock);
+    htpasswd->reloading = 0;
+    thread_mutex_unlock (&htpasswd->reload_lock);
+    return NULL;
+}
+
+
+/* The file is checked at most once a second unless waiting */
+static void htpasswd_recheckfile (htpasswd_auth_state *htpasswd, int mode)
+{
+    struct stat file_stat;
+    time_t now = time (NULL);
+
+    if (htpasswd->filename == NULL)
+        return;
+    if (mode == HTPASSWD_CHECK && htpasswd_fetch (htpasswd->checked) == now)
+        return;
+
+    thread_mutex_lock (&htpasswd->reload_lock);
+    htpasswd_publish (htpasswd->checked, now);
+    /* collect a finished reload, or any reload if waiting */
+    while (htpasswd->reload_thread && (mode != HTPASSWD_CHECK || htpasswd->reloading == 0))
+    {
+        thread_type *reload = htpasswd->reload_thread;
+
+        htpasswd->reload_thread = NULL;
+        thread_mutex_unlock (&htpasswd->reload_lock);
+        thread_join (reload);
+        thread_mutex_lock (&htpasswd->reload_lock);
+    }
+    if (htpasswd->reload_thread)
+    {
+        thread_mutex_unlock (&htpasswd->reload_lock);
+        return;
+    }
+    if (stat (htpasswd->filename, &file_stat) != 0)
+    {
+        const char *msg = strerror (errno);
+        thread_mutex_unlock (&htpasswd->reload_lock);
+        WARN2 ("failed to check status of %s (%s)", htpasswd->filename, msg ? msg : "unknown");
+        return;
+    }
+    if (file_stat.st_mtime == htpasswd->mtime && mode != HTPASSWD_FORCE)
+    {
+        /* common case, no update to file */
+        thread_mutex_unlock (&htpasswd->reload_lock);
+        return;
+    }
+    htpasswd->mtime = file_stat.st_mtime;
+    INFO1 ("re-reading htpasswd file \"%s\"", htpasswd->filename);
+    if (mode == HTPASSWD_CHECK)
+    {
+        htpasswd->reloading = 1;
+        htpasswd->reload_thread = thread_create ("htpasswd reload", htpasswd_reload_thread, htpasswd, THREAD_ATTACHED);
+        if (htpasswd->reload_thread)
+        {
+            thread_mutex_unlock (&htpasswd->reload_lock);
+            return;
+        }
+        htpasswd->reloading = 0;
+        WARN0 ("failed to start reload thread, reloading now");
+    }
+    thread_mutex_unlock (&htpasswd->reload_lock);
+    htpasswd_reload (htpasswd);
 }
 
 
@@ -180,8 +387,7 @@ static auth_result htpasswd_auth (auth_client *auth_user)
     auth_t *auth = auth_user->auth;
     htpasswd_auth_state *htpasswd = auth->state;
     client_t *client = auth_user->client;
-    htpasswd_user entry;
-    void *result;
+    htpasswd_user *found;
 
     do {
         const char *val;
@@ -205,30 +411,26 @@ static auth_result htpasswd_auth (auth_client *auth_user)
         return AUTH_FAILED;
     } while (0);
 
-    htpasswd_recheckfile (htpasswd);
+    htpasswd_recheckfile (htpasswd, HTPASSWD_CHECK);
 
-    thread_rwlock_rlock (&htpasswd->file_rwlock);
-    entry.name = client->username;
-    if (avl_get_by_key (htpasswd->users, &entry, &result) == 0)
+    found = htpasswd_find (htpasswd_fetch (htpasswd->users), client->username);
+    if (found)
     {
-        htpasswd_user *found = result;
-        char *hashed_pw;
+        struct MD5Context context;
+        unsigned char digest [HASH_LEN];
 
-        hashed_pw = get_hash (client->password, strlen (client->password));
-        if (strcmp (found->pass, hashed_pw) == 0)
+        MD5Init (&context);
+        MD5Update (&context, (const unsigned char *)client->password, strlen (client->password));
+        MD5Final (digest, &context);
+        if (found->has_digest && memcmp (found->digest, digest, HASH_LEN) == 0)
         {
-            free (hashed_pw);
-            thread_rwlock_unlock (&htpasswd->file_rwlock);
             client->flags |= CLIENT_AUTHENTICATED;
             return AUTH_OK;
         }
-        thread_rwlock_unlock (&htpasswd->file_rwlock);
-        free (hashed_pw);
         DEBUG0 ("incorrect password for client");
         return AUTH_FAILED;
     }
     DEBUG1 ("no such username: %s", client->username);
-    thread_rwlock_unlock (&htpasswd->file_rwlock);
     return AUTH_FAILED;
 }
 
@@ -262,7 +464,8 @@ int  auth_get_htpasswd_auth (auth_t *authenticator, config_options_t *options)
             state->filename);
 
     thread_rwlock_create(&state->file_rwlock);
-    htpasswd_recheckfile (state);
+    thread_mutex_create (&state->reload_lock);
+    htpasswd_recheckfile (state, HTPASSWD_WAIT);
 
     return 0;
 }
@@ -273,15 +476,12 @@ static auth_result htpasswd_adduser (auth_t *auth, const char *username, const c
     FILE *passwdfile;
     char *hashed_password = NULL;
     htpasswd_auth_state *state = auth->state;
-    htpasswd_user entry;
-    void *result;
 
-    htpasswd_recheckfile (state);
+    htpasswd_recheckfile (state, HTPASSWD_WAIT);
 
     thread_rwlock_wlock (&state->file_rwlock);
 
-    entry.name = (char*)username;
-    if (avl_get_by_key (state->users, &entry, &result) == 0)
+    if (htpasswd_find (htpasswd_fetch (state->users), username))
     {
         thread_rwlock_unlock (&state->file_rwlock);
         return AUTH_USEREXISTS;
@@ -305,6 +505,7 @@ static auth_result htpasswd_adduser (auth_t *auth, const char *username, const c
 
     fclose(passwdfile);
     thread_rwlock_unlock (&state->file_rwlock);
+    htpasswd_recheckfile (state, HTPASSWD_FORCE);
 
     return AUTH_USERADDED;
 }
@@ -396,34 +597,54 @@ static auth_result htpasswd_deleteuser(auth_t *auth, const char *username)
     }
     free(tmpfile);
     thread_rwlock_unlock (&state->file_rwlock);
-    htpasswd_recheckfile (state);
+    htpasswd_recheckfile (state, HTPASSWD_FORCE);
 
     return AUTH_USERDELETED;
 }
 
 
+static int compare_users (const void *a, const void *b)
+{
+    const htpasswd_user *user1 = *(const htpasswd_user **)a;
+    const htpasswd_user *user2 = *(const htpasswd_user **)b;
+
+    return strcmp (user1->name, user2->name);
+}
+
+
 static auth_result htpasswd_userlist(auth_t *auth, xmlNodePtr srcnode)
 {
     htpasswd_auth_state *state;
+    htpasswd_table *users;
+    htpasswd_user **list;
     xmlNodePtr newnode;
-    avl_node *node;
+    unsigned int i, count = 0;
 
     state = auth->state;
 
-    htpasswd_recheckfile (state);
-
-    thread_rwlock_rlock (&state->file_rwlock);
-    node = avl_get_first (state->users);
-    while (node)
+    htpasswd_recheckfile (state, HTPASSWD_WAIT);
+
+    /* no lock is taken, as with htpasswd_auth the table fetched is not changed
+     * and if replaced meanwhile is kept for HTPASSWD_GRACE seconds, much longer
+     * than the listing takes */
+    users = htpasswd_fetch (state->users);
+    if (users == NULL)
+        return AUTH_OK;
+    list = malloc ((users->count ? users->count : 1) * sizeof (htpasswd_user *));
+    if (list == NULL)
+        abort();
+    for (i = 0; i <= users->mask; i++)
+        if (users->slots[i].name)
+            list [count++] = &users->slots[i];
+    qsort (list, count, sizeof (htpasswd_user *), compare_users);
+
+    for (i = 0; i < count; i++)
     {
-        htpasswd_user *user = (htpasswd_user *)node->key;
         newnode = xmlNewChild (srcnode, NULL, XMLSTR("User"), NULL);
-        xmlNewChild(newnode, NULL, XMLSTR("username"), XMLSTR(user->name));
-        xmlNewChild(newnode, NULL, XMLSTR("password"), XMLSTR(user->pass));
-        node = avl_get_next (node);
+        xmlNewChild(newnode, NULL, XMLSTR("username"), XMLSTR(list[i]->name));
+        xmlNewChild(newnode, NULL, XMLSTR("password"), XMLSTR(list[i]->pass));
     }
-    thread_rwlock_unlock (&state->file_rwlock);
+    free (list);
 
     return AUTH_OK;
 }
-
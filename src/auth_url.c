@@ -48,6 +48,9 @@
  * encoded) and duration is the amount of time in seconds. user and pass
  * setting can be blank
  *
+ * Departures can instead be batched, the records are collected for a short
+ * time and posted together as text/plain, one record (as above) per line.
+ *
  * On stream start and end, another url can be issued to help clear any user
  * info stored at the auth server. Useful for abnormal outage/termination
  * cases.
@@ -63,6 +66,21 @@
  * As admin requests can come in for a stream (eg metadata update) these requests
  * can be issued while stream is active. For these &admin=1 is added to the POST
  * details.
+ *
+ * The requests are not run one at a time by blocking auth threads, a single
+ * auth thread runs all of them for the authenticator with a curl multi
+ * handle, so many can be outstanding and connections to the auth server are
+ * kept open and reused between requests.
+ *
+ * listener_add results can be cached for a while so that a listener that
+ * reconnects soon after does not cause another request. The cache is keyed
+ * on the requested mount (with query args), the headers passed on and
+ * optionally the IP and username/password. The auth server can state how
+ * long a reply can be reused for with
+ *
+ * Cache-Control: max-age=300
+ *
+ * or that it must not be cached with no-store or no-cache.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -80,6 +98,9 @@
 #include <strings.h>
 #endif
 #include <ctype.h>
+#ifdef HAVE_SYS_SELECT_H
+#include <sys/select.h>
+#endif
 
 #include <curl/curl.h>
 
@@ -91,23 +112,92 @@
 #include "mpeg.h"
 #include "global.h"
 #include "stats.h"
+#include "md5.h"
+#include "timing/timing.h"
 
 #include "logging.h"
 #define CATMODULE "auth_url"
 
+/* idle request handles kept for reuse */
+#define URL_SPARE_REQUESTS      100
+
+/* what the listener_add cache key includes besides the mount */
+#define URL_CACHE_KEY_IP        1
+#define URL_CACHE_KEY_USER      (1<<1)
+
+/* reply headers seen that need storing with a cached result */
+#define URL_SEEN_TIMELIMIT      1
+#define URL_SEEN_USERNAME       (1<<1)
+#define URL_SEEN_MOUNT          (1<<2)
+
+/* client flags that a listener_add reply sets */
+#define URL_CACHE_CLIENT_FLAGS  (CLIENT_AUTHENTICATED|CLIENT_IS_SLAVE|CLIENT_HIJACKER)
+
+typedef struct url_cache_entry
+{
+    struct url_cache_entry *hash_next;
+    struct url_cache_entry *prev, *next;    /* most recently used first */
+    unsigned char key [HASH_LEN];
+    time_t expire;
+    time_t discon_time;
+    auth_result result;
+    unsigned int flags;
+    char *username;
+    char *mount;
+    char *message;          /* for a 403 reply */
+} url_cache_entry;
+
+/* only the auth thread uses this so there is no lock */
 typedef struct
 {
-    int id;
+    url_cache_entry **table;
+    url_cache_entry *head, *tail;
+    unsigned int count, size, mask;
+} url_cache;
+
+typedef struct url_request
+{
     CURL *curl;
-    char *server_id;
+    auth_t *auth;
+    auth_client *auth_user;     /* NULL if nothing waits on the reply */
+    const char *url;
     char *location;
+    int cache_age;              /* from the reply, -1 if not given */
+    unsigned int seen;
+    unsigned char cache_key [HASH_LEN];
+    auth_result (*done)(struct url_request *req, CURLcode res);
+    struct url_request *next;
     char errormsg [CURL_ERROR_SIZE];
+} url_request;
+
+typedef struct
+{
+    CURLM *multi;
+    char *server_id;
+    url_request *spare;
+    int spare_count;
+    int outstanding;            /* includes those waiting */
+    int active;                 /* in the multi handle */
+    url_request *waiting, **waiting_tail;
+
+    /* listener_remove records waiting to be posted together */
+    struct curl_slist *batch_headers;
+    char *batch;
+    unsigned int batch_len, batch_size, batch_count;
+    uint64_t batch_start;
 } auth_thread_data;
 
 typedef struct {
     time_t stop_req_until;
     int  stop_req_duration;
     int  timeout;
+    int  connections;
+    int  cache_ttl;
+    int  cache_failed_ttl;
+    int  cache_key;
+    int  remove_batch;
+    int  remove_wait;
+    url_cache cache;
     char *addurl;
     char *removeurl;
     char *stream_start;
@@ -126,6 +216,9 @@ typedef struct {
 } auth_url;
 
 
+static void url_remove_batch_send (auth_thread_data *atd, auth_t *auth);
+
+
 struct build_intro_contents
 {
     format_type_t type;
@@ -134,6 +227,197 @@ struct build_intro_contents
     size_t intro_len;
 };
 
+static url_cache_entry **url_cache_bucket (url_cache *cache, const unsigned char *key)
+{
+    uint32_t slot;
+
+    memcpy (&slot, key, sizeof (slot));
+    return &cache->table [slot & cache->mask];
+}
+
+
+static void url_cache_remove (url_cache *cache, url_cache_entry *entry)
+{
+    url_cache_entry **p = url_cache_bucket (cache, entry->key);
+
+    while (*p != entry)
+        p = &(*p)->hash_next;
+    *p = entry->hash_next;
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        cache->head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+    cache->count--;
+    free (entry->username);
+    free (entry->mount);
+    free (entry->message);
+    free (entry);
+}
+
+
+static void url_cache_key (auth_url *url, auth_client *auth_user, unsigned char key[HASH_LEN])
+{
+    client_t *client = auth_user->client;
+    struct MD5Context context;
+    const char *qargs = httpp_getvar (client->parser, HTTPP_VAR_QUERYARGS);
+
+    MD5Init (&context);
+    MD5Update (&context, (unsigned char *)auth_user->mount, strlen (auth_user->mount));
+    if (qargs)
+        MD5Update (&context, (unsigned char *)qargs, strlen (qargs));
+    MD5Update (&context, (unsigned char *)"", 1);
+    if (url->cache_key & URL_CACHE_KEY_IP)
+        MD5Update (&context, (unsigned char *)client->connection.ip, strlen (client->connection.ip) + 1);
+    if (url->cache_key & URL_CACHE_KEY_USER)
+    {
+        if (client->username)
+            MD5Update (&context, (unsigned char *)client->username, strlen (client->username));
+        MD5Update (&context, (unsigned char *)":", 1);
+        if (client->password)
+            MD5Update (&context, (unsigned char *)client->password, strlen (client->password));
+        MD5Update (&context, (unsigned char *)"", 1);
+    }
+    if (url->header_chk_list)
+    {
+        /* the auth server sees these so the reply may depend on them */
+        const char *cur_header = url->header_chk_list;
+        int c = url->header_chk_count;
+
+        for (; c; c--)
+        {
+            const char *val = httpp_getvar (client->parser, cur_header);
+            if (val)
+                MD5Update (&context, (unsigned char *)val, strlen (val));
+            MD5Update (&context, (unsigned char *)"", 1);
+            cur_header += strlen (cur_header) + 1;
+        }
+    }
+    MD5Final (key, &context);
+}
+
+
+static url_cache_entry *url_cache_find (url_cache *cache, const unsigned char *key, time_t now)
+{
+    url_cache_entry *entry = *url_cache_bucket (cache, key);
+
+    while (entry && memcmp (entry->key, key, HASH_LEN) != 0)
+        entry = entry->hash_next;
+    if (entry == NULL)
+        return NULL;
+    if (entry->expire <= now || (entry->discon_time && entry->discon_time <= now))
+    {
+        url_cache_remove (cache, entry);
+        return NULL;
+    }
+    if (entry->prev)
+    {
+        entry->prev->next = entry->next;
+        if (entry->next)
+            entry->next->prev = entry->prev;
+        else
+            cache->tail = entry->prev;
+        entry->prev = NULL;
+        entry->next = cache->head;
+        cache->head->prev = entry;
+        cache->head = entry;
+    }
+    return entry;
+}
+
+
+/* record the result of a listener_add request if it can be reused */
+static void url_cache_store (auth_url *url, url_request *req, auth_result result)
+{
+    auth_client *auth_user = req->auth_user;
+    client_t *client = auth_user->client;
+    url_cache *cache = &url->cache;
+    url_cache_entry *entry, **bucket;
+    time_t now = time (NULL);
+    int ttl = (result == AUTH_OK) ? url->cache_ttl : url->cache_failed_ttl;
+    long code = 0;
+
+    if (cache->size == 0 || req->location || (client->flags & CLIENT_HAS_INTRO_CONTENT))
+        return;
+    /* a server error says nothing about the listener */
+    curl_easy_getinfo (req->curl, CURLINFO_RESPONSE_CODE, &code);
+    if ((code < 200 || code > 299) && code != 403)
+        return;
+    if (req->cache_age >= 0)
+        ttl = req->cache_age;
+    if (ttl <= 0)
+        return;
+
+    entry = url_cache_find (cache, req->cache_key, now);
+    if (entry)
+        url_cache_remove (cache, entry);
+    if (cache->count >= cache->size)
+        url_cache_remove (cache, cache->tail);
+
+    entry = calloc (1, sizeof (url_cache_entry));
+    if (entry == NULL)
+        abort();
+    memcpy (entry->key, req->cache_key, HASH_LEN);
+    entry->expire = now + ttl;
+    entry->result = result;
+    entry->flags = client->flags & URL_CACHE_CLIENT_FLAGS;
+    if (req->seen & URL_SEEN_TIMELIMIT)
+        entry->discon_time = client->connection.discon.time;
+    if ((req->seen & URL_SEEN_USERNAME) && client->username)
+        entry->username = strdup (client->username);
+    if (req->seen & URL_SEEN_MOUNT)
+        entry->mount = strdup (auth_user->mount);
+    if (result != AUTH_OK && atoi (req->errormsg) == 403)
+        entry->message = strdup (req->errormsg);
+
+    bucket = url_cache_bucket (cache, entry->key);
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    entry->next = cache->head;
+    if (cache->head)
+        cache->head->prev = entry;
+    else
+        cache->tail = entry;
+    cache->head = entry;
+    cache->count++;
+}
+
+
+/* apply a cached listener_add result to the client. As the auth server has not
+ * seen a listener_add for a client accepted this way, it is marked so that no
+ * listener_remove is sent for it either.
+ */
+static auth_result url_cache_apply (url_cache_entry *entry, auth_client *auth_user)
+{
+    client_t *client = auth_user->client;
+
+    client->flags |= entry->flags;
+    if (entry->discon_time)
+        client->connection.discon.time = entry->discon_time;
+    if (entry->username)
+    {
+        free (client->username);
+        client->username = strdup (entry->username);
+    }
+    if (entry->mount)
+    {
+        free (auth_user->mount);
+        auth_user->mount = strdup (entry->mount);
+    }
+    if (entry->message)
+    {
+        auth_user->client = NULL;
+        client_send_403 (client, entry->message+4);
+    }
+    else
+        client->flags |= CLIENT_AUTH_CACHED;
+    return entry->result;
+}
+
+
 static void auth_url_clear(auth_t *self)
 {
     auth_url *url;
@@ -141,6 +425,9 @@ static void auth_url_clear(auth_t *self)
     INFO1 ("Doing auth URL cleanup for %s", self->mount);
     url = self->state;
     self->state = NULL;
+    while (url->cache.head)
+        url_cache_remove (&url->cache, url->cache.head);
+    free (url->cache.table);
     free (url->username);
     free (url->password);
     free (url->removeurl);
@@ -169,17 +456,17 @@ static int my_getpass(void *client, char *prompt, char *buffer, int buflen)
 
 static size_t handle_returned_header (void *ptr, size_t size, size_t nmemb, void *stream)
 {
-    auth_client *auth_user = stream;
+    url_request *req = stream;
+    auth_client *auth_user = req->auth_user;
     unsigned bytes = size * nmemb;
-    client_t *client = auth_user->client;
-    auth_thread_data *atd = auth_user->thread_data;
+    client_t *client = auth_user ? auth_user->client : NULL;
     char *header = (char *)ptr, *header_data;
 
-    if (bytes <= 1 || client == NULL)
+    if (bytes <= 1)
         return bytes;
     do
     {
-        auth_t *auth = auth_user->auth;
+        auth_t *auth = req->auth;
         auth_url *url = auth->state;
         int retcode = 0, header_datalen;
 
@@ -190,18 +477,22 @@ static size_t handle_returned_header (void *ptr, size_t size, size_t nmemb, void
             if (retcode == 403)
             {
                 char *p = strchr (ptr, ' ') + 1;
-                snprintf (atd->errormsg, sizeof(atd->errormsg), "%s", p);
-                p = strchr (atd->errormsg, '\r');
+                snprintf (req->errormsg, sizeof(req->errormsg), "%s", p);
+                p = strchr (req->errormsg, '\r');
                 if (p) *p='\0';
             }
             else if ((auth->flags & AUTH_SKIP_IF_SLOW) && retcode >= 400 && retcode < 600)
             {
-                snprintf (atd->errormsg, sizeof(atd->errormsg), "auth on %s disabled, response was \'%.200s...\'", auth->mount, header);
+                snprintf (req->errormsg, sizeof(req->errormsg), "auth on %s disabled, response was \'%.200s...\'", auth->mount, header);
                 url->stop_req_until = time (NULL) + url->stop_req_duration; /* prevent further attempts for a while */
-                client->flags |= CLIENT_AUTHENTICATED;
+                req->cache_age = 0;
+                if (client)
+                    client->flags |= CLIENT_AUTHENTICATED;
                 return bytes;
             }
         }
+        if (client == NULL)
+            return bytes;
         header_data = strchr (header, ':');
         if (header_data == NULL)
             return bytes;
@@ -231,6 +522,7 @@ static size_t handle_returned_header (void *ptr, size_t size, size_t nmemb, void
             unsigned int limit = 60;
             sscanf (header_data, "%u\r\n", &limit);
             client->connection.discon.time = time(NULL) + limit;
+            req->seen |= URL_SEEN_TIMELIMIT;
             break;
         }
         if (strncasecmp (header, "icecast-slave:", 14) == 0)
@@ -241,7 +533,7 @@ static size_t handle_returned_header (void *ptr, size_t size, size_t nmemb, void
 
         if (strncasecmp (header, "icecast-auth-message:", 21) == 0)
         {
-            snprintf (atd->errormsg, sizeof (atd->errormsg), "%.*s", header_datalen, header_data);
+            snprintf (req->errormsg, sizeof (req->errormsg), "%.*s", header_datalen, header_data);
             break;
         }
         if (strncasecmp (header, "ice-username:", 13) == 0)
@@ -252,15 +544,16 @@ static size_t handle_returned_header (void *ptr, size_t size, size_t nmemb, void
                 snprintf (name, header_datalen+1, "%s", header_data);
                 free (client->username);
                 client->username = name;
+                req->seen |= URL_SEEN_USERNAME;
             }
             break;
         }
         if (strncasecmp (header, "Location:", 9) == 0)
         {
-            free (atd->location);
-            atd->location = malloc (header_datalen+1);
-            if (atd->location)
-                snprintf (atd->location, header_datalen+1, "%s", header_data);
+            free (req->location);
+            req->location = malloc (header_datalen+1);
+            if (req->location)
+                snprintf (req->location, header_datalen+1, "%s", header_data);
             break;
         }
         if (strncasecmp (header, "Mountpoint:", 11) == 0)
@@ -271,9 +564,20 @@ static size_t handle_returned_header (void *ptr, size_t size, size_t nmemb, void
                 snprintf (mount, header_datalen+1, "%s", header_data);
                 free (auth_user->mount);
                 auth_user->mount = mount;
+                req->seen |= URL_SEEN_MOUNT;
             }
             break;
         }
+        if (strncasecmp (header, "cache-control:", 14) == 0)
+        {
+            const char *age = strstr (header_data, "max-age=");
+
+            if (strstr (header_data, "no-store") || strstr (header_data, "no-cache"))
+                req->cache_age = 0;
+            else if (age)
+                req->cache_age = atoi (age + 8);
+            break;
+        }
         if (strncasecmp (header, "content-type:", 13) == 0)
         {
             format_type_t type = format_get_type (header_data);
@@ -295,10 +599,10 @@ static size_t handle_returned_header (void *ptr, size_t size, size_t nmemb, void
 
 static size_t handle_returned_data (void *ptr, size_t size, size_t nmemb, void *stream)
 {
-    auth_client *auth_user = stream;
+    url_request *req = stream;
     unsigned bytes = size * nmemb;
-    client_t *client = auth_user->client;
-    refbuf_t *r = client->refbuf;
+    client_t *client = req->auth_user ? req->auth_user->client : NULL;
+    refbuf_t *r = client ? client->refbuf : NULL;
 
     if (client && client->respcode == 0 && r &&
          client->flags & CLIENT_HAS_INTRO_CONTENT)
@@ -343,11 +647,300 @@ static size_t handle_returned_data (void *ptr, size_t size, size_t nmemb, void *
 }
 
 
+/* take a spare request or set up a new one, the settings common to all the
+ * requests are only applied when the handle is created.
+ */
+static url_request *url_request_get (auth_thread_data *atd, auth_t *auth)
+{
+    url_request *req = atd->spare;
+
+    if (req)
+    {
+        atd->spare = req->next;
+        atd->spare_count--;
+        curl_easy_setopt (req->curl, CURLOPT_HTTPHEADER, NULL);
+    }
+    else
+    {
+        auth_url *url = auth->state;
+
+        req = calloc (1, sizeof (url_request));
+        if (req == NULL || (req->curl = curl_easy_init ()) == NULL)
+            abort();
+        curl_easy_setopt (req->curl, CURLOPT_USERAGENT, atd->server_id);
+        curl_easy_setopt (req->curl, CURLOPT_HEADERFUNCTION, handle_returned_header);
+        curl_easy_setopt (req->curl, CURLOPT_WRITEFUNCTION, handle_returned_data);
+        curl_easy_setopt (req->curl, CURLOPT_WRITEHEADER, req);
+        curl_easy_setopt (req->curl, CURLOPT_WRITEDATA, req);
+        curl_easy_setopt (req->curl, CURLOPT_PRIVATE, req);
+        curl_easy_setopt (req->curl, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt (req->curl, CURLOPT_TIMEOUT, (long)url->timeout);
+#ifdef CURLOPT_PASSWDFUNCTION
+        curl_easy_setopt (req->curl, CURLOPT_PASSWDFUNCTION, my_getpass);
+#endif
+        curl_easy_setopt (req->curl, CURLOPT_ERRORBUFFER, &req->errormsg[0]);
+        curl_easy_setopt (req->curl, CURLOPT_FOLLOWLOCATION, 1);
+#ifdef CURLOPT_POSTREDIR
+        curl_easy_setopt (req->curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
+#endif
+        if (auth->flags & AUTH_SKIP_IF_SLOW)
+            curl_easy_setopt (req->curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    }
+    req->next = NULL;
+    req->auth = auth;
+    req->auth_user = NULL;
+    req->cache_age = -1;
+    req->seen = 0;
+    req->errormsg[0] = '\0';
+    return req;
+}
+
+
+static void url_request_release (auth_thread_data *atd, url_request *req)
+{
+    free (req->location);
+    req->location = NULL;
+    req->auth_user = NULL;
+    if (atd->spare_count >= URL_SPARE_REQUESTS)
+    {
+        curl_easy_cleanup (req->curl);
+        free (req);
+        return;
+    }
+    req->next = atd->spare;
+    atd->spare = req;
+    atd->spare_count++;
+}
+
+
+static int url_request_start (auth_thread_data *atd, url_request *req)
+{
+    CURLMcode code = curl_multi_add_handle (atd->multi, req->curl);
+
+    if (code != CURLM_OK)
+    {
+        snprintf (req->errormsg, sizeof (req->errormsg), "%s", curl_multi_strerror (code));
+        return -1;
+    }
+    atd->active++;
+    return 0;
+}
+
+
+static void url_request_finish (auth_thread_data *atd, url_request *req, CURLcode res)
+{
+    auth_client *auth_user = req->auth_user;
+    auth_result result;
+
+    atd->outstanding--;
+    result = req->done (req, res);
+    url_request_release (atd, req);
+    if (auth_user)
+        auth_client_complete (auth_user, result);
+}
+
+
+/* hand the request to the multi handle, done is called from url_run_requests
+ * when the reply is in, and if an auth_user was attached to the request then
+ * it is completed after that. If the request cannot be started then done is
+ * called here and its result returned, else AUTH_PENDING.
+ *
+ * When all the connections are in use the request waits here rather than in
+ * libcurl, where the waiting time would count against the timeout.
+ */
+static auth_result url_request_send (auth_thread_data *atd, url_request *req, const char *url,
+        const char *post, auth_result (*done)(url_request *req, CURLcode res))
+{
+    auth_url *auth_url_info = req->auth->state;
+
+    curl_easy_setopt (req->curl, CURLOPT_URL, url);
+    curl_easy_setopt (req->curl, CURLOPT_COPYPOSTFIELDS, post);
+    req->url = url;
+    req->done = done;
+
+    if (atd->active < auth_url_info->connections)
+    {
+        if (url_request_start (atd, req) < 0)
+        {
+            auth_result result = done (req, CURLE_FAILED_INIT);
+            url_request_release (atd, req);
+            return result;
+        }
+    }
+    else
+    {
+        req->next = NULL;
+        *atd->waiting_tail = req;
+        atd->waiting_tail = &req->next;
+    }
+    atd->outstanding++;
+    return AUTH_PENDING;
+}
+
+
+static void url_reap_requests (auth_thread_data *atd, auth_t *auth)
+{
+    auth_url *url = auth->state;
+    CURLMsg *msg;
+    int remaining;
+
+    while ((msg = curl_multi_info_read (atd->multi, &remaining)))
+    {
+        CURL *curl = msg->easy_handle;
+        CURLcode res = msg->data.result;
+        url_request *req = NULL;
+
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+        /* msg is invalid after the handle is removed */
+        curl_easy_getinfo (curl, CURLINFO_PRIVATE, (char **)&req);
+        curl_multi_remove_handle (atd->multi, curl);
+        atd->active--;
+        url_request_finish (atd, req, res);
+    }
+    while (atd->waiting && atd->active < url->connections)
+    {
+        url_request *req = atd->waiting;
+
+        atd->waiting = req->next;
+        if (atd->waiting == NULL)
+            atd->waiting_tail = &atd->waiting;
+        req->next = NULL;
+        if (url_request_start (atd, req) < 0)
+            url_request_finish (atd, req, CURLE_FAILED_INIT);
+    }
+}
+
+
+static void url_wait_requests (auth_thread_data *atd, int wait_ms)
+{
+#if LIBCURL_VERSION_NUM >= 0x071c00
+    curl_multi_wait (atd->multi, NULL, 0, wait_ms, NULL);
+#else
+    fd_set rfds, wfds, efds;
+    struct timeval tv;
+    int max_fd = -1;
+    long timeout = -1;
+
+    curl_multi_timeout (atd->multi, &timeout);
+    if (timeout >= 0 && timeout < wait_ms)
+        wait_ms = timeout;
+    FD_ZERO (&rfds);
+    FD_ZERO (&wfds);
+    FD_ZERO (&efds);
+    curl_multi_fdset (atd->multi, &rfds, &wfds, &efds, &max_fd);
+    if (max_fd < 0)
+    {
+        thread_sleep (wait_ms * 1000);
+        return;
+    }
+    tv.tv_sec = wait_ms / 1000;
+    tv.tv_usec = (wait_ms % 1000) * 1000;
+    select (max_fd + 1, &rfds, &wfds, &efds, &tv);
+#endif
+}
+
+
+/* run from the auth thread, progress the outstanding requests and complete
+ * those that have finished.
+ */
+static int url_run_requests (auth_t *auth, void *thread_data, int wait_ms)
+{
+    auth_thread_data *atd = thread_data;
+    auth_url *url = auth->state;
+    int running;
+
+    if (atd->batch_count && timing_get_time() - atd->batch_start >= url->remove_wait)
+        url_remove_batch_send (atd, auth);
+    curl_multi_perform (atd->multi, &running);
+    url_reap_requests (atd, auth);
+    if (wait_ms && atd->outstanding)
+    {
+        url_wait_requests (atd, wait_ms);
+        curl_multi_perform (atd->multi, &running);
+        url_reap_requests (atd, auth);
+    }
+    else if (wait_ms && atd->batch_count)
+        thread_sleep (wait_ms * 1000);
+    /* a batch waiting to go keeps the auth thread running */
+    return atd->outstanding + (atd->batch_count ? 1 : 0);
+}
+
+
+static auth_result url_remove_listener_done (url_request *req, CURLcode res)
+{
+    auth_url *url = req->auth->state;
+
+    if (res)
+    {
+        WARN3 ("auth to server %s (%s) failed with \"%s\"", url->removeurl, req->auth->mount, req->errormsg);
+        url->stop_req_until = time (NULL) + url->stop_req_duration; /* prevent further attempts for a while */
+    }
+    return AUTH_OK;
+}
+
+
+/* post the collected listener_remove records, there is no per listener
+ * user/pass in this case.
+ */
+static void url_remove_batch_send (auth_thread_data *atd, auth_t *auth)
+{
+    auth_url *url = auth->state;
+    url_request *req;
+
+    if (atd->batch_count == 0)
+        return;
+    req = url_request_get (atd, auth);
+    if (url->userpwd && strchr (url->removeurl, '@') == NULL)
+        curl_easy_setopt (req->curl, CURLOPT_USERPWD, url->userpwd);
+    else
+        curl_easy_setopt (req->curl, CURLOPT_USERPWD, "");
+    curl_easy_setopt (req->curl, CURLOPT_HTTPHEADER, atd->batch_headers);
+
+    DEBUG2 ("sending %u listener_remove records for %s", atd->batch_count, auth->mount);
+    url_request_send (atd, req, url->removeurl, atd->batch, url_remove_listener_done);
+    atd->batch_len = 0;
+    atd->batch_count = 0;
+}
+
+
+static void url_remove_batch_add (auth_thread_data *atd, auth_t *auth, const char *record)
+{
+    auth_url *url = auth->state;
+    unsigned int len = strlen (record);
+
+    if (atd->batch_len + len + 2 > atd->batch_size)
+    {
+        unsigned int size = atd->batch_size ? atd->batch_size : 16384;
+
+        while (atd->batch_len + len + 2 > size)
+            size *= 2;
+        atd->batch = realloc (atd->batch, size);
+        if (atd->batch == NULL)
+            abort();
+        atd->batch_size = size;
+    }
+    if (atd->batch_count == 0)
+        atd->batch_start = timing_get_time();
+    memcpy (atd->batch + atd->batch_len, record, len);
+    atd->batch_len += len;
+    atd->batch [atd->batch_len++] = '\n';
+    atd->batch [atd->batch_len] = '\0';
+    atd->batch_count++;
+    if (atd->batch_count >= url->remove_batch)
+        url_remove_batch_send (atd, auth);
+}
+
+
+/* the departing client is not held for the reply, so the request is sent
+ * (or added to the batch) and the client released straight away.
+ */
 static auth_result url_remove_listener (auth_client *auth_user)
 {
     client_t *client = auth_user->client;
     auth_url *url = auth_user->auth->state;
     auth_thread_data *atd = auth_user->thread_data;
+    url_request *req;
     time_t now = time(NULL), duration = now - client->connection.con_time;
     char *username, *password, *mount, *server, *ipaddr, *user_agent;
     const char *qargs, *tmp;
@@ -355,6 +948,8 @@ static auth_result url_remove_listener (auth_client *auth_user)
 
     if (url->removeurl == NULL || client == NULL)
         return AUTH_OK;
+    if (client->flags & CLIENT_AUTH_CACHED)
+        return AUTH_OK;     /* no listener_add was sent for it */
     if (url->stop_req_until)
     {
         if (url->stop_req_until >= now)
@@ -396,10 +991,16 @@ static auth_result url_remove_listener (auth_client *auth_user)
     free (password);
     free (user_agent);
 
+    if (url->remove_batch > 1)
+    {
+        url_remove_batch_add (atd, auth_user->auth, post);
+        return AUTH_OK;
+    }
+    req = url_request_get (atd, auth_user->auth);
     if (strchr (url->removeurl, '@') == NULL)
     {
         if (url->userpwd)
-            curl_easy_setopt (atd->curl, CURLOPT_USERPWD, url->userpwd);
+            curl_easy_setopt (req->curl, CURLOPT_USERPWD, url->userpwd);
         else
         {
             /* auth'd requests may not have a user/pass, but may use query args */
@@ -408,51 +1009,121 @@ static auth_result url_remove_listener (auth_client *auth_user)
                 int len = strlen (client->username) + strlen (client->password) + 2;
                 userpwd = malloc (len);
                 snprintf (userpwd, len, "%s:%s", client->username, client->password);
-                curl_easy_setopt (atd->curl, CURLOPT_USERPWD, userpwd);
+                curl_easy_setopt (req->curl, CURLOPT_USERPWD, userpwd);
             }
             else
-                curl_easy_setopt (atd->curl, CURLOPT_USERPWD, "");
+                curl_easy_setopt (req->curl, CURLOPT_USERPWD, "");
         }
     }
     else
     {
         /* url has user/pass but libcurl may need to clear any existing settings */
-        curl_easy_setopt (atd->curl, CURLOPT_USERPWD, "");
+        curl_easy_setopt (req->curl, CURLOPT_USERPWD, "");
     }
-    curl_easy_setopt (atd->curl, CURLOPT_URL, url->removeurl);
-    curl_easy_setopt (atd->curl, CURLOPT_POSTFIELDS, post);
-    curl_easy_setopt (atd->curl, CURLOPT_WRITEHEADER, auth_user);
-    curl_easy_setopt (atd->curl, CURLOPT_WRITEDATA, auth_user);
 
     DEBUG2 ("...handler %d (%s) sending request", auth_user->handler, auth_user->mount);
-    if (curl_easy_perform (atd->curl))
-    {
-        WARN3 ("auth to server %s (%s) failed with \"%s\"", url->removeurl, auth_user->mount, atd->errormsg);
-        url->stop_req_until = time (NULL) + url->stop_req_duration; /* prevent further attempts for a while */
-    }
-    else
-        DEBUG2 ("...handler %d (%s) request complete", auth_user->handler, auth_user->mount);
-
+    url_request_send (atd, req, url->removeurl, post, url_remove_listener_done);
     free (userpwd);
 
     return AUTH_OK;
 }
 
 
+static auth_result url_add_listener_done (url_request *req, CURLcode res)
+{
+    auth_client *auth_user = req->auth_user;
+    client_t *client = auth_user->client;
+    auth_t *auth = req->auth;
+    auth_url *url = auth->state;
+    struct build_intro_contents *x = (void *)client->refbuf->data;
+    auth_result ret = AUTH_FAILED;
+
+    DEBUG2 ("handler %d (%s) request finished", auth_user->handler, auth_user->mount);
+
+    if (client->flags & CLIENT_AUTHENTICATED)
+    {
+        if (client->flags & CLIENT_HAS_INTRO_CONTENT)
+        {
+            client->refbuf->next = x->head;
+            DEBUG3 ("intro (%d) received %lu for %s", x->type, (unsigned long)x->intro_len, client->connection.ip);
+        }
+        if (x->head == NULL)
+            client->flags &= ~CLIENT_HAS_INTRO_CONTENT;
+        x->head = NULL;
+        ret = AUTH_OK;
+    }
+    if (res)
+    {
+        url->stop_req_until = time (NULL) + url->stop_req_duration; /* prevent further attempts for a while */
+        WARN3 ("auth to server %s (%s) failed with %s", url->addurl, auth_user->mount, req->errormsg);
+        INFO1 ("will not auth new listeners for %d seconds", url->stop_req_duration);
+        if (auth->flags & AUTH_SKIP_IF_SLOW)
+        {
+            client->flags |= CLIENT_AUTHENTICATED;
+            ret = AUTH_OK;
+        }
+    }
+    if (res == CURLE_OK)
+        url_cache_store (url, req, ret);
+    /* better cleanup memory */
+    while (x->head)
+    {
+        refbuf_t *n = x->head;
+        x->head = n->next;
+        n->next = NULL;
+        refbuf_release (n);
+    }
+    if (x->type)
+        mpeg_cleanup (&x->sync);
+    if (req->location)
+    {
+        client_send_302 (client, req->location);
+        auth_user->client = NULL;
+        free (req->location);
+        req->location = NULL;
+    }
+    else if (req->errormsg[0])
+    {
+        INFO3 ("listener %s (%s) returned \"%s\"", client->connection.ip, url->addurl, req->errormsg);
+        if (atoi (req->errormsg) == 403)
+        {
+            auth_user->client = NULL;
+            client_send_403 (client, req->errormsg+4);
+        }
+    }
+    return ret;
+}
+
+
 static auth_result url_add_listener (auth_client *auth_user)
 {
     client_t *client = auth_user->client;
     auth_t *auth = auth_user->auth;
     auth_url *url = auth->state;
     auth_thread_data *atd = auth_user->thread_data;
+    url_request *req;
 
-    int res = 0, ret = AUTH_FAILED, poffset = 0;
+    int ret, poffset = 0;
     struct build_intro_contents *x;
     char *userpwd = NULL, post [8192];
+    unsigned char key [HASH_LEN];
 
     if (url->addurl == NULL || client == NULL)
         return AUTH_OK;
 
+    if (url->cache.size)
+    {
+        url_cache_entry *entry;
+
+        url_cache_key (url, auth_user, key);
+        entry = url_cache_find (&url->cache, key, time (NULL));
+        if (entry)
+        {
+            DEBUG2 ("cached result used for listener #%" PRIu64 " on %s", client->connection.id, auth_user->mount);
+            return url_cache_apply (entry, auth_user);
+        }
+    }
+
     if (url->stop_req_until)
     {
         time_t now = time(NULL);
@@ -553,10 +1224,11 @@ static auth_result url_add_listener (auth_client *auth_user)
         }
     }
 
+    req = url_request_get (atd, auth_user->auth);
     if (strchr (url->addurl, '@') == NULL)
     {
         if (url->userpwd)
-            curl_easy_setopt (atd->curl, CURLOPT_USERPWD, url->userpwd);
+            curl_easy_setopt (req->curl, CURLOPT_USERPWD, url->userpwd);
         else
         {
             /* auth'd requests may not have a user/pass, but may use query args */
@@ -565,24 +1237,17 @@ static auth_result url_add_listener (auth_client *auth_user)
                 int len = strlen (client->username) + strlen (client->password) + 2;
                 userpwd = malloc (len);
                 snprintf (userpwd, len, "%s:%s", client->username, client->password);
-                curl_easy_setopt (atd->curl, CURLOPT_USERPWD, userpwd);
+                curl_easy_setopt (req->curl, CURLOPT_USERPWD, userpwd);
             }
             else
-                curl_easy_setopt (atd->curl, CURLOPT_USERPWD, "");
+                curl_easy_setopt (req->curl, CURLOPT_USERPWD, "");
         }
     }
     else
     {
         /* url has user/pass but libcurl may need to clear any existing settings */
-        curl_easy_setopt (atd->curl, CURLOPT_USERPWD, "");
-    }
-    curl_easy_setopt (atd->curl, CURLOPT_URL, url->addurl);
-    curl_easy_setopt (atd->curl, CURLOPT_POSTFIELDS, post);
-    curl_easy_setopt (atd->curl, CURLOPT_WRITEHEADER, auth_user);
-    curl_easy_setopt (atd->curl, CURLOPT_WRITEDATA, auth_user);
-    atd->errormsg[0] = '\0';
-    free (atd->location);
-    atd->location = NULL;
+        curl_easy_setopt (req->curl, CURLOPT_USERPWD, "");
+    }
     /* setup in case intro data is returned */
     x = (void *)client->refbuf->data;
     x->type = 0;
@@ -590,65 +1255,26 @@ static auth_result url_add_listener (auth_client *auth_user)
     x->intro_len = 0;
     x->tailp = &x->head;
 
+    req->auth_user = auth_user;
+    if (url->cache.size)
+        memcpy (req->cache_key, key, HASH_LEN);
     DEBUG2 ("handler %d (%s) sending request", auth_user->handler, auth_user->mount);
-    res = curl_easy_perform (atd->curl);
-    DEBUG2 ("handler %d (%s) request finished", auth_user->handler, auth_user->mount);
-
+    ret = url_request_send (atd, req, url->addurl, post, url_add_listener_done);
     free (userpwd);
 
-    if (client->flags & CLIENT_AUTHENTICATED)
-    {
-        if (client->flags & CLIENT_HAS_INTRO_CONTENT)
-        {
-            client->refbuf->next = x->head;
-            DEBUG3 ("intro (%d) received %lu for %s", x->type, (unsigned long)x->intro_len, client->connection.ip);
-        }
-        if (x->head == NULL)
-            client->flags &= ~CLIENT_HAS_INTRO_CONTENT;
-        x->head = NULL;
-        ret = AUTH_OK;
-    }
-    if (res)
-    {
-        url->stop_req_until = time (NULL) + url->stop_req_duration; /* prevent further attempts for a while */
-        WARN3 ("auth to server %s (%s) failed with %s", url->addurl, auth_user->mount, atd->errormsg);
-        INFO1 ("will not auth new listeners for %d seconds", url->stop_req_duration);
-        if (auth->flags & AUTH_SKIP_IF_SLOW)
-        {
-            client->flags |= CLIENT_AUTHENTICATED;
-            ret = AUTH_OK;
-        }
-    }
-    /* better cleanup memory */
-    while (x->head)
-    {
-        refbuf_t *n = x->head;
-        x->head = n->next;
-        n->next = NULL;
-        refbuf_release (n);
-    }
-    if (x->type)
-        mpeg_cleanup (&x->sync);
-    if (atd->location)
-    {
-        client_send_302 (client, atd->location);
-        auth_user->client = NULL;
-        free (atd->location);
-        atd->location = NULL;
-    }
-    else if (atd->errormsg[0])
-    {
-        INFO3 ("listener %s (%s) returned \"%s\"", client->connection.ip, url->addurl, atd->errormsg);
-        if (atoi (atd->errormsg) == 403)
-        {
-            auth_user->client = NULL;
-            client_send_403 (client, atd->errormsg+4);
-        }
-    }
     return ret;
 }
 
 
+/* mount_add and mount_remove replies are only checked for failure */
+static auth_result url_stream_done (url_request *req, CURLcode res)
+{
+    if (res)
+        WARN3 ("auth to server %s (%s) failed with %s", req->url, req->auth->mount, req->errormsg);
+    return AUTH_OK;
+}
+
+
 /* called by auth thread when a source starts, there is no client_t in
  * this case
  */
@@ -658,6 +1284,7 @@ static void url_stream_start (auth_client *auth_user)
     client_t *client = auth_user->client;
     auth_url *url = auth_user->auth->state;
     auth_thread_data *atd = auth_user->thread_data;
+    url_request *req;
     char post [4096];
 
     server = util_url_escape (auth_user->hostname);
@@ -680,24 +1307,19 @@ static void url_stream_start (auth_client *auth_user)
     free (server);
     free (mount);
 
+    req = url_request_get (atd, auth_user->auth);
     if (strchr (url->stream_start, '@') == NULL)
     {
         if (url->userpwd)
-            curl_easy_setopt (atd->curl, CURLOPT_USERPWD, url->userpwd);
+            curl_easy_setopt (req->curl, CURLOPT_USERPWD, url->userpwd);
         else
-            curl_easy_setopt (atd->curl, CURLOPT_USERPWD, "");
+            curl_easy_setopt (req->curl, CURLOPT_USERPWD, "");
     }
     else
-        curl_easy_setopt (atd->curl, CURLOPT_USERPWD, "");
-    curl_easy_setopt (atd->curl, CURLOPT_URL, url->stream_start);
-    curl_easy_setopt (atd->curl, CURLOPT_POSTFIELDS, post);
-    curl_easy_setopt (atd->curl, CURLOPT_WRITEHEADER, auth_user);
-    curl_easy_setopt (atd->curl, CURLOPT_WRITEDATA, auth_user);
+        curl_easy_setopt (req->curl, CURLOPT_USERPWD, "");
 
     DEBUG2 ("handler %d (%s) sending request", auth_user->handler, auth_user->mount);
-    if (curl_easy_perform (atd->curl))
-        WARN3 ("auth to server %s (%s) failed with %s", url->stream_start, auth_user->mount, atd->errormsg);
-    DEBUG2 ("handler %d (%s) request finished", auth_user->handler, auth_user->mount);
+    url_request_send (atd, req, url->stream_start, post, url_stream_done);
 }
 
 
@@ -707,6 +1329,7 @@ static void url_stream_end (auth_client *auth_user)
     client_t *client = auth_user->client;
     auth_url *url = auth_user->auth->state;
     auth_thread_data *atd = auth_user->thread_data;
+    url_request *req;
     char post [4096];
 
     server = util_url_escape (auth_user->hostname);
@@ -729,48 +1352,50 @@ static void url_stream_end (auth_client *auth_user)
     free (server);
     free (mount);
 
+    req = url_request_get (atd, auth_user->auth);
     if (strchr (url->stream_end, '@') == NULL)
     {
         if (url->userpwd)
-            curl_easy_setopt (atd->curl, CURLOPT_USERPWD, url->userpwd);
+            curl_easy_setopt (req->curl, CURLOPT_USERPWD, url->userpwd);
         else
-            curl_easy_setopt (atd->curl, CURLOPT_USERPWD, "");
+            curl_easy_setopt (req->curl, CURLOPT_USERPWD, "");
     }
     else
-        curl_easy_setopt (atd->curl, CURLOPT_USERPWD, "");
-    curl_easy_setopt (atd->curl, CURLOPT_URL, url->stream_end);
-    curl_easy_setopt (atd->curl, CURLOPT_POSTFIELDS, post);
-    curl_easy_setopt (atd->curl, CURLOPT_WRITEHEADER, auth_user);
-    curl_easy_setopt (atd->curl, CURLOPT_WRITEDATA, auth_user);
+        curl_easy_setopt (req->curl, CURLOPT_USERPWD, "");
 
     DEBUG2 ("handler %d (%s) sending request", auth_user->handler, auth_user->mount);
-    if (curl_easy_perform (atd->curl))
-        WARN3 ("auth to server %s (%s) failed with %s", url->stream_end, auth_user->mount, atd->errormsg);
-    DEBUG2 ("handler %d (%s) request finished", auth_user->handler, auth_user->mount);
+    url_request_send (atd, req, url->stream_end, post, url_stream_done);
+}
+
+
+static auth_result url_stream_auth_done (url_request *req, CURLcode res)
+{
+    auth_url *url = req->auth->state;
+
+    if (res)
+        WARN3 ("auth to server %s (%s) failed with %s", url->stream_auth, req->auth_user->mount, req->errormsg);
+    return AUTH_OK;
 }
 
 
-static void url_stream_auth (auth_client *auth_user)
+static auth_result url_stream_auth (auth_client *auth_user)
 {
     client_t *client = auth_user->client;
     auth_url *url = auth_user->auth->state;
     auth_thread_data *atd = auth_user->thread_data;
+    url_request *req = url_request_get (atd, auth_user->auth);
     char *mount, *host, *user, *pass, *ipaddr, *admin="";
     char post [4096];
 
     if (strchr (url->stream_auth, '@') == NULL)
     {
         if (url->userpwd)
-            curl_easy_setopt (atd->curl, CURLOPT_USERPWD, url->userpwd);
+            curl_easy_setopt (req->curl, CURLOPT_USERPWD, url->userpwd);
         else
-            curl_easy_setopt (atd->curl, CURLOPT_USERPWD, "");
+            curl_easy_setopt (req->curl, CURLOPT_USERPWD, "");
     }
     else
-        curl_easy_setopt (atd->curl, CURLOPT_USERPWD, "");
-    curl_easy_setopt (atd->curl, CURLOPT_URL, url->stream_auth);
-    curl_easy_setopt (atd->curl, CURLOPT_POSTFIELDS, post);
-    curl_easy_setopt (atd->curl, CURLOPT_WRITEHEADER, auth_user);
-    curl_easy_setopt (atd->curl, CURLOPT_WRITEDATA, auth_user);
+        curl_easy_setopt (req->curl, CURLOPT_USERPWD, "");
     if (strcmp (auth_user->mount, httpp_getvar (client->parser, HTTPP_VAR_URI)) != 0)
         admin = "&admin=1";
     mount = util_url_escape (auth_user->mount);
@@ -789,8 +1414,8 @@ static void url_stream_auth (auth_client *auth_user)
     free (host);
 
     client->flags &= ~CLIENT_AUTHENTICATED;
-    if (curl_easy_perform (atd->curl))
-        WARN3 ("auth to server %s (%s) failed with %s", url->stream_auth, auth_user->mount, atd->errormsg);
+    req->auth_user = auth_user;
+    return url_request_send (atd, req, url->stream_auth, post, url_stream_auth_done);
 }
 
 
@@ -817,22 +1442,14 @@ static void *alloc_thread_data (auth_t *auth)
     auth_url *url = auth->state;
     atd->server_id = strdup (config->server_id);
 
-    atd->curl = curl_easy_init ();
-    curl_easy_setopt (atd->curl, CURLOPT_USERAGENT, atd->server_id);
-    curl_easy_setopt (atd->curl, CURLOPT_HEADERFUNCTION, handle_returned_header);
-    curl_easy_setopt (atd->curl, CURLOPT_WRITEFUNCTION, handle_returned_data);
-    curl_easy_setopt (atd->curl, CURLOPT_NOSIGNAL, 1L);
-    curl_easy_setopt (atd->curl, CURLOPT_TIMEOUT, (long)url->timeout);
-#ifdef CURLOPT_PASSWDFUNCTION
-    curl_easy_setopt (atd->curl, CURLOPT_PASSWDFUNCTION, my_getpass);
+    atd->multi = curl_multi_init ();
+    atd->waiting_tail = &atd->waiting;
+    /* finished connections are cached for the next requests */
+    curl_multi_setopt (atd->multi, CURLMOPT_MAXCONNECTS, (long)url->connections);
+#if LIBCURL_VERSION_NUM >= 0x071e00
+    curl_multi_setopt (atd->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)url->connections);
 #endif
-    curl_easy_setopt (atd->curl, CURLOPT_ERRORBUFFER, &atd->errormsg[0]);
-    curl_easy_setopt (atd->curl, CURLOPT_FOLLOWLOCATION, 1);
-#ifdef CURLOPT_POSTREDIR
-    curl_easy_setopt (atd->curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-#endif
-    if (auth->flags & AUTH_SKIP_IF_SLOW)
-        curl_easy_setopt (atd->curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    atd->batch_headers = curl_slist_append (NULL, "Content-Type: text/plain");
     INFO0 ("...handler data initialized");
     return atd;
 }
@@ -841,7 +1458,17 @@ static void *alloc_thread_data (auth_t *auth)
 static void release_thread_data (auth_t *auth, void *thread_data)
 {
     auth_thread_data *atd = thread_data;
-    curl_easy_cleanup (atd->curl);
+
+    while (atd->spare)
+    {
+        url_request *req = atd->spare;
+        atd->spare = req->next;
+        curl_easy_cleanup (req->curl);
+        free (req);
+    }
+    curl_multi_cleanup (atd->multi);
+    curl_slist_free_all (atd->batch_headers);
+    free (atd->batch);
     free (atd->server_id);
     free (atd);
     DEBUG1 ("...handler destroyed for %s", auth->mount);
@@ -859,11 +1486,18 @@ int auth_get_url_auth (auth_t *authenticator, config_options_t *options)
     authenticator->listuser = auth_url_listuser;
     authenticator->alloc_thread_data = alloc_thread_data;
     authenticator->release_thread_data = release_thread_data;
+    authenticator->run_requests = url_run_requests;
+    authenticator->max_outstanding = 1000;
 
     url_info = calloc(1, sizeof(auth_url));
     url_info->auth_header = strdup ("icecast-auth-user:");
     url_info->timelimit_header = strdup ("icecast-auth-timelimit:");
     url_info->timeout = 5;
+    url_info->connections = 20;
+    url_info->cache_ttl = 30;
+    url_info->cache_failed_ttl = 10;
+    url_info->cache_key = URL_CACHE_KEY_IP|URL_CACHE_KEY_USER;
+    url_info->remove_wait = 1000;
     url_info->stop_req_duration = 60;
 
     while(options) {
@@ -932,6 +1566,40 @@ int auth_get_url_auth (auth_t *authenticator, config_options_t *options)
             int timeout = atoi (options->value);
             url_info->timeout = timeout > 0 ? timeout : 1;
         }
+        if (strcmp(options->name, "connections") == 0)
+        {
+            int connections = atoi (options->value);
+            url_info->connections = connections > 0 ? connections : 1;
+        }
+        if (strcmp(options->name, "max_requests") == 0)
+        {
+            int requests = atoi (options->value);
+            authenticator->max_outstanding = requests > 0 ? requests : 1;
+        }
+        if (strcmp(options->name, "listener_remove_batch") == 0)
+            url_info->remove_batch = atoi (options->value);
+        if (strcmp(options->name, "listener_remove_wait") == 0)
+        {
+            int ms = atoi (options->value);
+            url_info->remove_wait = ms > 0 ? ms : 1;
+        }
+        if (strcmp(options->name, "cache_size") == 0)
+        {
+            int size = atoi (options->value);
+            url_info->cache.size = size > 0 ? size : 0;
+        }
+        if (strcmp(options->name, "cache_ttl") == 0)
+            url_info->cache_ttl = atoi (options->value);
+        if (strcmp(options->name, "cache_failed_ttl") == 0)
+            url_info->cache_failed_ttl = atoi (options->value);
+        if (strcmp(options->name, "cache_key") == 0)
+        {
+            url_info->cache_key = 0;
+            if (strstr (options->value, "ip"))
+                url_info->cache_key |= URL_CACHE_KEY_IP;
+            if (strstr (options->value, "user"))
+                url_info->cache_key |= URL_CACHE_KEY_USER;
+        }
         if (strcmp(options->name, "on_error_wait") == 0)
         {
             int seconds = atoi (options->value);
@@ -945,6 +1613,15 @@ int auth_get_url_auth (auth_t *authenticator, config_options_t *options)
         options = options->next;
     }
 
+    if (url_info->cache.size)
+    {
+        unsigned int slots = 64;
+
+        while (slots < url_info->cache.size && slots < (1<<20))
+            slots <<= 1;
+        url_info->cache.table = calloc (slots, sizeof (url_cache_entry *));
+        url_info->cache.mask = slots - 1;
+    }
     if (url_info->auth_header)
         url_info->auth_header_len = strlen (url_info->auth_header);
     if (url_info->timelimit_header)
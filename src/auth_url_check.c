@@ -0,0 +1,399 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* auth_url_check.c
+**
+** Runs the URL auth request engine against a local HTTP stub, run by
+** "make check". The stub replies to each POST after a delay, accepting every
+** listener_add, and counts what it is sent. Listeners are queued as
+** auth_run_thread does. The stream details are not filled in, the parts of
+** the server auth_url.c calls for those are stubbed out here.
+**
+** Passes without checking anything if built without URL auth.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef HAVE_AUTH_URL
+
+int main (void)
+{
+    printf ("built without URL auth, skipped\n");
+    return 0;
+}
+
+#else
+
+#include "auth_url.c"
+
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define CHECK_DELAY_MS      20
+
+
+/* not used by the engine, these are just enough for auth_url.c to link */
+int errorlog;
+static ice_config_t check_config;
+ice_config_t *config_get_config (void) { return &check_config; }
+ice_config_t *config_get_config_unlocked (void) { return &check_config; }
+void config_release_config (void) { }
+void global_lock (void) { }
+void global_unlock (void) { }
+char *stats_get_value (const char *source, const char *name) { return NULL; }
+int client_send_302 (client_t *client, const char *location) { return 0; }
+int client_send_403 (client_t *client, const char *reason) { return 0; }
+format_type_t format_get_type (const char *contenttype) { return FORMAT_TYPE_UNDEFINED; }
+void mpeg_setup (mpeg_sync *mpsync, const char *mount) { }
+void mpeg_cleanup (mpeg_sync *mpsync) { }
+int  mpeg_complete_frames_cb (mpeg_sync *mp, sync_callback_t *cb, refbuf_t *new_block, unsigned offset) { return 0; }
+void mpeg_data_insert (mpeg_sync *mp, refbuf_t *inserted) { }
+int  mpeg_block_expanded (struct mpeg_sync *mp) { return 0; }
+
+
+/* what the stub has seen */
+static struct
+{
+    mutex_t lock;
+    int port;
+    int busy, busy_peak;
+    int posts, add_records, remove_records, remove_posts;
+} stub;
+
+static int completed, accepted;
+
+void auth_client_complete (auth_client *auth_user, auth_result result)
+{
+    completed++;
+    if (result == AUTH_OK && (auth_user->client->flags & CLIENT_AUTHENTICATED))
+        accepted++;
+}
+
+
+static int count_str (const char *s, const char *find)
+{
+    int n = 0;
+
+    while ((s = strstr (s, find)))
+    {
+        n++;
+        s += strlen (find);
+    }
+    return n;
+}
+
+
+/* one thread per connection, requests on it are handled in turn */
+static void *stub_connection (void *arg)
+{
+    int sock = (int)(intptr_t)arg;
+    char buf [1<<16];
+    unsigned int len = 0;
+
+    while (1)
+    {
+        char *end, *cl, reply [200];
+        unsigned int hdrlen, bodylen = 0;
+        int bytes, adds, removes;
+
+        buf [len] = '\0';
+        end = strstr (buf, "\r\n\r\n");
+        if (end == NULL)
+        {
+            if (len >= sizeof (buf) - 1)
+                break;
+            bytes = recv (sock, buf + len, sizeof (buf) - 1 - len, 0);
+            if (bytes <= 0)
+                break;
+            len += bytes;
+            continue;
+        }
+        hdrlen = end + 4 - buf;
+        cl = strstr (buf, "Content-Length:");   // as curl sends it
+        if (cl && cl < end)
+            bodylen = atoi (cl + 15);
+        if (hdrlen + bodylen >= sizeof (buf))
+            break;
+        while (len < hdrlen + bodylen)
+        {
+            bytes = recv (sock, buf + len, sizeof (buf) - 1 - len, 0);
+            if (bytes <= 0)
+                break;
+            len += bytes;
+        }
+        if (len < hdrlen + bodylen)
+            break;
+        buf [hdrlen + bodylen] = '\0';
+        adds = count_str (buf + hdrlen, "action=listener_add");
+        removes = count_str (buf + hdrlen, "action=listener_remove");
+
+        thread_mutex_lock (&stub.lock);
+        stub.posts++;
+        stub.add_records += adds;
+        stub.remove_records += removes;
+        if (removes)
+            stub.remove_posts++;
+        if (++stub.busy > stub.busy_peak)
+            stub.busy_peak = stub.busy;
+        thread_mutex_unlock (&stub.lock);
+
+        thread_sleep (CHECK_DELAY_MS * 1000);
+        snprintf (reply, sizeof reply, "HTTP/1.1 200 OK\r\n%sContent-Length: 0\r\n\r\n",
+                adds ? "icecast-auth-user: 1\r\n" : "");
+        bytes = send (sock, reply, strlen (reply), 0);
+
+        thread_mutex_lock (&stub.lock);
+        stub.busy--;
+        thread_mutex_unlock (&stub.lock);
+        if (bytes < 0)
+            break;
+
+        len -= hdrlen + bodylen;
+        memmove (buf, buf + hdrlen + bodylen, len);
+    }
+    close (sock);
+    return NULL;
+}
+
+
+static void *stub_accept (void *arg)
+{
+    int server = (int)(intptr_t)arg;
+
+    while (1)
+    {
+        int sock = accept (server, NULL, NULL);
+
+        if (sock < 0)
+            break;
+        thread_create ("stub connection", stub_connection, (void *)(intptr_t)sock, THREAD_DETACHED);
+    }
+    return NULL;
+}
+
+
+static int stub_start (void)
+{
+    struct sockaddr_in sa;
+    socklen_t salen = sizeof (sa);
+    int server = socket (AF_INET, SOCK_STREAM, 0);
+
+    memset (&sa, 0, sizeof (sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+    if (server < 0 || bind (server, (struct sockaddr *)&sa, sizeof (sa)) < 0 ||
+            listen (server, 512) < 0 || getsockname (server, (struct sockaddr *)&sa, &salen) < 0)
+    {
+        perror ("stub");
+        return -1;
+    }
+    thread_mutex_create (&stub.lock);
+    stub.port = ntohs (sa.sin_port);
+    thread_create ("stub accept", stub_accept, (void *)(intptr_t)server, THREAD_DETACHED);
+    return 0;
+}
+
+
+static void stub_reset (void)
+{
+    thread_mutex_lock (&stub.lock);
+    stub.busy_peak = stub.posts = stub.add_records = stub.remove_records = stub.remove_posts = 0;
+    thread_mutex_unlock (&stub.lock);
+}
+
+
+/* set up an authenticator on the stub, extra options are name=value pairs */
+static void check_auth_setup (auth_t *auth, const char **extra)
+{
+    static char addurl [100], removeurl [100];
+    config_options_t options [20], *opt = options;
+
+    memset (auth, 0, sizeof (*auth));
+    memset (options, 0, sizeof (options));
+    snprintf (addurl, sizeof addurl, "http://127.0.0.1:%d/add", stub.port);
+    snprintf (removeurl, sizeof removeurl, "http://127.0.0.1:%d/remove", stub.port);
+    opt->name = "listener_add";
+    opt->value = addurl;
+    opt->next = opt + 1;
+    opt++;
+    opt->name = "listener_remove";
+    opt->value = removeurl;
+    for (; *extra; extra += 2)
+    {
+        opt->next = opt + 1;
+        opt++;
+        opt->name = (char *)extra[0];
+        opt->value = (char *)extra[1];
+    }
+    auth->mount = "/check";
+    auth_get_url_auth (auth, options);
+}
+
+
+static void check_auth_clear (auth_t *auth)
+{
+    auth->release (auth);
+}
+
+
+/* listener_add for each, as auth_run_thread does, and a listener_remove for
+ * each but the last after its add is queued. The listeners are from
+ * different addresses unless same_ip is set. Returns the time taken in ms.
+ */
+static uint64_t check_run (auth_t *auth, int count, int same_ip)
+{
+    auth_client *users = calloc (count, sizeof (auth_client));
+    client_t *clients = calloc (count, sizeof (client_t));
+    void *atd = auth->alloc_thread_data (auth);
+    uint64_t start = timing_get_time();
+    int i, queued = 0, outstanding = 0;
+
+    completed = accepted = 0;
+    for (i = 0; i < count; i++)
+    {
+        char ip [20];
+
+        snprintf (ip, sizeof ip, "10.0.%d.%d", same_ip ? 0 : i/250, same_ip ? 1 : i%250 + 1);
+        clients[i].connection.ip = strdup (ip);
+        clients[i].connection.id = i + 1;
+        clients[i].connection.con_time = time (NULL);
+        clients[i].parser = httpp_create_parser ();
+        httpp_initialize (clients[i].parser, NULL);
+        clients[i].refbuf = refbuf_new (sizeof (struct build_intro_contents));
+        users[i].client = &clients[i];
+        users[i].auth = auth;
+        users[i].mount = strdup (auth->mount);
+        users[i].hostname = "localhost";
+        users[i].port = 8000;
+        users[i].thread_data = atd;
+    }
+    while (completed < count)
+    {
+        if (queued < count && outstanding < auth->max_outstanding)
+        {
+            auth_client *auth_user = &users [queued++];
+
+            if (auth->authenticate (auth_user) == AUTH_PENDING)
+                outstanding++;
+            else
+                auth_client_complete (auth_user, AUTH_OK);
+            if (queued < count)
+                auth->release_listener (auth_user);
+            continue;
+        }
+        outstanding = auth->run_requests (auth, atd, 10);
+    }
+    while (auth->run_requests (auth, atd, 10))
+        ;
+    auth->release_thread_data (auth, atd);
+    for (i = 0; i < count; i++)
+    {
+        free (clients[i].connection.ip);
+        httpp_destroy (clients[i].parser);
+        refbuf_release (clients[i].refbuf);
+        free (users[i].mount);
+    }
+    free (clients);
+    free (users);
+    return timing_get_time() - start;
+}
+
+
+static int failures;
+
+static void check (int ok, const char *what)
+{
+    printf ("  %s: %s\n", ok ? "ok" : "FAILED", what);
+    if (ok == 0)
+        failures++;
+}
+
+
+/* more requests than connections with a timeout shorter than all of them
+ * take, those waiting for a connection must not time out */
+static void check_burst (void)
+{
+    const char *extra[] = { "connections", "20", "timeout", "1", NULL };
+    auth_t auth;
+    uint64_t ms;
+
+    printf ("1000 listeners over 20 connections, 1s timeout\n");
+    stub_reset ();
+    check_auth_setup (&auth, extra);
+    ms = check_run (&auth, 1000, 0);
+    printf ("  %d posts in %" PRIu64 "ms, %d at once\n", stub.posts, ms, stub.busy_peak);
+    check (accepted == 1000, "all accepted");
+    check (stub.add_records == 1000 && stub.remove_records == 999, "all added and removed");
+    check (stub.busy_peak <= 20, "connections limit kept");
+    check (((auth_url *)auth.state)->stop_req_until == 0, "no time out");
+    check_auth_clear (&auth);
+}
+
+
+static void check_remove_batch (void)
+{
+    const char *extra[] = { "listener_remove_batch", "100", "listener_remove_wait", "200", NULL };
+    auth_t auth;
+
+    printf ("1000 listeners, listener_remove in batches of 100\n");
+    stub_reset ();
+    check_auth_setup (&auth, extra);
+    check_run (&auth, 1000, 0);
+    printf ("  %d remove posts\n", stub.remove_posts);
+    check (accepted == 1000, "all accepted");
+    check (stub.remove_records == 999, "all removed");
+    check (stub.remove_posts == 10, "removes batched");
+    check_auth_clear (&auth);
+}
+
+
+/* all from one address so all but the first are accepted from the cache */
+static void check_cache (void)
+{
+    const char *extra[] = { "cache_size", "10", "max_requests", "1", NULL };
+    auth_t auth;
+
+    printf ("10 listeners from one address with cache_size\n");
+    stub_reset ();
+    check_auth_setup (&auth, extra);
+    check_run (&auth, 10, 1);
+    check (accepted == 10, "all accepted");
+    check (stub.add_records == 1, "one listener_add");
+    check (stub.remove_records == 1, "no listener_remove for those from the cache");
+    check_auth_clear (&auth);
+}
+
+
+int main (void)
+{
+    thread_initialize ();
+    refbuf_initialize ();
+    curl_global_init (CURL_GLOBAL_ALL);
+    check_config.server_id = "auth_url_check";
+
+    if (stub_start () < 0)
+        return 1;
+    check_burst ();
+    check_remove_batch ();
+    check_cache ();
+
+    printf ("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+}
+
+#endif
@@ -780,6 +780,8 @@ static int _parse_accesslog (xmlNodePtr node, void *arg)
         return 2;
     if (type && strcmp (type, "CLF-ESC") == 0)
         log->type = LOG_ACCESS_CLF_ESC;
+    if (type && strcmp (type, "binary") == 0)
+        log->type = LOG_ACCESS_BINARY;
     xmlFree (type);
     return 0;
 }
@@ -987,6 +989,7 @@ static int _parse_paths (xmlNodePtr node, void *arg)
         { "ssl-cafile",             config_get_str, &config->ca_file },
         { "ssl_certificate",        config_get_str, &config->cert_file },
         { "ssl-allowed-ciphers",    config_get_str, &config->cipher_list },
+        { "ssl-ktls",               config_get_bool,&config->ssl_ktls },
         { "webroot",        config_get_str, &config->webroot_dir },
         { "adminroot",      config_get_str, &config->adminroot_dir },
         { "alias",          _parse_alias,   config },
@@ -1325,6 +1328,8 @@ static int _parse_limits (xmlNodePtr node, void *arg)
         { "min-queue-size", config_get_qsizing, &config->min_queue_size },
         { "burst-size",     config_get_qsizing, &config->burst_size },
         { "workers",        config_get_int,     &config->workers_count },
+        { "worker-epoll",   config_get_bool,    &config->worker_epoll },
+        { "worker-reuseport", config_get_bool,  &config->worker_reuseport },
         { "client-timeout", config_get_int,     &config->client_timeout },
         { "header-timeout", config_get_int,     &config->header_timeout },
         { "source-timeout", config_get_int,     &config->source_timeout },
@@ -1384,6 +1389,7 @@ static int _parse_listen_sock (xmlNodePtr node, void *arg)
         { "so-sndbuf",          config_get_int,     &listener->so_sndbuf },
 #ifndef _WIN32
         { "so-mss",             config_get_int,     &listener->so_mss },
+        { "so-notsent-lowat",   config_get_int,     &listener->notsent_lowat },
 #endif
         { "ssl",                config_get_bool,    &listener->ssl },
         { "shoutcast-mount",    config_get_str,     &listener->shoutcast_mount },
@@ -1443,6 +1449,7 @@ static int _parse_root (xmlNodePtr node, ice_config_t *config)
         { "port",               config_get_port,    &config->port },
         { "bind-address",       config_get_str,     &bindaddress },
         { "fileserve",          config_get_bool,    &config->fileserve },
+        { "fileserve-pacing",   config_get_bool,    &config->fileserve_pacing },
         { "relays-on-demand",   config_get_bool,    &config->on_demand },
         { "master-server",      config_get_str,     &config->master_server },
         { "master-username",    config_get_str,     &config->master_username },
@@ -56,6 +56,7 @@ typedef struct access_log
 
 #define LOG_ACCESS_CLF                  0
 #define LOG_ACCESS_CLF_ESC              1
+#define LOG_ACCESS_BINARY               2
 
 typedef struct error_log
 {
@@ -196,6 +197,7 @@ struct _listener_t
     int ssl;
     int so_sndbuf;
     int so_mss;
+    int notsent_lowat;
 };
 
 
@@ -257,6 +259,8 @@ typedef struct ice_config_tag
     unsigned int queue_size_limit;
     int min_queue_size;
     int workers_count;
+    int worker_epoll;
+    int worker_reuseport;
     uint32_t burst_size;
     int client_timeout;
     int header_timeout;
@@ -265,6 +269,7 @@ typedef struct ice_config_tag
     int64_t max_bandwidth;
     int max_listeners;
     int fileserve;
+    int fileserve_pacing;
     int on_demand; /* global setting for all relays */
 
     char *shoutcast_mount;
@@ -316,6 +321,7 @@ typedef struct ice_config_tag
     char *key_file;
     char *ca_file;
     char *cipher_list;
+    int ssl_ktls;
     char *webroot_dir;
     char *adminroot_dir;
     struct _aliases *aliases;
@@ -27,6 +27,12 @@
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
 
 #include "thread/thread.h"
 #include "avl/avl.h"
@@ -56,6 +62,14 @@ worker_t *worker_balance_to_check, *worker_least_used, *worker_incoming = NULL;
 FD_t logger_fd[2];
 
 static void logger_commits (int id);
+static void worker_control_write (worker_t *worker);
+static void worker_group_del (client_t *client);
+#ifdef HAVE_SYS_EPOLL_H
+static void worker_poll_control (worker_t *worker);
+static void worker_poll_writable (worker_t *worker, client_t *client);
+#else
+#define worker_poll_control(x)      do {} while (0)
+#endif
 
 
 void client_register (client_t *client)
@@ -390,7 +404,7 @@ int client_send_bytes (client_t *client, const void *buf, unsigned len)
     int (*con_send)(struct connection_tag *handle, const void *buf, size_t len) = connection_send;
     int ret;
 #ifdef HAVE_OPENSSL
-    if (client->connection.ssl)
+    if (connection_plain_send (&client->connection) == 0)
         con_send = connection_send_ssl;
 #endif
     ret = con_send (&client->connection, buf, len);
@@ -512,6 +526,7 @@ static void worker_add_client (worker_t *worker, client_t *client)
 {
     ++worker->pending_count;
     client->next_on_worker = NULL;
+    client->prevp_on_worker = worker->pending_clients_tail;
     *worker->pending_clients_tail = client;
     worker->pending_clients_tail = &client->next_on_worker;
     client->worker = worker;
@@ -527,7 +542,7 @@ int client_change_worker (client_t *client, worker_t *dest_worker)
     thread_spin_lock (&dest_worker->lock);
     worker_add_client (dest_worker, client);
     thread_spin_unlock (&dest_worker->lock);
-    worker_wakeup (dest_worker);
+    worker_control_write (dest_worker);
 
     return 1;
 }
@@ -545,7 +560,7 @@ void client_add_worker (client_t *client)
 
     worker_add_client (handler, client);
     thread_spin_unlock (&handler->lock);
-    worker_wakeup (handler);
+    worker_control_write (handler);
 }
 
 void client_add_incoming (client_t *client)
@@ -559,7 +574,7 @@ void client_add_incoming (client_t *client)
 
     worker_add_client (handler, client);
     thread_spin_unlock (&handler->lock);
-    worker_wakeup (handler);
+    worker_control_write (handler);
 }
 
 
@@ -595,6 +610,513 @@ void worker_control_create (FD_t wakeup_fd[])
 }
 
 
+/* Wakeups are coalesced, only the first since the worker last drained the
+ * feed does a write, others just see the flag set. These are full barriers
+ * so state changed before a wakeup is seen by the worker after the clear. */
+#ifdef __GNUC__
+#define worker_signal_set(w)        __sync_fetch_and_or (&(w)->signalled, 1)
+#define worker_signal_clear(w)      __sync_fetch_and_and (&(w)->signalled, 0)
+#define worker_counter_inc(x)       __sync_fetch_and_add (&(x), 1)
+#else
+#define worker_signal_set(w)        0
+#define worker_signal_clear(w)      do {} while (0)
+#define worker_counter_inc(x)       ((x)++)
+#endif
+
+
+/* use an eventfd for the worker control feed where possible, a single
+ * descriptor with a counter rather than a pipe pair */
+static void worker_control_open (worker_t *worker)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+    int fd = eventfd (0, EFD_NONBLOCK|EFD_CLOEXEC);
+
+    if (fd >= 0)
+    {
+        worker->wakeup_fd[0] = worker->wakeup_fd[1] = fd;
+        return;
+    }
+    WARN1 ("eventfd failed (%s), using pipe", strerror (errno));
+#endif
+    worker_control_create (&worker->wakeup_fd[0]);
+}
+
+
+static void worker_control_close (worker_t *worker)
+{
+    if (worker->wakeup_fd[1] != worker->wakeup_fd[0])
+        sock_close (worker->wakeup_fd[1]);
+    sock_close (worker->wakeup_fd[0]);
+}
+
+
+static void worker_control_read (worker_t *worker)
+{
+    char ca[100];
+    int ret;
+
+    do
+    {
+        ret = pipe_read (worker->wakeup_fd[0], ca, sizeof ca);
+        if (ret > 0)
+            break;
+        if (ret < 0 && sock_recoverable (sock_error()))
+            break;
+        worker_control_close (worker);
+        worker_control_open (worker);
+        worker_poll_control (worker);
+        worker_signal_clear (worker);
+        worker_wakeup (worker);
+        WARN0 ("Had to recreate worker control feed");
+    } while (1);
+    worker_signal_clear (worker);
+}
+
+
+/* Timing wheel. Active clients are filed by schedule_ms so that each pass only
+ * visits those that are due, rather than walking every client on the worker.
+ * Level 0 has a slot per ms, a slot on each higher level covers a whole lap of
+ * the level below and is cascaded down when time reaches it. Clients waiting
+ * on a source wakeup flag are also held in a group for that flag.
+ */
+struct worker_wake_group
+{
+    char *flag;
+    client_t *clients;
+    struct worker_wake_group *next;
+};
+
+#define WORKER_SWEEP_INTERVAL   1000
+#define WORKER_FANOUT_BATCH     64
+#define WHEEL_LN_MASK           ((1<<WORKER_WHEEL_LN_BITS)-1)
+#define WHEEL_L0_MASK           ((1<<WORKER_WHEEL_L0_BITS)-1)
+
+static int wheel_shift (int level)
+{
+    return level ? WORKER_WHEEL_L0_BITS + (level-1)*WORKER_WHEEL_LN_BITS : 0;
+}
+
+static client_t **wheel_slot (worker_t *worker, int level, uint64_t when)
+{
+    if (level == 0)
+        return &worker->wheel [when & WHEEL_L0_MASK];
+    return &worker->wheel [(1<<WORKER_WHEEL_L0_BITS) + ((level-1)<<WORKER_WHEEL_LN_BITS)
+        + ((when >> wheel_shift (level)) & WHEEL_LN_MASK)];
+}
+
+
+static void worker_wheel_add (worker_t *worker, client_t *client)
+{
+    uint64_t base = worker->wheel_ms + 1, when = client->schedule_ms;
+    client_t **slot;
+    int level = 0;
+
+    if (when < base)
+        when = base;
+    while (level < WORKER_WHEEL_LEVELS-1 && (when - base) >> wheel_shift (level+1))
+        level++;
+    if (level && (when - base) >> (wheel_shift (level) + WORKER_WHEEL_LN_BITS))
+        when = base + ((uint64_t)1 << (wheel_shift (level) + WORKER_WHEEL_LN_BITS)) - 1; // far off, recheck then
+    slot = wheel_slot (worker, level, when);
+
+    client->wheel_next = *slot;
+    if (*slot)
+        (*slot)->wheel_prevp = &client->wheel_next;
+    client->wheel_prevp = slot;
+    *slot = client;
+    worker->wheel_count++;
+}
+
+
+static void worker_wheel_del (worker_t *worker, client_t *client)
+{
+    if (client->wheel_prevp == NULL)
+        return;
+    *client->wheel_prevp = client->wheel_next;
+    if (client->wheel_next)
+        client->wheel_next->wheel_prevp = client->wheel_prevp;
+    client->wheel_prevp = NULL;
+    worker->wheel_count--;
+}
+
+
+/* move clients from the higher levels as time reaches their slot */
+static void worker_wheel_cascade (worker_t *worker, uint64_t tick)
+{
+    int level;
+
+    for (level = 1; level < WORKER_WHEEL_LEVELS; level++)
+    {
+        client_t **slot = wheel_slot (worker, level, tick), *client = *slot;
+
+        *slot = NULL;
+        while (client)
+        {
+            client_t *nx = client->wheel_next;
+            client->wheel_prevp = NULL;
+            worker->wheel_count--;
+            worker_wheel_add (worker, client);
+            client = nx;
+        }
+        if ((tick >> wheel_shift (level)) & WHEEL_LN_MASK)
+            break;
+    }
+}
+
+
+static void worker_run_append (client_t ***run_tail, client_t *client)
+{
+    client->wheel_next = NULL;
+    **run_tail = client;
+    *run_tail = &client->wheel_next;
+}
+
+
+/* take clients off the wheel that are due by the time given, they leave any
+ * wake group as well so worker_groups_check cannot queue them a second time */
+static void worker_wheel_expire (worker_t *worker, uint64_t upto, client_t ***run_tail)
+{
+    while (worker->wheel_ms < upto)
+    {
+        uint64_t tick = worker->wheel_ms + 1;
+        client_t **slot, *client;
+
+        if (worker->wheel_count == 0)
+        {
+            worker->wheel_ms = upto;
+            break;
+        }
+        if ((tick & WHEEL_L0_MASK) == 0)
+            worker_wheel_cascade (worker, tick);
+        slot = wheel_slot (worker, 0, tick);
+        client = *slot;
+        *slot = NULL;
+        while (client)
+        {
+            client_t *nx = client->wheel_next;
+            client->wheel_prevp = NULL;
+            worker->wheel_count--;
+            worker_group_del (client);
+            worker_run_append (run_tail, client);
+            client = nx;
+        }
+        worker->wheel_ms = tick;
+    }
+}
+
+
+/* time the wheel next needs attention, either a client is due or a cascade */
+static uint64_t worker_wheel_next (worker_t *worker)
+{
+    uint64_t base = worker->wheel_ms + 1, next = (uint64_t)-1;
+    int i, level;
+
+    if (worker->wheel_count == 0)
+        return next;
+    for (i = 0; i <= WHEEL_L0_MASK; i++)
+    {
+        if (worker->wheel [(base + i) & WHEEL_L0_MASK])
+        {
+            next = base + i;
+            break;
+        }
+    }
+    for (level = 1; level < WORKER_WHEEL_LEVELS; level++)
+    {
+        int shift = wheel_shift (level);
+        uint64_t lap = (base + ((uint64_t)1 << shift) - 1) >> shift;
+
+        for (i = 0; i <= WHEEL_LN_MASK; i++)
+        {
+            uint64_t when = (lap + i) << shift;
+            if (when >= next)
+                break;
+            if (*wheel_slot (worker, level, when))
+            {
+                next = when;
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+
+static void worker_group_add (worker_t *worker, client_t *client)
+{
+    struct worker_wake_group *group = worker->groups;
+
+    while (group && group->flag != client->wakeup)
+        group = group->next;
+    if (group == NULL)
+    {
+        group = calloc (1, sizeof (*group));
+        group->flag = client->wakeup;
+        group->next = worker->groups;
+        worker->groups = group;
+    }
+    client->wake_next = group->clients;
+    if (group->clients)
+        group->clients->wake_prevp = &client->wake_next;
+    client->wake_prevp = &group->clients;
+    group->clients = client;
+}
+
+
+static void worker_group_del (client_t *client)
+{
+    if (client->wake_prevp == NULL)
+        return;
+    *client->wake_prevp = client->wake_next;
+    if (client->wake_next)
+        client->wake_next->wake_prevp = client->wake_prevp;
+    client->wake_prevp = NULL;
+}
+
+
+/* file a client staying on the worker by when it next needs to run. Inactive
+ * clients are left out until another thread activates them and wakes us */
+static void worker_client_refile (worker_t *worker, client_t *client)
+{
+    if ((client->flags & CLIENT_ACTIVE) == 0)
+        return;
+    worker_wheel_add (worker, client);
+    if (client->wakeup && (client->flags & CLIENT_WRITE_WAIT) == 0)
+        worker_group_add (worker, client);
+}
+
+
+/* queue up clients whose wakeup flag has been set. Empty groups are dropped
+ * without looking at the flag as the source may of gone. Clients offering a
+ * fanout handler get the chance to be run as a batch first */
+static void worker_groups_check (worker_t *worker, client_t ***run_tail)
+{
+    struct worker_wake_group **groupp = &worker->groups;
+
+    while (*groupp)
+    {
+        struct worker_wake_group *group = *groupp;
+        client_t *client = group->clients;
+
+        if (client == NULL)
+        {
+            *groupp = group->next;
+            free (group);
+            continue;
+        }
+        if (*group->flag)
+        {
+            group->clients = NULL;
+            while (client)
+            {
+                client_t *batch [WORKER_FANOUT_BATCH];
+                int i, n = 0, done = 0;
+
+                for (; client && n < WORKER_FANOUT_BATCH; client = client->wake_next)
+                {
+                    client->wake_prevp = NULL;
+                    if (client->wheel_prevp == NULL)
+                        continue;   // off the wheel so already queued to run
+                    worker_wheel_del (worker, client);
+                    batch [n++] = client;
+                }
+                if (n > 1 && batch[0]->ops->fanout)
+                    done = batch[0]->ops->fanout (batch, n);
+                for (i = 0; i < n; i++)
+                {
+                    if (i < done)
+                    {
+#ifdef HAVE_SYS_EPOLL_H
+                        if (batch[i]->connection.wouldblock && worker->poll_writes &&
+                                worker->epoll_fd >= 0 && worker->running)
+                            worker_poll_writable (worker, batch [i]);
+#endif
+                        worker_client_refile (worker, batch [i]);
+                    }
+                    else
+                        worker_run_append (run_tail, batch [i]);
+                }
+            }
+        }
+        groupp = &group->next;
+    }
+}
+
+
+static void worker_wheel_reset (worker_t *worker)
+{
+    while (worker->groups)
+    {
+        struct worker_wake_group *group = worker->groups;
+        worker->groups = group->next;
+        free (group);
+    }
+    memset (worker->wheel, 0, sizeof (worker->wheel));
+    worker->wheel_count = 0;
+}
+
+
+#ifdef HAVE_SYS_EPOLL_H
+#define WORKER_POLL_EVENTS      256
+#define WORKER_POLL_BACKSTOP    1000
+
+/* Optional readiness mode. Clients whose last send was short are not
+ * scheduled by time alone, the socket is registered (oneshot) for write
+ * readiness and the client is left until the kernel reports space or a
+ * backstop timer expires. A registration is only ever armed while the
+ * client sits idle on this worker, so event data can refer to the client.
+ */
+static void worker_poll_create (worker_t *worker)
+{
+    worker->epoll_fd = epoll_create1 (EPOLL_CLOEXEC);
+    if (worker->epoll_fd < 0)
+    {
+        WARN1 ("epoll unavailable (%s), using timed scheduling", strerror (errno));
+        return;
+    }
+    worker_poll_control (worker);
+}
+
+
+static void worker_poll_control (worker_t *worker)
+{
+    struct epoll_event ev;
+
+    if (worker->epoll_fd < 0)
+        return;
+    ev.events = EPOLLIN;
+    ev.data.ptr = worker;
+    if (epoll_ctl (worker->epoll_fd, EPOLL_CTL_ADD, worker->wakeup_fd[0], &ev) < 0)
+    {
+        ERROR1 ("unable to poll worker control feed (%s)", strerror (errno));
+        close (worker->epoll_fd);
+        worker->epoll_fd = -1;
+    }
+}
+
+
+static void worker_poll_writable (worker_t *worker, client_t *client)
+{
+    struct epoll_event ev;
+    int op = (client->flags & CLIENT_IN_POLLSET) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+    ev.events = EPOLLOUT | EPOLLONESHOT;
+    ev.data.ptr = client;
+    if (epoll_ctl (worker->epoll_fd, op, client->connection.sock, &ev) < 0)
+    {
+        // registration dropped on a socket close or left from an earlier stay on this worker
+        if (errno == ENOENT)
+            op = EPOLL_CTL_ADD;
+        else if (errno == EEXIST)
+            op = EPOLL_CTL_MOD;
+        else
+            op = 0;
+        if (op == 0 || epoll_ctl (worker->epoll_fd, op, client->connection.sock, &ev) < 0)
+        {
+            client->flags &= ~CLIENT_IN_POLLSET;
+            return;     // stay on the timed schedule
+        }
+    }
+    client->flags |= (CLIENT_WRITE_WAIT|CLIENT_IN_POLLSET);
+    if (client->schedule_ms < worker->time_ms + WORKER_POLL_BACKSTOP)
+        client->schedule_ms = worker->time_ms + WORKER_POLL_BACKSTOP;
+}
+
+
+/* client is to run before the socket reported writable, so disarm it */
+static void worker_poll_cancel (worker_t *worker, client_t *client)
+{
+    struct epoll_event ev;
+
+    memset (&ev, 0, sizeof (ev));
+    epoll_ctl (worker->epoll_fd, EPOLL_CTL_DEL, client->connection.sock, &ev);
+    client->flags &= ~(CLIENT_WRITE_WAIT|CLIENT_IN_POLLSET);
+}
+
+
+/* accept mode, the worker has its own listening sockets and new clients go
+ * straight on to its pending list */
+static void worker_listen_update (worker_t *worker)
+{
+    struct epoll_event ev;
+    int i;
+
+    if (worker->running == 0)
+    {
+        connection_worker_sockets_close (worker);
+        return;
+    }
+    if (worker->listen_gen == global.server_sockets_gen)
+        return;
+    if (connection_worker_sockets (worker) == 0)
+        return;
+    for (i = 0; i < worker->listen_count; i++)
+    {
+        ev.events = EPOLLIN;
+        ev.data.ptr = &worker->listen_sock [i];
+        if (epoll_ctl (worker->epoll_fd, EPOLL_CTL_ADD, worker->listen_sock [i], &ev) < 0)
+            WARN1 ("unable to poll worker listening socket (%s)", strerror (errno));
+    }
+}
+
+
+static void worker_listen_accept (worker_t *worker, int idx)
+{
+    int loop = 32;
+
+    while (loop-- && worker->running)
+    {
+        client_t *client = connection_worker_accept (worker, idx);
+        if (client == NULL)
+            break;
+        thread_spin_lock (&worker->lock);
+        worker_add_client (worker, client);
+        thread_spin_unlock (&worker->lock);
+    }
+}
+
+
+/* wait for the control feed or sockets, return the number of clients made ready */
+static int worker_poll_wait (worker_t *worker, int duration)
+{
+    struct epoll_event events [WORKER_POLL_EVENTS];
+    int i, ret, ready = 0;
+
+    do
+    {
+        ret = epoll_wait (worker->epoll_fd, events, WORKER_POLL_EVENTS, duration);
+        if (ret > 0 && ready == 0)
+            worker->time_ms = timing_get_time();
+        for (i = 0; i < ret; i++)
+        {
+            client_t *client;
+
+            if (events[i].data.ptr == worker)
+            {
+                worker_control_read (worker);
+                continue;
+            }
+            if (worker->listen_count && (sock_t*)events[i].data.ptr >= worker->listen_sock &&
+                    (sock_t*)events[i].data.ptr < worker->listen_sock + worker->listen_count)
+            {
+                worker_listen_accept (worker, (sock_t*)events[i].data.ptr - worker->listen_sock);
+                continue;
+            }
+            client = events[i].data.ptr;
+            client->flags &= ~CLIENT_WRITE_WAIT;
+            client->schedule_ms = worker->time_ms;
+            worker_wheel_del (worker, client);
+            worker_wheel_add (worker, client);
+            ready++;
+        }
+        duration = 0;
+    } while (ret == WORKER_POLL_EVENTS);
+
+    return ready;
+}
+#endif
+
+
 static client_t **worker_add_pending_clients (worker_t *worker)
 {
     thread_spin_lock (&worker->lock);
@@ -604,6 +1126,7 @@ static client_t **worker_add_pending_clients (worker_t *worker)
         client_t **p;
 
         p = worker->last_p;
+        worker->pending_clients->prevp_on_worker = worker->last_p;
         *worker->last_p = worker->pending_clients;
         worker->last_p = worker->pending_clients_tail;
         worker->count += worker->pending_count;
@@ -616,16 +1139,17 @@ static client_t **worker_add_pending_clients (worker_t *worker)
         return p;  /* only these new ones scheduled so process from here */
     }
     thread_spin_unlock (&worker->lock);
-    worker->wakeup_ms = worker->time_ms + 60000;
-    return &worker->clients;
+    return NULL;
 }
 
 
-// enter with spin lock enabled, exit without
+// enter with spin lock enabled, exit without. Returns where to start a walk
+// of the clients list from or NULL if the wheel alone is enough
 //
 static client_t **worker_wait (worker_t *worker)
 {
-    int ret, duration = 2;
+    int duration = 2;
+    client_t **prevp;
 
     if (worker->running)
     {
@@ -637,29 +1161,26 @@ static client_t **worker_wait (worker_t *worker)
     }
     thread_spin_unlock (&worker->lock);
 
-    ret = util_timed_wait_for_fd (worker->wakeup_fd[0], duration);
-    if (ret > 0) /* may of been several wakeup attempts */
-    {
-        char ca[100];
-        do
-        {
-            ret = pipe_read (worker->wakeup_fd[0], ca, sizeof ca);
-            if (ret > 0)
-                break;
-            if (ret < 0 && sock_recoverable (sock_error()))
-                break;
-            sock_close (worker->wakeup_fd[1]);
-            sock_close (worker->wakeup_fd[0]);
-            worker_control_create (&worker->wakeup_fd[0]);
-            worker_wakeup (worker);
-            WARN0 ("Had to recreate worker control feed");
-        } while (1);
-    }
+#ifdef HAVE_SYS_EPOLL_H
+    if (worker->epoll_fd >= 0)
+        worker_poll_wait (worker, duration);
+    else
+#endif
+    if (util_timed_wait_for_fd (worker->wakeup_fd[0], duration) > 0) /* may of been several wakeup attempts */
+        worker_control_read (worker);
 
     worker->time_ms = timing_get_time();
     worker->current_time.tv_sec = (time_t)(worker->time_ms/1000);
 
-    return worker_add_pending_clients (worker);
+    prevp = worker_add_pending_clients (worker);
+    if (worker->rescan || worker->running == 0 || worker->sweep_ms <= worker->time_ms)
+    {
+        // another thread may of changed client state, so check them all
+        worker->rescan = 0;
+        worker->sweep_ms = worker->time_ms + WORKER_SWEEP_INTERVAL;
+        prevp = &worker->clients;
+    }
+    return prevp;
 }
 
 
@@ -667,17 +1188,28 @@ static void worker_relocate_clients (worker_t *worker)
 {
     if (workers == NULL)
         return;
+#ifdef HAVE_SYS_EPOLL_H
+    if (worker->epoll_fd >= 0)
+    {
+        close (worker->epoll_fd);
+        worker->epoll_fd = -1;
+    }
+#endif
     while (worker->count || worker->pending_count)
     {
         client_t *client = worker->clients, **prevp = &worker->clients;
 
+        worker_wheel_reset (worker);
         worker->wakeup_ms = worker->time_ms + 150;
         worker->current_time.tv_sec = (time_t)(worker->time_ms/1000);
         while (client)
         {
+            client->wheel_prevp = client->wake_prevp = NULL;
             if (client->flags & CLIENT_ACTIVE)
             {
+                client->flags &= ~(CLIENT_WRITE_WAIT|CLIENT_IN_POLLSET);
                 client->worker = workers;
+                client->prevp_on_worker = prevp;
                 prevp = &client->next_on_worker;
             }
             else
@@ -691,11 +1223,12 @@ static void worker_relocate_clients (worker_t *worker)
         if (worker->clients)
         {
             thread_spin_lock (&workers->lock);
+            worker->clients->prevp_on_worker = workers->pending_clients_tail;
             *workers->pending_clients_tail = worker->clients;
             workers->pending_clients_tail = prevp;
             workers->pending_count += worker->count;
             thread_spin_unlock (&workers->lock);
-            worker_wakeup (workers);
+            worker_control_write (workers);
             worker->clients = NULL;
             worker->last_p = &worker->clients;
             worker->count = 0;
@@ -705,81 +1238,149 @@ static void worker_relocate_clients (worker_t *worker)
     }
 }
 
+
+/* process client details but skip those that are not ready yet */
+static int worker_client_due (worker_t *worker, client_t *client, uint64_t sched_ms, unsigned c)
+{
+    if ((client->flags & CLIENT_ACTIVE) == 0)
+        return 0;
+    if (worker->running == 0)  // force all active clients to run on worker shutdown
+        return 1;
+    if (client->schedule_ms <= sched_ms)
+    {
+        if (c > 9000 && client->wakeup == NULL)
+            return 0;
+        return 1;
+    }
+    if (client->wakeup == NULL || *client->wakeup == 0 || (client->flags & CLIENT_WRITE_WAIT))
+        return 0;
+    return 1;
+}
+
+
+/* walk the clients list, queueing those that are due and filing any not on
+ * the wheel, eg new or reactivated clients */
+static void worker_sweep (worker_t *worker, client_t **prevp, uint64_t sched_ms, client_t ***run_tail)
+{
+    client_t *client = *prevp;
+
+    while (client)
+    {
+        if (client->worker != worker) abort();
+        if (worker_client_due (worker, client, sched_ms, 0))
+        {
+            worker_wheel_del (worker, client);
+            worker_group_del (client);
+            worker_run_append (run_tail, client);
+        }
+        else if (client->wheel_prevp == NULL)
+            worker_client_refile (worker, client);
+        client = client->next_on_worker;
+    }
+}
+
+
+static unsigned worker_run (worker_t *worker, client_t *client, uint64_t sched_ms, unsigned c)
+{
+    while (client)
+    {
+        client_t *run_next = client->wheel_next;
+        int ret = 0;
+
+        if (client->worker != worker) abort();
+        worker_group_del (client);
+        if (worker_client_due (worker, client, sched_ms, c) == 0)
+        {
+            worker_client_refile (worker, client);
+            client = run_next;
+            continue;
+        }
+        client_t **prevp = client->prevp_on_worker, *nx = client->next_on_worker;
+
+        if ((c & 511) == 0)
+        {
+            // update these periodically to keep in sync
+            worker->time_ms = worker_check_time_ms (worker);
+            worker->current_time.tv_sec = (time_t)(worker->time_ms/1000);
+        }
+        c++;
+#ifdef HAVE_SYS_EPOLL_H
+        if (client->flags & CLIENT_WRITE_WAIT)
+            worker_poll_cancel (worker, client);
+#endif
+        client->connection.wouldblock = 0;
+        errno = 0;
+        ret = client->ops->process (client);
+        if (ret < 0)
+        {
+            client->worker = NULL;
+            if (client->ops->release)
+                client->ops->release (client);
+        }
+        if (ret)
+        {
+            thread_spin_lock (&worker->lock);
+            worker->count--;
+            *prevp = nx;
+            if (nx)
+                nx->prevp_on_worker = prevp;
+            else /* is this the last client */
+                worker->last_p = prevp;
+            thread_spin_unlock (&worker->lock);
+            client = run_next;
+            continue;
+        }
+#ifdef HAVE_SYS_EPOLL_H
+        if (client->connection.wouldblock && (client->flags & CLIENT_ACTIVE) &&
+                worker->poll_writes && worker->epoll_fd >= 0 && worker->running)
+            worker_poll_writable (worker, client);
+#endif
+        worker_client_refile (worker, client);
+        client = run_next;
+    }
+    return c;
+}
+
+
 void *worker (void *arg)
 {
     worker_t *worker = arg;
     long prev_count = -1;
     client_t **prevp = &worker->clients;
-    uint64_t c = 0;
 
     thread_rwlock_rlock (&global.workers_rw);
+    refbuf_cache_create ();
+    logging_access_buffer_create ();
     worker->running = 1;
     worker->wakeup_ms = (int64_t)0;
     worker->time_ms = timing_get_time();
+    worker->wheel_ms = worker->time_ms;
+    worker->sweep_ms = worker->time_ms + WORKER_SWEEP_INTERVAL;
 
     while (1)
     {
-        client_t *client = *prevp;
         uint64_t sched_ms = worker->time_ms + 12;
+        client_t *run = NULL, **run_tail = &run;
+        unsigned c;
 
-        c = 0;
-        while (client)
-        {
-            if (client->worker != worker) abort();
-            /* process client details but skip those that are not ready yet */
-            if (client->flags & CLIENT_ACTIVE)
-            {
-                int ret = 0;
-                client_t *nx = client->next_on_worker;
+#ifdef HAVE_SYS_EPOLL_H
+        if (worker->accept)
+            worker_listen_update (worker);
+#endif
+        if (prevp)
+            worker_sweep (worker, prevp, sched_ms, &run_tail);
+        worker_wheel_expire (worker, sched_ms, &run_tail);
+        worker_groups_check (worker, &run_tail);
+        c = worker_run (worker, run, sched_ms, 0);
 
-                int process = 1;
-                if (worker->running)  // force all active clients to run on worker shutdown
-                {
-                    if (client->schedule_ms <= sched_ms)
-                    {
-                        if (c > 9000 && client->wakeup == NULL)
-                            process = 0;
-                    }
-                    else if (client->wakeup == NULL || *client->wakeup == 0)
-                    {
-                        process = 0;
-                    }
-                }
+        // pick up those waiting on a flag set during this pass
+        run = NULL;
+        run_tail = &run;
+        worker_groups_check (worker, &run_tail);
+        worker_run (worker, run, sched_ms, c);
+
+        logging_access_flush (worker->current_time.tv_sec, 0);
 
-                if (process)
-                {
-                    if ((c & 511) == 0)
-                    {
-                        // update these periodically to keep in sync
-                        worker->time_ms = worker_check_time_ms (worker);
-                        worker->current_time.tv_sec = (time_t)(worker->time_ms/1000);
-                    }
-                    c++;
-                    errno = 0;
-                    ret = client->ops->process (client);
-                    if (ret < 0)
-                    {
-                        client->worker = NULL;
-                        if (client->ops->release)
-                            client->ops->release (client);
-                    }
-                    if (ret)
-                    {
-                        thread_spin_lock (&worker->lock);
-                        worker->count--;
-                        if (nx == NULL) /* is this the last client */
-                            worker->last_p = prevp;
-                        client = *prevp = nx;
-                        thread_spin_unlock (&worker->lock);
-                        continue;
-                    }
-                }
-                if ((client->flags & CLIENT_ACTIVE) && client->schedule_ms < worker->wakeup_ms)
-                    worker->wakeup_ms = client->schedule_ms;
-            }
-            prevp = &client->next_on_worker;
-            client = *prevp;
-        }
         if (prev_count != worker->count)
         {
             DEBUG2 ("%p now has %d clients", worker, worker->count);
@@ -791,16 +1392,51 @@ void *worker (void *arg)
             if (worker->count == 0 && worker->pending_count == 0)
                 break;
         }
+        worker->wakeup_ms = worker_wheel_next (worker);
+        if (worker->wakeup_ms > worker->sweep_ms)
+            worker->wakeup_ms = worker->sweep_ms;
         prevp = worker_wait (worker);
     }
     thread_spin_unlock (&worker->lock);
+    connection_worker_sockets_close (worker);
+    worker_wheel_reset (worker);
     worker_relocate_clients (worker);
+    logging_access_flush (0, 1);
     INFO0 ("shutting down");
     thread_rwlock_unlock (&global.workers_rw);
     return NULL;
 }
 
 
+/* wakeup counters for each worker, in the global stats */
+static void worker_stat (const char *name, uint64_t count, int update)
+{
+    char value[24];
+
+    if (update == 0)
+    {
+        stats_event (NULL, name, NULL);
+        return;
+    }
+    snprintf (value, sizeof value, "%" PRIu64, count);
+    stats_event_flags (NULL, name, value, STATS_COUNTERS);
+}
+
+static void worker_stats (worker_t *worker, int update)
+{
+    char name[40];
+    int len;
+
+    if (worker->id < 0)
+        len = snprintf (name, sizeof name, "worker_incoming_wakeups");
+    else
+        len = snprintf (name, sizeof name, "worker%d_wakeups", worker->id);
+    worker_stat (name, worker->wakeups, update);
+    snprintf (name+len, sizeof name - len, "_suppressed");
+    worker_stat (name, worker->wakeups_suppressed, update);
+}
+
+
 // We pick a worker (consequetive) and set a max number of clients to move if needed
 void worker_balance_trigger (time_t now)
 {
@@ -822,6 +1458,17 @@ void worker_balance_trigger (time_t now)
         if (worker_balance_to_check == NULL)
             worker_balance_to_check = workers;
     }
+    if ((now & 7) == 0)
+    {
+        worker_t *w = workers;
+        while (w)
+        {
+            worker_stats (w, 1);
+            w = w->next;
+        }
+        if (worker_incoming)
+            worker_stats (worker_incoming, 1);
+    }
     thread_rwlock_unlock (&workers_lock);
 }
 
@@ -829,8 +1476,16 @@ void worker_balance_trigger (time_t now)
 static void worker_start (void)
 {
     worker_t *handler = calloc (1, sizeof(worker_t));
-
-    worker_control_create (&handler->wakeup_fd[0]);
+    ice_config_t *config = config_get_config_unlocked();   // config lock held by caller
+
+    worker_control_open (handler);
+#ifdef HAVE_SYS_EPOLL_H
+    handler->epoll_fd = -1;
+    handler->poll_writes = config->worker_epoll;
+    if (config->worker_epoll || config->worker_reuseport)
+        worker_poll_create (handler);
+#endif
+    handler->listen_gen = -1;
 
     handler->pending_clients_tail = &handler->pending_clients;
     thread_spin_create (&handler->lock);
@@ -840,6 +1495,7 @@ static void worker_start (void)
     if (worker_incoming == NULL)
     {
         worker_incoming = handler;
+        handler->id = -1;
         handler->move_allocations = 1000000;    // should stay fixed for this one
         handler->thread = thread_create ("worker", worker, handler, THREAD_ATTACHED);
         thread_rwlock_unlock (&workers_lock);
@@ -847,6 +1503,11 @@ static void worker_start (void)
         worker_start();  // single level recursion, just get a special worker thread set up
         return;
     }
+    handler->id = worker_count;
+#ifdef HAVE_SYS_EPOLL_H
+    if (config->worker_reuseport && handler->epoll_fd >= 0)
+        handler->accept = 1;
+#endif
     handler->next = workers;
     workers = handler;
     worker_count++;
@@ -891,9 +1552,13 @@ static void worker_stop (void)
 
             thread_join (handler->thread);
             thread_spin_destroy (&handler->lock);
+            worker_stats (handler, 0);
 
-            sock_close (handler->wakeup_fd[1]);
-            sock_close (handler->wakeup_fd[0]);
+            worker_control_close (handler);
+#ifdef HAVE_SYS_EPOLL_H
+            if (handler->epoll_fd >= 0)
+                close (handler->epoll_fd);
+#endif
             free (handler);
             thread_rwlock_wlock (&workers_lock);
         }
@@ -915,12 +1580,36 @@ void workers_adjust (int new_count)
 }
 
 
-void worker_wakeup (worker_t *worker)
+/* used when adding clients, only the new ones need to be checked */
+static void worker_control_write (worker_t *worker)
 {
+    if (worker_signal_set (worker))
+    {
+        worker_counter_inc (worker->wakeups_suppressed);
+        return;
+    }
+    worker_counter_inc (worker->wakeups);
+#ifdef HAVE_SYS_EVENTFD_H
+    if (worker->wakeup_fd[1] == worker->wakeup_fd[0])
+    {
+        uint64_t v = 1;
+        if (write (worker->wakeup_fd[1], &v, sizeof v) < 0)
+            worker_signal_clear (worker);
+        return;
+    }
+#endif
     pipe_write (worker->wakeup_fd[1], "W", 1);
 }
 
 
+/* client state on the worker has been changed by another thread */
+void worker_wakeup (worker_t *worker)
+{
+    worker->rescan = 1;
+    worker_control_write (worker);
+}
+
+
 static void logger_commits (int id)
 {
     pipe_write (logger_fd[1], "L", 1);
@@ -938,7 +1627,11 @@ static void *log_commit_thread (void *arg)
             global_lock();
             int loop = (global.running == ICE_RUNNING);
             global_unlock();
-            if (loop) continue;
+            if (loop)
+            {
+                log_commit_entries ();  // pick up anything left from a busy period
+                continue;
+            }
         }
         if (ret > 0)
         {
@@ -21,6 +21,12 @@
 typedef struct _client_tag client_t;
 typedef struct _worker_t worker_t;
 
+/* per worker timing wheel, 256 1ms slots then 3 levels of 64 slots each */
+#define WORKER_WHEEL_L0_BITS        8
+#define WORKER_WHEEL_LN_BITS        6
+#define WORKER_WHEEL_LEVELS         4
+#define WORKER_WHEEL_SLOTS          ((1<<WORKER_WHEEL_L0_BITS) + (WORKER_WHEEL_LEVELS-1)*(1<<WORKER_WHEEL_LN_BITS))
+
 #include "cfgfile.h"
 #include "connection.h"
 #include "refbuf.h"
@@ -34,7 +40,19 @@ struct _worker_t
     int count, pending_count;
     int move_allocations;
     spin_t lock;
-    FD_t wakeup_fd[2];
+    FD_t wakeup_fd[2];      /* both the same descriptor with eventfd */
+    int signalled;          /* wakeup already pending on the control feed */
+    int id;
+    uint64_t wakeups, wakeups_suppressed;
+#ifdef HAVE_SYS_EPOLL_H
+    int epoll_fd;   /* -1 unless polling sockets */
+    int poll_writes;    /* clients wait on socket writability */
+#endif
+    /* own listening sockets when accepting directly */
+    int accept;
+    int listen_count, listen_gen;
+    sock_t *listen_sock;
+    listener_t **listen_conn;
 
     client_t *pending_clients;
     client_t **pending_clients_tail,
@@ -44,6 +62,14 @@ struct _worker_t
     struct timespec current_time;
     uint64_t time_ms;
     uint64_t wakeup_ms;
+    uint64_t sweep_ms;      /* next full walk of the clients list */
+    int rescan;             /* client state changed by another thread */
+
+    uint64_t wheel_ms;      /* wheel slots up to here have expired */
+    unsigned int wheel_count;
+    struct worker_wake_group *groups;
+    client_t *wheel [WORKER_WHEEL_SLOTS];
+
     struct _worker_t *next;
 };
 
@@ -56,6 +82,9 @@ struct _client_functions
 {
     int  (*process)(struct _client_tag *client);
     void (*release)(struct _client_tag *client);
+    /* optional, run clients woken together in one pass. Those fully handled
+     * are moved to the front of the array, the count of which is returned */
+    int  (*fanout)(struct _client_tag **clients, int count);
 };
 
 struct _client_tag
@@ -69,7 +98,11 @@ struct _client_tag
     /* position in first buffer */
     unsigned int pos;
 
-    client_t *next_on_worker;
+    client_t *next_on_worker, **prevp_on_worker;
+
+    /* timing wheel slot and wakeup group links, only used by the worker */
+    client_t *wheel_next, **wheel_prevp;
+    client_t *wake_next, **wake_prevp;
 
     /* functions to process client */
     struct _client_functions *ops;
@@ -172,6 +205,10 @@ int  is_worker_incoming (worker_t *w);
 #define CLIENT_RANGE_END            (1<<11)
 #define CLIENT_KEEPALIVE            (1<<12)
 #define CLIENT_CHUNKED              (1<<13)
-#define CLIENT_FORMAT_BIT           (1<<16)
+#define CLIENT_WRITE_WAIT           (1<<14)
+#define CLIENT_IN_POLLSET           (1<<15)
+#define CLIENT_KERNEL_PACED         (1<<16)
+#define CLIENT_AUTH_CACHED          (1<<17)
+#define CLIENT_FORMAT_BIT           (1<<18)
 
 #endif  /* __CLIENT_H__ */
@@ -44,6 +44,10 @@
 #include <netdb.h>
 #endif
 
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
 #ifdef HAVE_SIGNALFD
 #include <sys/signalfd.h>
 #include <signal.h>
@@ -60,6 +64,7 @@
 #include "cfgfile.h"
 #include "global.h"
 #include "util.h"
+#include "iptrie.h"
 #include "connection.h"
 #include "refbuf.h"
 #include "client.h"
@@ -154,6 +159,7 @@ struct _client_functions http_req_stats_ops =
 
 /* filtering client connection based on IP */
 cache_file_contents banned_ip, allowed_ip;
+static ip_list_t banned_list, allowed_list;
 
 /* filtering listener connection based on useragent */
 cache_file_contents useragents;
@@ -221,27 +227,6 @@ static DH *get_dh2048()
 #endif  // END DH CODE
 
 
-static int compare_banned_ip (void *arg, void *a, void *b)
-{
-    struct node_IP_time *this = (struct node_IP_time *)a;
-    struct node_IP_time *that = (struct node_IP_time *)b;
-    int ret = strcmp (&this->ip[0], &that->ip[0]);
-
-    if (ret && that->a.timeout)
-    {
-        cache_file_contents *c = arg;
-        time_t threshold = c->file_recheck - 60;
-
-        if (c->deletions_count < 9 && that->a.timeout < threshold)
-        {
-            c->deletions [c->deletions_count] = that;
-            c->deletions_count++;
-        }
-    }
-    return ret;
-}
-
-
 void connection_initialize(void)
 {
     thread_spin_create (&_connection_lock);
@@ -398,6 +383,15 @@ static void get_ssl_certificate (ice_config_t *config)
         {
             WARN1 ("Invalid cipher list: %s", config->cipher_list);
         }
+        if (config->ssl_ktls)
+        {
+#ifdef SSL_OP_ENABLE_KTLS
+            SSL_CTX_set_options (new_ssl_ctx, SSL_OP_ENABLE_KTLS);
+            INFO0 ("SSL kernel TLS offload requested");
+#else
+            WARN0 ("SSL kernel TLS offload requested but not supported by this OpenSSL");
+#endif
+        }
         ssl_ok = 1;
         INFO1 ("SSL certificate found at %s", config->cert_file);
         if (strcmp (config->cert_file, config->key_file) != 0)
@@ -438,7 +432,7 @@ int connection_read_ssl (connection_t *con, void *buf, size_t len)
             break;
         case SSL_ERROR_SSL:
         case SSL_ERROR_SYSCALL:     // avoid the ssl shutdown
-            con->sslflags |= 1;
+            con->sslflags |= CONN_SSL_NO_SHUTDOWN;
             // fallthru
         case SSL_ERROR_ZERO_RETURN:
             con->error = 1;
@@ -454,8 +448,28 @@ int connection_read_ssl (connection_t *con, void *buf, size_t len)
     return bytes;
 }
 
+/* once the handshake has completed, check whether the kernel has taken over
+ * the record encryption, if so then the socket can be written to directly */
+static void connection_check_ktls (connection_t *con)
+{
+    if (SSL_is_init_finished (con->ssl) == 0)
+        return;
+    con->sslflags |= CONN_SSL_KTLS_CHECKED;
+#ifdef SSL_OP_ENABLE_KTLS
+    if (SSL_want (con->ssl) == SSL_NOTHING && BIO_get_ktls_send (SSL_get_wbio (con->ssl)))
+    {
+        con->sslflags |= CONN_SSL_KTLS_SEND;
+        DEBUG1 ("kernel TLS send enabled for %s", con->ip);
+    }
+#endif
+}
+
+
 int connection_send_ssl (connection_t *con, const void *buf, size_t len)
 {
+    if (con->sslflags & CONN_SSL_KTLS_SEND)
+        return connection_send (con, buf, len);
+
     ERR_clear_error();
     int bytes = SSL_write (con->ssl, buf, len);
     int code = SSL_get_error (con->ssl, bytes);
@@ -468,20 +482,28 @@ int connection_send_ssl (connection_t *con, const void *buf, size_t len)
         case SSL_ERROR_SYSCALL: // avoid the ssl shutdown
             // DEBUG3("syscall error %d, on %s (%" PRIu64 ")", sock_error(), &con->ip[0], con->id);
         case SSL_ERROR_SSL:
-            con->sslflags |= 1;
+            con->sslflags |= CONN_SSL_NO_SHUTDOWN;
             // fallthru
         case SSL_ERROR_ZERO_RETURN:
             con->error = 1;
             // fallthru
         case SSL_ERROR_WANT_READ:
+            return -1;
         case SSL_ERROR_WANT_WRITE:
+            con->wouldblock = 1;
             return -1;
         default:
             ERR_error_string (ERR_get_error(), err);
             DEBUG2("error %d, %s", code, err);
     }
     if (bytes > 0)
+    {
+        if (bytes < len)
+            con->wouldblock = 1;
         con->sent_bytes += bytes;
+        if ((con->sslflags & CONN_SSL_KTLS_CHECKED) == 0)
+            connection_check_ktls (con);
+    }
     return bytes;
 }
 #else
@@ -530,13 +552,45 @@ int connection_send (connection_t *con, const void *buf, size_t len)
     {
         if (!sock_recoverable (sock_error()))
             con->error = 1;
+        else
+            con->wouldblock = 1;
     }
     else
+    {
+        if (bytes < len)
+            con->wouldblock = 1;
         con->sent_bytes += bytes;
+    }
     return bytes;
 }
 
 
+#ifdef HAVE_SYS_SENDFILE_H
+/* send len bytes of file fd from offset directly on the socket, offset is
+ * moved on by the amount sent. 0 is returned at the end of file */
+int connection_sendfile (connection_t *con, int fd, off_t *offset, size_t len)
+{
+    ssize_t bytes;
+
+    if (connection_unreadable (con))
+        return -1;
+    bytes = sendfile (con->sock, fd, offset, len);
+    if (bytes < 0)
+    {
+        if (!sock_recoverable (sock_error()))
+            con->error = 1;
+        else
+            con->wouldblock = 1;
+        return -1;
+    }
+    if (bytes && bytes < len)
+        con->wouldblock = 1;
+    con->sent_bytes += bytes;
+    return (int)bytes;
+}
+#endif
+
+
 void connection_bufs_init (struct connection_bufs *v, short start)
 {
     memset (v, 0, sizeof (struct connection_bufs));
@@ -614,6 +668,40 @@ static int connbufs_locate_start (struct connection_bufs *vects, int skip, IOVEC
 }
 
 
+#ifdef HAVE_OPENSSL
+/* gather the iovecs into the staging buffer so that they go out as a single
+ * record instead of one record per iovec. A write that has to be retried must
+ * be given the same data so the staged amount is kept until it completes */
+static int connbufs_send_ssl (connection_t *con, IOVEC *io, int count)
+{
+    int len = con->ssl_pending, ret;
+
+    if (len == 0)
+    {
+        if (count == 1 || IO_VECTOR_LEN(io) >= CONN_SSL_STAGE_SZ)
+            return connection_send_ssl (con, IO_VECTOR_BASE(io), IO_VECTOR_LEN(io));
+        if (con->ssl_stage == NULL)
+        {
+            con->ssl_stage = malloc (CONN_SSL_STAGE_SZ);
+            if (con->ssl_stage == NULL)
+                abort();
+        }
+        for (; count && len < CONN_SSL_STAGE_SZ; count--, io++)
+        {
+            int amount = IO_VECTOR_LEN(io);
+            if (amount > CONN_SSL_STAGE_SZ - len)
+                amount = CONN_SSL_STAGE_SZ - len;
+            memcpy (con->ssl_stage + len, IO_VECTOR_BASE(io), amount);
+            len += amount;
+        }
+    }
+    ret = connection_send_ssl (con, con->ssl_stage, len);
+    con->ssl_pending = (ret < 0 && con->error == 0) ? len : 0;
+    return ret;
+}
+#endif
+
+
 int connection_bufs_send (connection_t *con, struct connection_bufs *vectors, int skip)
 {
     IOVEC *p = vectors->block, old_vals;
@@ -625,27 +713,19 @@ int connection_bufs_send (connection_t *con, struct connection_bufs *vectors, in
 
     if (i >= 0)
     {
-        if (not_ssl_connection (con))
+        if (connection_plain_send (con))
         {
             if (connection_unreadable (con))
                 return -1;
             ret = sock_writev (con->sock, p, vectors->count - i);
             if (ret < 0 && !sock_recoverable (sock_error()))
                 con->error = 1;
+            else if (ret < vectors->total - skip)
+                con->wouldblock = 1;
         }
 #ifdef HAVE_OPENSSL
         else
-        {
-            IOVEC *io = p;
-            int bytes = 0;
-            for (; i < vectors->count; i++, io++)
-            {
-               int v = connection_send_ssl (con, IO_VECTOR_BASE(io), IO_VECTOR_LEN(io));
-               if (v > 0) bytes += v;
-               if (v < 0 || v < IO_VECTOR_LEN(io)) break;
-            }
-            if (bytes > 0)  ret = bytes;
-        }
+            ret = connbufs_send_ssl (con, p, vectors->count - i);
 #endif
         if (offset)
             *p = old_vals;
@@ -675,137 +755,71 @@ int connection_chunk_end (connection_t *con, struct connection_bufs *bufs, char
 
 
 
-static void add_banned_ip (cache_file_contents *c, const void *e, time_t now)
-{
-    if (c)
-    {
-        struct node_IP_time *banned;
-        const char *ip = e;
-#ifdef HAVE_FNMATCH_H
-        if (ip [strcspn (ip, "*?[")]) // if wildcard present
-        {
-            struct cache_list_node *entry = calloc (1, sizeof (*entry));
-            entry->content = strdup (ip);
-            entry->next = c->extra;
-            c->extra = entry;
-            DEBUG1 ("Adding wildcard entry \"%.30s\"", ip);
-            return;
-        }
-#endif
-        banned = calloc (1, sizeof (struct node_IP_time));
-        snprintf (&banned->ip[0], sizeof (banned->ip), "%s", ip);
-        banned->a.timeout = now;
-        DEBUG1 ("Adding literal entry \"%.30s\"", ip);
-        avl_insert (c->contents, banned);
-    }
-}
-
 void connection_add_banned_ip (const char *ip, int duration)
 {
-    time_t timeout = 0;
+    time_t now = time(NULL), timeout = 0;
     if (duration > 0)
-        timeout = time(NULL) + duration;
+        timeout = now + duration;
 
-    if (banned_ip.contents)
-    {
-        global_lock();
-        add_banned_ip (&banned_ip, ip, timeout);
-        global_unlock();
-    }
+    global_lock();
+    if (banned_list.loaded)
+        ip_list_add (&banned_list, ip, timeout, now);
     else
         INFO0 ("No ban-file set up, missing tag in xml or no file referenced");
+    global_unlock();
 }
 
 void connection_release_banned_ip (const char *ip)
 {
-    if (banned_ip.contents)
-    {
-        global_lock();
-        avl_delete (banned_ip.contents, (void*)ip, cached_treenode_free);
-        global_unlock();
-    }
+    global_lock();
+    if (banned_list.loaded)
+        ip_list_remove (&banned_list, ip, time(NULL));
+    global_unlock();
 }
 
 void connection_stats (void)
 {
-    long banned_IPs = 0;
-    if (banned_ip.contents)
-        banned_IPs = (long)banned_ip.contents->length;
+    long banned_IPs = banned_list.count;
     stats_event_args (NULL, "banned_IPs", "%ld", banned_IPs);
 }
 
 
 time_t cachefile_timecheck = (time_t)0;
 
-/* check specified ip against internal set of banned IPs
+/* check specified ip against the banned IPs, no lock is needed for the lookup
  * return -1 for no data, 0 for no match and 1 for match
  */
-static int search_banned_ip_locked (char *ip)
+static int search_banned_ip (char *ip)
 {
-    int ret = 0;
-    if (banned_ip.extra)
-    {
-        struct cache_list_node *entry = banned_ip.extra;
-        while (entry)
-        {
-            if (cached_pattern_compare (ip, entry->content) == 0)
-                return 1;
-            entry = entry->next;
-        }
-    }
-    if (banned_ip.contents)
-    {
-        int i;
-        void *result;
+    time_t now = cachefile_timecheck;
 
-        banned_ip.deletions_count = 0;
-        if (avl_get_by_key (banned_ip.contents, ip, &result) == 0)
-        {
-            struct node_IP_time *match = result;
-            if (match->a.timeout == 0 || match->a.timeout > cachefile_timecheck)
-            {
-                if (match->a.timeout && cachefile_timecheck + 300 > match->a.timeout)
-                    match->a.timeout = cachefile_timecheck + 300;
-                ret = 1;
-            }
-            else
-                avl_delete (banned_ip.contents, ip, cached_treenode_free);
-        }
-        /* we may of seen others to remove */
-        for (i = 0; i < banned_ip.deletions_count; ++i)
-        {
-            struct node_IP_time *to_go = banned_ip.deletions[i];
-            INFO1 ("removing %s from ban list for now", &(to_go->ip[0]));
-            avl_delete (banned_ip.contents, &(to_go->ip[0]), cached_treenode_free);
-        }
-        banned_ip.deletions_count = 0;
+    cached_file_recheck (&banned_ip, now);
+    if (now >= banned_list.purge_time)
+    {
+        global_lock();
+        ip_list_purge (&banned_list, now);
+        global_unlock();
     }
-    return ret;
-}
-
-
-static int search_banned_ip (char *ip)
-{
-    int ret;
-    cached_file_recheck (&banned_ip, cachefile_timecheck);
-    global_lock();
-    ret = search_banned_ip_locked (ip);
-    global_unlock();
-    return ret;
+    return ip_list_search (&banned_list, ip, now);
 }
 
 
 /* return 0 if the passed ip address is not to be handled by icecast, non-zero otherwise */
 static int accept_ip_address (char *ip)
 {
-    cachefile_timecheck = time (NULL);
+    time_t now = time (NULL);
+    int allowed;
+
+    cachefile_timecheck = now;
 
     if (search_banned_ip (ip) > 0)
     {
         DEBUG1 ("%s banned", ip);
         return 0;
     }
-    if (cached_pattern_search (&allowed_ip, ip, cachefile_timecheck) == 0)
+    cached_file_recheck (&allowed_ip, now);
+    allowed = ip_list_search (&allowed_list, ip, now);
+    if (allowed == 0)
     {
         DEBUG1 ("%s is not allowed", ip);
         return 0;
@@ -1056,15 +1070,13 @@ static sock_t wait_for_serversock (void)
 }
 
 
-static client_t *accept_client (void)
+/* accept a connection on the listening socket given, returning a client ready
+ * for reading the request. server_conn is looked up if not known */
+static client_t *connection_accept_sock (sock_t serversock, listener_t *server_conn)
 {
-    sock_t sock, serversock = wait_for_serversock ();
-    listener_t *server_conn = NULL;
+    sock_t sock;
     char addr [200];
 
-    if (serversock == SOCK_ERROR)
-        return NULL;
-
     sock = sock_accept (serversock, addr, 200);
     if (sock == SOCK_ERROR)
     {
@@ -1080,20 +1092,29 @@ static client_t *accept_client (void)
         refbuf_t *r;
 
         if (accept_ip_address (addr) == 0)
+        {
+            server_conn = NULL;
             break;
+        }
         if (sock_set_blocking (sock, 0) || (sock_set_cork (sock, 1) < 0 && sock_set_nodelay (sock)))
         {
             WARN0 ("failed to set tcp options on client connection, dropping");
+            server_conn = NULL;
             break;
         }
         global_lock ();
-        for (i=0; i < global.server_sockets; i++)
+        if (server_conn)
+            server_conn->refcount++;
+        else
         {
-            if (global.serversock[i] == serversock)
+            for (i=0; i < global.server_sockets; i++)
             {
-                server_conn = global.server_conn[i];
-                server_conn->refcount++;
-                break;
+                if (global.serversock[i] == serversock)
+                {
+                    server_conn = global.server_conn[i];
+                    server_conn->refcount++;
+                    break;
+                }
             }
         }
         global_unlock ();
@@ -1136,6 +1157,14 @@ static client_t *accept_client (void)
             client->server_conn = server_conn;
             client->flags |= CLIENT_ACTIVE;
 
+            /* do a small delay here so the client has chance to send the request after
+             * getting a connect. */
+            client->counter = client->schedule_ms = timing_get_time();
+            client->connection.con_time = client->schedule_ms/1000;
+            client->connection.discon.time = client->connection.con_time + header_timeout;
+            client->schedule_ms += 30;
+            stats_event_inc (NULL, "connections");
+
             return client;
         }
     } while (0);
@@ -1151,6 +1180,16 @@ static client_t *accept_client (void)
 }
 
 
+static client_t *accept_client (void)
+{
+    sock_t serversock = wait_for_serversock ();
+
+    if (serversock == SOCK_ERROR)
+        return NULL;
+    return connection_accept_sock (serversock, NULL);
+}
+
+
 /* shoutcast source clients are handled specially because the protocol is limited. It is
  * essentially a password followed by a series of headers, each on a separate line.  In here
  * we get the password and build a http request like a native source client would do
@@ -1285,6 +1324,30 @@ int setup_source_client_callback (client_t *client)
 }
 
 
+/* look for the blank line ending the request headers, only the data from
+ * *scanned onwards is checked and *scanned is updated. A match is determined
+ * at the newline so a terminator split across reads is still found */
+static char *http_headers_end (char *data, unsigned int len, unsigned int *scanned)
+{
+    unsigned int i = *scanned;
+
+    while (i < len)
+    {
+        char *nl = memchr (data + i, '\n', len - i);
+        if (nl == NULL)
+            break;
+        i = nl - data;
+        if ((i >= 1 && data [i-1] == '\n') ||
+                (i >= 3 && memcmp (data + i - 3, "\r\n\r", 3) == 0) ||
+                (i >= 5 && memcmp (data + i - 5, "\r\r\n\r\r", 5) == 0))
+            return nl + 1;
+        i++;
+    }
+    *scanned = len;
+    return NULL;
+}
+
+
 static int http_client_request (client_t *client)
 {
     refbuf_t *refbuf = client->shared_data;
@@ -1331,31 +1394,14 @@ static int http_client_request (client_t *client)
                 client->check_buffer = format_generic_write_to_client;
                 return fserve_setup_client_fb (client, &fb);
             }
-            /* find a blank line */
-            do
+            /* find a blank line, carry on from where the last read got to */
+            ptr = http_headers_end (refbuf->data, refbuf->len, &client->pos);
+            if (ptr == NULL)
             {
-                buf = refbuf->data;
-                ptr = strstr (buf, "\r\n\r\n");
-                if (ptr)
-                {
-                    ptr += 4;
-                    break;
-                }
-                ptr = strstr (buf, "\n\n");
-                if (ptr)
-                {
-                    ptr += 2;
-                    break;
-                }
-                ptr = strstr (buf, "\r\r\n\r\r\n");
-                if (ptr)
-                {
-                    ptr += 6;
-                    break;
-                }
                 client->schedule_ms = client->worker->time_ms + 100;
                 return 0;
-            } while (0);
+            }
+            client->pos = 0;
             client->refbuf = client->shared_data;
             client->shared_data = NULL;
             client->connection.discon.time = 0;
@@ -1485,8 +1531,8 @@ static void *connection_thread (void *arg)
 
     config = config_get_config ();
     /* setup the banned/allowed IP filenames from the xml */
-    cached_file_init (&banned_ip,  config->banfile,   add_banned_ip, compare_banned_ip);
-    cached_file_init (&allowed_ip, config->allowfile, NULL, NULL);
+    ip_list_init (&banned_ip,  &banned_list,  config->banfile);
+    ip_list_init (&allowed_ip, &allowed_list, config->allowfile);
     cached_file_init (&useragents, config->agentfile, NULL, NULL);
 
     connection_setup_sockets (config);
@@ -1502,16 +1548,7 @@ static void *connection_thread (void *arg)
         thread_spin_unlock (&_connection_lock);
         client_t *client = accept_client ();
         if (client)
-        {
-            /* do a small delay here so the client has chance to send the request after
-             * getting a connect. */
-            client->counter = client->schedule_ms = timing_get_time();
-            client->connection.con_time = client->schedule_ms/1000;
-            client->connection.discon.time = client->connection.con_time + header_timeout;
-            client->schedule_ms += 30;
             client_add_incoming (client);
-            stats_event_inc (NULL, "connections");
-        }
         if (global.new_connections_slowdown)
             thread_sleep (global.new_connections_slowdown * 5000);
         thread_spin_lock (&_connection_lock);
@@ -1887,6 +1924,8 @@ void connection_listen_sockets_close (ice_config_t *config, int all_sockets)
                         sock_set_send_buffer (global.serversock [old], listener->so_sndbuf);
                     if (listener->so_mss)
                         sock_set_mss (global.serversock [old], listener->so_mss);
+                    if (listener->notsent_lowat)
+                        sock_set_notsent_lowat (global.serversock [old], listener->notsent_lowat);
                     if (new < old)
                     {
                         global.server_conn [new] = global.server_conn [old];
@@ -1905,6 +1944,7 @@ void connection_listen_sockets_close (ice_config_t *config, int all_sockets)
             config_clear_listener (global.server_conn [old]);
             global.server_sockets--;
         }
+        global.server_sockets_gen++;
         if (global.server_sockets == 0)
         {
             free (global.serversock);
@@ -1916,6 +1956,118 @@ void connection_listen_sockets_close (ice_config_t *config, int all_sockets)
 }
 
 
+static int listen_socket_prepare (sock_t sock, listener_t *listener)
+{
+    /* some win32 setups do not do TCP win scaling well, so allow an override */
+    if (listener->so_sndbuf)
+        sock_set_send_buffer (sock, listener->so_sndbuf);
+    if (listener->so_mss)
+        sock_set_mss (sock, listener->so_mss);
+    if (listener->notsent_lowat && sock_set_notsent_lowat (sock, listener->notsent_lowat) < 0)
+        WARN1 ("unable to set unsent data limit on port %d", listener->port);
+    if (sock_listen (sock, listener->qlen) == SOCK_ERROR)
+    {
+        sock_close (sock);
+        return -1;
+    }
+    sock_set_blocking (sock, 0);
+    return 0;
+}
+
+
+void connection_worker_sockets_close (worker_t *worker)
+{
+    int i;
+
+    if (worker->listen_count == 0)
+        return;
+    global_lock();
+    for (i = 0; i < worker->listen_count; i++)
+    {
+        sock_close (worker->listen_sock [i]);
+        config_clear_listener (worker->listen_conn [i]);
+    }
+    global_unlock();
+    free (worker->listen_sock);
+    free (worker->listen_conn);
+    worker->listen_sock = NULL;
+    worker->listen_conn = NULL;
+    worker->listen_count = 0;
+}
+
+
+/* Open sockets for the worker on the same addresses as the main listening
+ * sockets. These are SO_REUSEPORT so the kernel spreads new connections over
+ * the workers and the connection thread. Returns 0 if nothing changed.
+ */
+int connection_worker_sockets (worker_t *worker)
+{
+    int i, count = 0, arr_size = 0;
+    sock_t *socks = NULL;
+    listener_t **conns = NULL;
+
+    if (worker->listen_gen == global.server_sockets_gen)
+        return 0;
+    connection_worker_sockets_close (worker);
+
+    global_lock();
+    worker->listen_gen = global.server_sockets_gen;
+    for (i = 0; i < global.server_sockets; i++)
+    {
+        listener_t *listener = global.server_conn [i];
+        sock_server_t sockets;
+        sock_t sock;
+
+        if (i && listener == global.server_conn [i-1])
+            continue;   // same listen-socket, the addresses were done together
+        sockets = sock_get_server_sockets (listener->port, listener->bind_address);
+        if (sock_server_reuseport (sockets) < 0)
+        {
+            sock_free_server_sockets (sockets);
+            break;
+        }
+        while (sock_get_next_server_socket (sockets, &sock) == 0)
+        {
+            if (sock == SOCK_ERROR)
+            {
+                DEBUG2 ("port %d (%s) is not shareable, left to connection thread",
+                        listener->port, listener->bind_address ? listener->bind_address : "default");
+                continue;
+            }
+            if (listen_socket_prepare (sock, listener) < 0)
+                continue;
+            if (count >= arr_size)
+            {
+                void *tmp;
+                arr_size += 10;
+                tmp = realloc (socks, (arr_size*sizeof (sock_t)));
+                if (tmp) socks = tmp;
+                tmp = realloc (conns, (arr_size*sizeof (listener_t*)));
+                if (tmp) conns = tmp;
+            }
+            socks [count] = sock;
+            conns [count] = listener;
+            listener->refcount++;
+            count++;
+        }
+        sock_free_server_sockets (sockets);
+    }
+    global_unlock();
+
+    worker->listen_sock = socks;
+    worker->listen_conn = conns;
+    worker->listen_count = count;
+    DEBUG2 ("worker %p accepting on %d sockets", worker, count);
+    return 1;
+}
+
+
+client_t *connection_worker_accept (worker_t *worker, int idx)
+{
+    return connection_accept_sock (worker->listen_sock [idx], worker->listen_conn [idx]);
+}
+
+
 int connection_setup_sockets (ice_config_t *config)
 {
     static int sockets_setup = 2;
@@ -1947,6 +2099,9 @@ int connection_setup_sockets (ice_config_t *config)
 
         sock_server_t sockets = sock_get_server_sockets (listener->port, listener->bind_address);
 
+        if (config->worker_reuseport)
+            sock_server_reuseport (sockets);
+
         do
         {
             sock_t sock = SOCK_ERROR;
@@ -1955,16 +2110,8 @@ int connection_setup_sockets (ice_config_t *config)
             socket_attempt++;
             if (sock == SOCK_ERROR)
                 continue;
-            /* some win32 setups do not do TCP win scaling well, so allow an override */
-            if (listener->so_sndbuf)
-                sock_set_send_buffer (sock, listener->so_sndbuf);
-            if (listener->so_mss)
-                sock_set_mss (sock, listener->so_mss);
-            if (sock_listen (sock, listener->qlen) == SOCK_ERROR)
-            {
-                sock_close (sock);
+            if (listen_socket_prepare (sock, listener) < 0)
                 continue;
-            }
             if (count >= arr_size) // need to resize arrays?
             {
                 void *tmp;
@@ -1976,7 +2123,6 @@ int connection_setup_sockets (ice_config_t *config)
                 if (tmp) global.server_conn = tmp;
             }
 
-            sock_set_blocking (sock, 0);
             global.serversock [count] = sock;
             global.server_conn [count] = listener;
             listener->refcount++;
@@ -2015,6 +2161,7 @@ int connection_setup_sockets (ice_config_t *config)
         listener = listener->next;
     }
     global.server_sockets = count;
+    global.server_sockets_gen++;
     global_unlock();
 
     if (count)
@@ -2032,13 +2179,18 @@ void connection_reset (connection_t *con, uint64_t time_ms)
     con->sent_bytes = 0;
 #ifdef HAVE_OPENSSL
     if (con->ssl) { SSL_shutdown (con->ssl); SSL_free (con->ssl); con->ssl = NULL; }
+    free (con->ssl_stage);
+    con->ssl_stage = NULL;
+    con->ssl_pending = 0;
+    con->sslflags = 0;
 #endif
 }
 
 void connection_close(connection_t *con)
 {
 #ifdef HAVE_OPENSSL
-    if (con->ssl) { if ((con->sslflags & 1) == 0) SSL_shutdown (con->ssl); SSL_free (con->ssl); }
+    if (con->ssl) { if ((con->sslflags & CONN_SSL_NO_SHUTDOWN) == 0) SSL_shutdown (con->ssl); SSL_free (con->ssl); }
+    free (con->ssl_stage);
 #endif
     if (con->sock != SOCK_ERROR)
         sock_close (con->sock);
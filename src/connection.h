@@ -26,6 +26,8 @@
 
 struct source_tag;
 struct ice_config_tag;
+struct _worker_t;
+struct _client_tag;
 typedef struct connection_tag connection_t;
 
 #include "compat.h"
@@ -49,9 +51,12 @@ struct connection_tag
     unsigned int chunk_pos; // for short writes on chunk size line
     char error;
     unsigned char readchk;
+    unsigned char wouldblock;   // last send was short, socket buffer is full
 
 #ifdef HAVE_OPENSSL
-    unsigned char sslflags;
+    unsigned char sslflags;     // CONN_SSL_* flags
+    unsigned short ssl_pending; // staged bytes waiting on an SSL_write retry
+    char *ssl_stage;            // gathers an iovec set into one record
     SSL *ssl;   /* SSL handler */
 #endif
 
@@ -75,15 +80,27 @@ struct connection_bufs
 #endif
 
 #ifdef HAVE_OPENSSL
+#define CONN_SSL_NO_SHUTDOWN        1
+#define CONN_SSL_KTLS_CHECKED       2
+#define CONN_SSL_KTLS_SEND          4
+
+#define CONN_SSL_STAGE_SZ           16384
+
 #define not_ssl_connection(x)    ((x)->ssl==NULL)
+/* data can be written directly to the socket, kernel doing any encryption */
+#define connection_plain_send(x) ((x)->ssl==NULL || ((x)->sslflags & CONN_SSL_KTLS_SEND))
 #else
 #define not_ssl_connection(x)    (1)
+#define connection_plain_send(x) (1)
 #endif
 void connection_initialize(void);
 void connection_shutdown(void);
 void connection_thread_startup();
 void connection_thread_shutdown();
 int  connection_setup_sockets (struct ice_config_tag *config);
+int  connection_worker_sockets (struct _worker_t *worker);
+void connection_worker_sockets_close (struct _worker_t *worker);
+struct _client_tag *connection_worker_accept (struct _worker_t *worker, int idx);
 void connection_reset (connection_t *con, uint64_t time_ms);
 void connection_close(connection_t *con);
 int  connection_init (connection_t *con, sock_t sock, const char *addr);
@@ -113,6 +130,9 @@ int  connection_send_ssl (connection_t *con, const void *buf, size_t len);
 #endif
 int  connection_read (connection_t *con, void *buf, size_t len);
 int  connection_send (connection_t *con, const void *buf, size_t len);
+#ifdef HAVE_SYS_SENDFILE_H
+int  connection_sendfile (connection_t *con, int fd, off_t *offset, size_t len);
+#endif
 void connection_thread_shutdown_req (void);
 
 int connection_check_pass (http_parser_t *parser, const char *user, const char *pass);
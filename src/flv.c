@@ -282,10 +282,7 @@ int flv_write_metadata (struct flv *flv, struct metadata_block *meta, const char
         if (meta_copied + 15 + flv->raw_offset > raw->len)
         {
             int newlen = meta_copied + flv->raw_offset + 1024;
-            void *p = realloc (raw->data, newlen);
-            if (p == NULL) return -1;
-            raw->data = p;
-            raw->len = newlen;
+            refbuf_resize (raw, newlen);
             flv->block_pos = flv->raw_offset = 0;
             connection_bufs_flush (&flv->bufs);
             return -1;
@@ -180,12 +180,103 @@ int format_check_frames (struct format_check_t *c)
 }
 
 
+/* read from the shared file blocks if available, falling back to the file */
+static ssize_t format_file_pread (format_plugin_t *plugin, icefile_handle f, char *buf, size_t len, uint64_t offset)
+{
+    size_t done = 0;
+    ssize_t bytes;
+
+    while (plugin && plugin->file_block && done < len)
+    {
+        refbuf_t *block;
+        uint64_t start;
+        size_t off, count;
+        int ret = plugin->file_block (plugin, offset + done, &block, &start);
+
+        if (ret == 0)
+            return done;
+        if (ret < 0)
+        {
+            if (ret == -1)
+                break;  // not cached, read the rest
+            return done ? (ssize_t)done : -1;
+        }
+        off = offset + done - start;
+        count = block->len - off;
+        if (count > len - done)
+            count = len - done;
+        memcpy (buf + done, block->data + off, count);
+        refbuf_release (block);
+        done += count;
+    }
+    if (done == len)
+        return done;
+    bytes = pread (f, buf + done, len - done, offset + done);
+    if (bytes < 0)
+        return done ? (ssize_t)done : bytes;
+    return done + bytes;
+}
+
+
+/* clients taking the file content as is can refer to the shared blocks
+ * directly. Returns 0 if the usual reading should be done instead */
+static int format_file_slice (client_t *client, format_plugin_t *plugin, icefile_handle f, int *result)
+{
+    refbuf_t *refbuf = client->refbuf, *block;
+    uint64_t start;
+    int ret;
+
+    if (refbuf && client->pos < refbuf->len)
+    {
+        *result = refbuf->len - client->pos;
+        return 1;
+    }
+    if (refbuf && refbuf->next)
+        return 0;
+    if (file_in_use (f) == 0)
+    {
+        *result = -2;
+        return 1;
+    }
+    if (client->connection.discon.time && client->worker->current_time.tv_sec >= client->connection.discon.time)
+    {
+        *result = -1;
+        return 1;
+    }
+    ret = plugin->file_block (plugin, client->intro_offset, &block, &start);
+    if (ret == -1)
+        return 0;
+    if (ret <= 0)
+    {
+        client->flags &= ~CLIENT_HAS_INTRO_CONTENT;
+        *result = ret < 0 ? -2 : -1;
+        return 1;
+    }
+    if (refbuf == NULL)
+        client->queue_pos = 0;
+    client_set_queue (client, NULL);
+    client->refbuf = block;
+    client->pos = client->intro_offset - start;
+    client->intro_offset = start + block->len;
+    *result = block->len - client->pos;
+    return 1;
+}
+
+
 int format_file_read (client_t *client, format_plugin_t *plugin, icefile_handle f)
 {
     refbuf_t *refbuf = client->refbuf;
     ssize_t bytes = -1, len, range = 0;
     int unprocessed = 0;
 
+    if (plugin && plugin->file_block && plugin->align_buffer == NULL &&
+            client->check_buffer == format_generic_write_to_client && (client->flags & CLIENT_RANGE_END) == 0)
+    {
+        int ret;
+        if (format_file_slice (client, plugin, f, &ret))
+            return ret;
+        refbuf = client->refbuf;
+    }
     do
     {
         len = 8192;
@@ -237,7 +328,7 @@ int format_file_read (client_t *client, format_plugin_t *plugin, icefile_handle
             if (client->connection.discon.time && client->worker->current_time.tv_sec >= client->connection.discon.time)
                 return -1;
 
-        bytes = pread (f, refbuf->data, len, client->intro_offset);
+        bytes = format_file_pread (plugin, f, refbuf->data, len, client->intro_offset);
         if (bytes <= 0)
         {
             client->flags &= ~CLIENT_HAS_INTRO_CONTENT;
@@ -291,6 +382,53 @@ int format_generic_write_to_client (client_t *client)
 }
 
 
+/* add the listener header for a source client header, ice-* headers become
+ * icy-* ones. Returns the length written */
+static int format_source_header (char *ptr, unsigned remaining, const char *name, const char *value, int *bitrate_filtered)
+{
+    int bytes = 0;
+
+    if (!strcasecmp (name, "ice-audio-info"))
+    {
+        /* convert ice-audio-info to icy-br */
+        char *brfield = NULL;
+        unsigned int bitrate;
+
+        if (*bitrate_filtered == 0)
+            brfield = strstr (value, "bitrate=");
+        if (brfield && sscanf (brfield, "bitrate=%u", &bitrate))
+        {
+            bytes = snprintf (ptr, remaining, "icy-br:%u\r\n", bitrate);
+            *bitrate_filtered = 1;
+            remaining -= bytes;
+            ptr += bytes;
+        }
+        /* show ice-audio_info header as well because of relays */
+        bytes += snprintf (ptr, remaining, "%s: %s\r\n", name, value);
+        return bytes;
+    }
+    if (strcasecmp (name, "ice-password") &&
+            strcasecmp (name, "icy-metaint") &&
+            strncasecmp (name, "Access-control-", 15))
+    {
+        if (!strncasecmp ("ice-", name, 4))
+        {
+            if (!strcasecmp ("ice-public", name))
+                bytes = snprintf (ptr, remaining, "icy-pub:%s\r\n", value);
+            else
+                if (!strcasecmp ("ice-bitrate", name))
+                    bytes = snprintf (ptr, remaining, "icy-br:%s\r\n", value);
+                else
+                    bytes = snprintf (ptr, remaining, "icy%s:%s\r\n", name + 3, value);
+        }
+        else
+            if (!strncasecmp ("icy-", name, 4))
+                bytes = snprintf (ptr, remaining, "icy%s:%s\r\n", name + 3, value);
+    }
+    return bytes;
+}
+
+
 int format_general_headers (format_plugin_t *plugin, client_t *client)
 {
     unsigned remaining = 4096 - client->refbuf->len;
@@ -483,62 +621,28 @@ int format_general_headers (format_plugin_t *plugin, client_t *client)
 
     if (plugin && plugin->parser)
     {
+        const http_header_t *header;
+        unsigned int idx = 0;
+
         /* iterate through source http headers and send to client */
         avl_tree_rlock (plugin->parser->vars);
+        while ((header = httpp_get_header (plugin->parser, idx++)))
+        {
+            if (header->value)
+            {
+                bytes = format_source_header (ptr, remaining, header->name, header->value, &bitrate_filtered);
+                remaining -= bytes;
+                ptr += bytes;
+            }
+        }
         node = avl_get_first (plugin->parser->vars);
         while (node)
         {
-            int next = 1;
             http_var_t *var = (http_var_t *)node->key;
-            bytes = 0;
-            if (!strcasecmp (var->name, "ice-audio-info"))
-            {
-                /* convert ice-audio-info to icy-br */
-                char *brfield = NULL;
-                unsigned int bitrate;
-
-                if (bitrate_filtered == 0)
-                    brfield = strstr (var->value, "bitrate=");
-                if (brfield && sscanf (brfield, "bitrate=%u", &bitrate))
-                {
-                    bytes = snprintf (ptr, remaining, "icy-br:%u\r\n", bitrate);
-                    next = 0;
-                    bitrate_filtered = 1;
-                }
-                else
-                    /* show ice-audio_info header as well because of relays */
-                    bytes = snprintf (ptr, remaining, "%s: %s\r\n", var->name, var->value);
-            }
-            else
-            {
-                if (strcasecmp (var->name, "ice-password") &&
-                        strcasecmp (var->name, "icy-metaint") &&
-                        strncasecmp (var->name, "Access-control-", 15))
-                {
-                    if (!strncasecmp ("ice-", var->name, 4))
-                    {
-                        if (!strcasecmp ("ice-public", var->name))
-                            bytes = snprintf (ptr, remaining, "icy-pub:%s\r\n", var->value);
-                        else
-                            if (!strcasecmp ("ice-bitrate", var->name))
-                                bytes = snprintf (ptr, remaining, "icy-br:%s\r\n", var->value);
-                            else
-                                bytes = snprintf (ptr, remaining, "icy%s:%s\r\n",
-                                        var->name + 3, var->value);
-                    }
-                    else 
-                        if (!strncasecmp ("icy-", var->name, 4))
-                        {
-                            bytes = snprintf (ptr, remaining, "icy%s:%s\r\n",
-                                    var->name + 3, var->value);
-                        }
-                }
-            }
-
+            bytes = format_source_header (ptr, remaining, var->name, var->value, &bitrate_filtered);
             remaining -= bytes;
             ptr += bytes;
-            if (next)
-                node = avl_get_next (node);
+            node = avl_get_next (node);
         }
         avl_tree_unlock (plugin->parser->vars);
     }
@@ -74,6 +74,11 @@ struct _format_plugin_tag
     void (*swap_client)(client_t *new_cient, client_t *old_client);
     void (*detach_queue_block)(struct source_tag *source, refbuf_t *refbuf);
     refbuf_t *(*qblock_copy)(refbuf_t *refbuf);
+    /* shared blocks of file content to use in place of reading the file.
+     * Returns 1 with a referenced block, 0 at end of file, -1 if not
+     * available and -2 on a read failure */
+    int  (*file_block)(struct _format_plugin_tag *plugin, uint64_t offset, refbuf_t **block, uint64_t *start);
+    void *file_data;
 
     /* for internal state management */
     void *_state;
@@ -637,6 +637,101 @@ static int send_icy_metadata (client_t *client, refbuf_t *refbuf)
 }
 
 
+/* Send as much of the block as possible in one go with the metadata inserted
+ * at each interval, rather than splitting the send at every insertion point.
+ * Only the first insertion in a block can carry a metadata update, later ones
+ * are the single nul byte, so the layout is worked out from the client
+ * position and the vector lives on the stack.
+ */
+#define ICY_SEGMENTS_MAX    32
+
+static int send_icy_interleaved (client_t *client, refbuf_t *refbuf)
+{
+    mp3_client_data *client_mp3 = client->format_data;
+    struct metadata_block *mb = refbuf->associated;
+    IOVEC vec [ICY_SEGMENTS_MAX];
+    struct connection_bufs bufs = { 0, ICY_SEGMENTS_MAX, 0, vec };
+    unsigned int interval = client_mp3->interval, since = client_mp3->since_meta_block;
+    unsigned int pos = client->pos;
+    int full_meta = 0;
+    int ret, total = 0, i;
+
+    if (mb == NULL || mb->icy == NULL)
+        mb = &blank_meta;       // the default block
+    while (bufs.count < ICY_SEGMENTS_MAX-1)
+    {
+        unsigned int len;
+
+        if (since == interval)
+        {
+            if (pos >= refbuf->len && bufs.count)
+                break;  // leave for the next block as that may update the metadata
+            if (full_meta || (mb == client_mp3->associated && (client->flags & CLIENT_IN_METADATA) == 0))
+                total = connection_bufs_append (&bufs, "\0", 1);
+            else
+            {
+                refbuf_t *icy = mb->icy;
+                if (client->flags & CLIENT_IN_METADATA && client_mp3->metadata_offset >= icy->len)
+                {
+                    ERROR3 ("mismatch in meta block (%s,%d, %d)", client->mount,
+                            client_mp3->metadata_offset, icy->len);
+                    client->connection.error = 1;
+                    return 0;
+                }
+                full_meta = 1;
+                total = connection_bufs_append (&bufs, icy->data + client_mp3->metadata_offset,
+                        icy->len - client_mp3->metadata_offset);
+            }
+            since = 0;
+        }
+        if (pos >= refbuf->len)
+            break;
+        len = refbuf->len - pos;
+        if (len > interval - since)
+            len = interval - since;
+        total = connection_bufs_append (&bufs, refbuf->data + pos, len);
+        pos += len;
+        since += len;
+    }
+    if (total == 0)
+        return -1;
+
+    ret = connection_bufs_send (&client->connection, &bufs, 0);
+
+    /* walk the segments to see how far the send got */
+    for (i = 0, total = ret; i < bufs.count && total > 0; i++)
+    {
+        int len = IO_VECTOR_LEN (vec + i);
+        char *base = IO_VECTOR_BASE (vec + i);
+        int sent = total < len ? total : len;
+
+        total -= sent;
+        if (base >= refbuf->data && base < refbuf->data + refbuf->len)
+        {
+            client->queue_pos += sent;
+            client->counter += sent;
+            client->pos += sent;
+            client_mp3->since_meta_block += sent;
+            continue;
+        }
+        if (sent < len)
+        {
+            // short send within the metadata
+            client->flags |= CLIENT_IN_METADATA;
+            client_mp3->metadata_offset += sent;
+            break;
+        }
+        client->flags &= ~CLIENT_IN_METADATA;
+        client_mp3->metadata_offset = 0;
+        client_mp3->since_meta_block = 0;
+        client_mp3->associated = mb; // change prev meta block
+    }
+    if (ret < bufs.total)
+        client->schedule_ms += 10 + (client->throttle * ((ret < 0) ? 10 : 6));
+    return ret;
+}
+
+
 /* Handler for writing mp3 data to a client, taking into account whether
  * client has requested shoutcast style metadata updates
  */
@@ -646,6 +741,8 @@ static int format_mp3_write_buf_to_client (client_t *client)
     mp3_client_data *client_mp3 = client->format_data;
     refbuf_t *refbuf = client->refbuf;
 
+    if (client_mp3->interval && (client->flags & CLIENT_CHUNKED) == 0)
+        return send_icy_interleaved (client, refbuf);
     if (client_mp3->interval && client_mp3->interval == client_mp3->since_meta_block)
         return send_icy_metadata (client, refbuf);
 
@@ -914,11 +1011,9 @@ static int validate_mpeg (source_t *source, refbuf_t *refbuf)
 
         if (mpeg_block_expanded (mpeg_sync))
         {
-            source_mp3->read_data = refbuf_new (0);
-            source_mp3->read_data->data = refbuf->data;
-            source_mp3->read_data->len = refbuf->len;
+            source_mp3->read_data = refbuf_new (refbuf->len);
+            memcpy (source_mp3->read_data->data, refbuf->data, refbuf->len);
             source_mp3->read_count = unprocessed;
-            refbuf->data = NULL;
             client->pos = unprocessed;
             return -1;
         }
@@ -80,6 +80,18 @@
 
 #define BUFSIZE 4096
 
+/* files up to this size are cached in memory once more than one client is
+ * reading them or they are used as a fallback, no more are cached once the
+ * total reaches FH_CACHE_TOTAL */
+#define FH_BLOCK_SIZE       16384
+#define FH_CACHE_MAX        (32*1024*1024)
+#define FH_CACHE_TOTAL      (256*1024*1024)
+
+/* kernel paced rate limited files, write every interval (ms) */
+#define FSERVE_PACED_INTERVAL   250
+#define FSERVE_PACED_BATCH_MAX  65536
+#define FSERVE_PACED_MIN_RATE   4000
+
 static spin_t pending_lock;
 static avl_tree *mimetypes = NULL;
 static avl_tree *fh_cache = NULL;
@@ -107,6 +119,13 @@ typedef struct {
     format_plugin_t *format;
     struct rate_calc *out_bitrate;
     avl_tree *clients;
+
+    /* file content shared by the clients, filled as read */
+    refbuf_t **blocks;
+    unsigned int block_count;
+    uint64_t cache_size;        /* taken from fh_cache_bytes */
+    int cache_disabled;
+    unsigned int cache_hits, cache_misses;
 } fh_node;
 
 int fserve_running;
@@ -119,6 +138,18 @@ static int _delete_fh (void *mapping);
 static void remove_fh_from_cache (fh_node *fh);
 
 static fh_node no_file;
+static uint64_t fh_cache_hits, fh_cache_misses;
+static uint64_t fh_cache_bytes;
+
+#ifdef __GNUC__
+#define fh_cache_bytes_add(v)   __atomic_add_fetch (&fh_cache_bytes, (v), __ATOMIC_RELAXED)
+#define fh_cache_bytes_sub(v)   __atomic_sub_fetch (&fh_cache_bytes, (v), __ATOMIC_RELAXED)
+#define fh_cache_bytes_get()    __atomic_load_n (&fh_cache_bytes, __ATOMIC_RELAXED)
+#else
+#define fh_cache_bytes_add(v)   (fh_cache_bytes += (v))
+#define fh_cache_bytes_sub(v)   (fh_cache_bytes -= (v))
+#define fh_cache_bytes_get()    (fh_cache_bytes)
+#endif
 
 
 void fserve_initialize(void)
@@ -226,6 +257,103 @@ static int _compare_fh(void *arg, void *a, void *b)
 }
 
 
+static void fh_cache_release (fh_node *fh)
+{
+    unsigned int i;
+
+    if (fh->blocks == NULL)
+        return;
+    for (i = 0; i < fh->block_count; i++)
+        refbuf_release (fh->blocks [i]);
+    free (fh->blocks);
+    fh->blocks = NULL;
+    fh->block_count = 0;
+    fh_cache_bytes_sub (fh->cache_size);
+    fh->cache_size = 0;
+}
+
+
+/* called with fh locked, sets up the block cache if the file is worth it and
+ * there is room for it. The whole file size is taken from the total up front.
+ */
+static int fh_cache_setup (fh_node *fh)
+{
+    struct stat st;
+
+    if (fh->cache_disabled)
+        return -1;
+    if ((fh->finfo.flags & FS_FALLBACK) == 0 && fh->refcount < 2)
+        return -1;  // not popular yet
+    if (fstat (fh->f, &st) < 0 || st.st_size == 0 || st.st_size > FH_CACHE_MAX)
+    {
+        fh->cache_disabled = 1;
+        return -1;
+    }
+    if (fh_cache_bytes_add (st.st_size) > FH_CACHE_TOTAL)
+    {
+        fh_cache_bytes_sub (st.st_size);
+        return -1;  // full, may be room later
+    }
+    fh->cache_size = st.st_size;
+    fh->block_count = (unsigned int)((st.st_size + FH_BLOCK_SIZE - 1) / FH_BLOCK_SIZE);
+    fh->blocks = calloc (fh->block_count, sizeof (refbuf_t *));
+    if (fh->blocks == NULL)
+        abort();
+    DEBUG2 ("caching %s in %u blocks", fh->finfo.mount, fh->block_count);
+    return 0;
+}
+
+
+/* plugin hook for the shared file blocks, reads the block on first use */
+static int fh_file_block (format_plugin_t *plugin, uint64_t offset, refbuf_t **block, uint64_t *start)
+{
+    fh_node *fh = plugin->file_data;
+    uint64_t idx = offset / FH_BLOCK_SIZE;
+    refbuf_t *r;
+
+    thread_mutex_lock (&fh->lock);
+    if (fh->blocks == NULL && fh_cache_setup (fh) < 0)
+    {
+        thread_mutex_unlock (&fh->lock);
+        return -1;
+    }
+    if (idx >= fh->block_count)
+    {
+        thread_mutex_unlock (&fh->lock);
+        return 0;
+    }
+    r = fh->blocks [idx];
+    if (r)
+        fh->cache_hits++;
+    else
+    {
+        ssize_t bytes;
+
+        r = refbuf_new (FH_BLOCK_SIZE);
+        bytes = pread (fh->f, r->data, FH_BLOCK_SIZE, idx * FH_BLOCK_SIZE);
+        if (bytes <= 0)
+        {
+            thread_mutex_unlock (&fh->lock);
+            refbuf_release (r);
+            return bytes < 0 ? -2 : 0;
+        }
+        r->len = bytes;
+        fh->blocks [idx] = r;
+        fh->cache_misses++;
+    }
+    if (offset >= idx * FH_BLOCK_SIZE + r->len)
+    {
+        thread_mutex_unlock (&fh->lock);
+        return 0;   // file has shrunk
+    }
+    refbuf_addref (r);
+    thread_mutex_unlock (&fh->lock);
+    *block = r;
+    *start = idx * FH_BLOCK_SIZE;
+    return 1;
+}
+
+
 static int _delete_fh (void *mapping)
 {
     fh_node *fh = mapping;
@@ -240,6 +368,7 @@ static int _delete_fh (void *mapping)
         thread_mutex_destroy (&fh->lock);
 
     file_close (&fh->f);
+    fh_cache_release (fh);
     if (fh->format)
     {
         free (fh->format->mount);
@@ -402,6 +531,8 @@ static fh_node *open_fh (fbinfo *finfo)
         free (fullpath);
         fh->format = calloc (1, sizeof (format_plugin_t));
         fh->format->type = fh->finfo.type;
+        fh->format->file_block = fh_file_block;
+        fh->format->file_data = fh;
         fh->format->contenttype = strdup (contenttype);
         free (contenttype);
         if (fh->finfo.type != FORMAT_TYPE_UNDEFINED)
@@ -603,11 +734,38 @@ int fserve_client_create (client_t *httpclient, const char *path)
 
 
 
+/* for rate limited files, let the kernel do the smoothing if allowed, so
+ * that the client can be sent larger pieces less often */
+static void fserve_pacing_setup (client_t *client, fh_node *fh)
+{
+    ice_config_t *config = config_get_config ();
+    int pacing = config->fileserve_pacing;
+    unsigned int rate = fh->finfo.limit;
+
+    config_release_config ();
+    if (pacing == 0 || rate < FSERVE_PACED_MIN_RATE)
+        return;
+    rate += rate/32;    // slack for any wrapping and headers, the average is checked anyway
+    if (sock_set_pacing_rate (client->connection.sock, rate) == 0)
+        client->flags |= CLIENT_KERNEL_PACED;
+}
+
+
+static void fserve_pacing_clear (client_t *client)
+{
+    if ((client->flags & CLIENT_KERNEL_PACED) == 0)
+        return;
+    sock_set_pacing_rate (client->connection.sock, 0);
+    client->flags &= ~CLIENT_KERNEL_PACED;
+}
+
+
 static void file_release (client_t *client)
 {
     fh_node *fh = client->shared_data;
     int ret = -1;
 
+    fserve_pacing_clear (client);
     if ((fh->finfo.flags & FS_FALLBACK) && (client->flags & CLIENT_AUTHENTICATED))
     {
         // reduce from global count
@@ -679,6 +837,8 @@ static int fserve_move_listener (client_t *client)
     int ret = 0;
     fbinfo f;
 
+    fserve_pacing_clear (client);
+
     memset (&f, 0, sizeof (f));
     if (client->refbuf && client->pos < client->refbuf->len)
         client->flags |= CLIENT_HAS_INTRO_CONTENT; // treat it as a partial write needing completion
@@ -762,6 +922,7 @@ static int prefile_send (client_t *client)
                     if (fh->finfo.limit)
                     {
                         client->ops = &throttled_file_content_ops;
+                        fserve_pacing_setup (client, fh);
                         rate_add (fh->out_bitrate, 0, worker->time_ms);
                         return 0;
                     }
@@ -793,7 +954,7 @@ static int prefile_send (client_t *client)
             return 0;
         }
         written += bytes;
-        global_add_bitrates (global.out_bitrate, bytes, worker->time_ms);
+        global_add_bitrates (worker, bytes, worker->time_ms);
         if (written > 30000)
             break;
     }
@@ -801,6 +962,59 @@ static int prefile_send (client_t *client)
 }
 
 
+#ifdef HAVE_SYS_SENDFILE_H
+/* clients taking the file content as is can have it sent by the kernel
+ * straight from the file, avoiding the read into a buffer */
+static int fserve_can_sendfile (client_t *client, fh_node *fh)
+{
+    if (client->refbuf || client->check_buffer != format_generic_write_to_client)
+        return 0;
+    if (connection_plain_send (&client->connection) == 0 || (client->flags & CLIENT_CHUNKED))
+        return 0;
+    if (fh->format && fh->format->align_buffer)
+        return 0;
+    return file_in_use (fh->f);
+}
+
+
+/* returns bytes sent, -1 if none could be and -2 at end of file or range */
+static int fserve_sendfile (client_t *client, fh_node *fh, unsigned int len)
+{
+    off_t offset = client->intro_offset;
+    int ret;
+
+    if (client->flags & CLIENT_RANGE_END)
+    {
+        if (client->intro_offset >= client->connection.discon.offset)
+        {
+            DEBUG1 ("End of requested range (%" PRId64 ")", client->connection.discon.offset);
+            return -2;
+        }
+        if (client->connection.discon.offset < (uint64_t)-1)
+        {
+            uint64_t range = client->connection.discon.offset - client->intro_offset + 1;
+            if (range < len)
+                len = (unsigned int)range;
+        }
+    }
+    else
+        if (client->connection.discon.time && client->worker->current_time.tv_sec >= client->connection.discon.time)
+            return -2;
+
+    ret = connection_sendfile (&client->connection, fh->f, &offset, len);
+    if (ret == 0)
+        return -2;
+    if (ret > 0)
+    {
+        client->intro_offset += ret;
+        client->counter += ret;
+        client->queue_pos += ret;
+    }
+    return ret;
+}
+#endif
+
+
 /* fast send routine */
 static int file_send (client_t *client)
 {
@@ -827,6 +1041,21 @@ static int file_send (client_t *client)
         loop--;
         if (fserve_running == 0 || client->connection.error)
             return -1;
+#ifdef HAVE_SYS_SENDFILE_H
+        if (fserve_can_sendfile (client, fh))
+        {
+            bytes = fserve_sendfile (client, fh, 48000 - written);
+            if (bytes == -2)
+                return -1;
+            if (bytes < 0 || client->connection.wouldblock)
+            {
+                client->schedule_ms += (written || bytes > 0 ? 80 : 150);
+                return 0;
+            }
+            written += bytes;
+            continue;
+        }
+#endif
         if (format_file_read (client, fh->format, fh->f) < 0)
             return -1;
         bytes = client->check_buffer (client);
@@ -852,7 +1081,7 @@ static int throttled_file_send (client_t *client)
     worker_t *worker = client->worker;
     unsigned long secs; 
     unsigned int  rate = 0;
-    unsigned int limit = fh->finfo.limit;
+    unsigned int limit = fh->finfo.limit, batch = 0;
 
     if (fserve_running == 0 || client->connection.error)
         return -1;
@@ -867,37 +1096,78 @@ static int throttled_file_send (client_t *client)
 
     if (client->flags & CLIENT_WANTS_FLV) /* increase limit for flv clients as wrapping takes more space */
         limit = (unsigned long)(limit * 1.01);
+    if (client->flags & CLIENT_KERNEL_PACED)
+    {
+        // the kernel spreads out the data so write a larger piece less often
+        batch = limit / (1000/FSERVE_PACED_INTERVAL);
+        if (batch > FSERVE_PACED_BATCH_MAX)
+            batch = FSERVE_PACED_BATCH_MAX;
+    }
     rate = secs ? (client->counter+1400)/secs : limit * 2;
     // DEBUG3 ("counter %lld, duration %ld, limit %u", client->counter, secs, rate);
     if (rate > limit)
     {
-        if (limit >= 1400)
+        if (batch)
+            client->schedule_ms += FSERVE_PACED_INTERVAL;
+        else if (limit >= 1400)
             client->schedule_ms += 1000/(limit/1400);
         else
             client->schedule_ms += 50; // should not happen but guard against it
         rate_add (fh->out_bitrate, 0, worker->time_ms);
-        global_add_bitrates (global.out_bitrate, 0, worker->time_ms);
+        global_add_bitrates (worker, 0, worker->time_ms);
         if (client->counter > 8192)
             return 0; // allow an initial amount without throttling
     }
-    switch (format_file_read (client, fh->format, fh->f))
+#ifdef HAVE_SYS_SENDFILE_H
+    if (fserve_can_sendfile (client, fh))
     {
-        case -1: // DEBUG0 ("loop of file triggered");
-            client->intro_offset = 0;
+        // send what is due at the limit since the start, up to the usual read size
+        uint64_t due = (uint64_t)limit * (secs + 1);
+        unsigned int len = batch ? batch : 8192;
+
+        if (due > client->counter && due - client->counter < len)
+            len = (unsigned int)(due - client->counter);
+        if (len < 1400)
+            len = 1400;
+        bytes = fserve_sendfile (client, fh, len);
+        if (bytes == -2)
+        {
+            client->intro_offset = 0;   // loop of file triggered
             client->schedule_ms += client->throttle ? client->throttle : 150;
             return 0;
-        case -2: // DEBUG0 ("major failure on read, better leave");
-            return -1;
-        default: //DEBUG1 ("reading from offset %ld", client->intro_offset);
-            break;
+        }
+    }
+    else
+#endif
+    {
+        int written = 0;
+        do
+        {
+            switch (format_file_read (client, fh->format, fh->f))
+            {
+                case -1: // DEBUG0 ("loop of file triggered");
+                    client->intro_offset = 0;
+                    client->schedule_ms += client->throttle ? client->throttle : 150;
+                    return 0;
+                case -2: // DEBUG0 ("major failure on read, better leave");
+                    return -1;
+                default: //DEBUG1 ("reading from offset %ld", client->intro_offset);
+                    break;
+            }
+            bytes = client->check_buffer (client);
+            if (bytes > 0)
+                written += bytes;
+        } while (bytes > 0 && written < batch && client->connection.wouldblock == 0);
+        bytes = written ? written : bytes;
     }
-    bytes = client->check_buffer (client);
     if (bytes < 0)
         bytes = 0;
     //DEBUG3 ("bytes %d, counter %ld, %ld", bytes, client->counter, client->worker->time_ms - (client->timer_start*1000));
     rate_add (fh->out_bitrate, bytes, worker->time_ms);
-    global_add_bitrates (global.out_bitrate, bytes, worker->time_ms);
-    if (limit > 2800)
+    global_add_bitrates (worker, bytes, worker->time_ms);
+    if (batch)
+        client->schedule_ms += FSERVE_PACED_INTERVAL;
+    else if (limit > 2800)
         client->schedule_ms += (1000/(limit/1400*2));
     else
         client->schedule_ms += 50;
@@ -1071,6 +1341,8 @@ int fserve_set_override (const char *mount, const char *dest, format_type_t type
             copy->expire = (time_t)-1;
             copy->stats = result->stats;
             copy->format = result->format;
+            if (copy->format)
+                copy->format->file_data = copy;
             copy->f = result->f;
             thread_mutex_create (&copy->lock);
             copy->out_bitrate = rate_setup (10000, 1000);
@@ -1460,6 +1732,9 @@ void fserve_scan (time_t now)
 
         thread_mutex_lock (&fh->lock);
 
+        fh_cache_hits += fh->cache_hits;
+        fh_cache_misses += fh->cache_misses;
+        fh->cache_hits = fh->cache_misses = 0;
         if (now == (time_t)0)
         {
             fh->expire = 0;
@@ -1520,6 +1795,18 @@ void fserve_scan (time_t now)
         thread_mutex_unlock (&fh->lock);
     }
     avl_tree_unlock (fh_cache);
+
+    if (now)
+    {
+        char buf[24];
+
+        snprintf (buf, sizeof buf, "%" PRIu64, fh_cache_hits);
+        stats_event_flags (NULL, "file_cache_hits", buf, STATS_COUNTERS);
+        snprintf (buf, sizeof buf, "%" PRIu64, fh_cache_misses);
+        stats_event_flags (NULL, "file_cache_misses", buf, STATS_COUNTERS);
+        snprintf (buf, sizeof buf, "%" PRIu64, (uint64_t)fh_cache_bytes_get());
+        stats_event_flags (NULL, "file_cache_bytes", buf, STATS_COUNTERS);
+    }
 }
 
 
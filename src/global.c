@@ -33,6 +33,10 @@ ice_global_t global;
 
 static mutex_t _global_mutex;
 
+/* merges come from the slave tick, the stats thread and workers, they are
+ * serialised so samples go into the rate in time order */
+static spin_t rate_merge_lock;
+
 void global_initialize(void)
 {
     memset (&global, 0, sizeof (global));
@@ -42,12 +46,14 @@ void global_initialize(void)
 #endif
     thread_mutex_create(&_global_mutex);
     thread_rwlock_create(&global.workers_rw);
+    thread_spin_create (&rate_merge_lock);
     global.out_bitrate = rate_setup (20000, 1000);
 }
 
 void global_shutdown(void)
 {
     thread_rwlock_destroy(&global.workers_rw);
+    thread_spin_destroy (&rate_merge_lock);
     thread_mutex_destroy(&_global_mutex);
     avl_tree_free(global.source_tree, NULL);
     rate_free (global.out_bitrate);
@@ -67,19 +73,97 @@ void global_unlock(void)
     thread_mutex_unlock(&_global_mutex);
 }
 
-void global_add_bitrates (struct rate_calc *rate, unsigned long value, uint64_t milli)
+
+/* Outgoing byte counts are kept per worker rather than going straight into
+ * the global rate, every send would otherwise take the same spinlock. Each
+ * shard sits on its own cache line and is only ever added to by the workers
+ * mapped to it, the totals are moved into the rate when it is read or on the
+ * slave thread tick.
+ */
+#define GLOBAL_RATE_SHARDS      64
+#define GLOBAL_RATE_LINE        64
+
+struct global_rate_shard
 {
-    rate_add (rate, value, milli);
+    uint64_t bytes;     /* not yet merged */
+    uint64_t milli;     /* time of the latest addition */
+    char pad [GLOBAL_RATE_LINE - 2*sizeof (uint64_t)];
+};
+
+#ifdef __GNUC__
+static struct global_rate_shard rate_shards [GLOBAL_RATE_SHARDS] __attribute__((aligned(GLOBAL_RATE_LINE)));
+#define rate_shard_add(s,v)     __atomic_fetch_add (&(s)->bytes, (v), __ATOMIC_RELAXED)
+#define rate_shard_take(s)      __atomic_exchange_n (&(s)->bytes, 0, __ATOMIC_RELAXED)
+#define rate_shard_stamp(s,t)   __atomic_store_n (&(s)->milli, (t), __ATOMIC_RELAXED)
+#define rate_shard_time(s)      __atomic_load_n (&(s)->milli, __ATOMIC_RELAXED)
+#else
+static struct global_rate_shard rate_shards [GLOBAL_RATE_SHARDS];
+#define rate_shard_add(s,v)     ((s)->bytes += (v))
+static uint64_t rate_shard_take (struct global_rate_shard *s)
+{
+    uint64_t v = s->bytes;
+    s->bytes = 0;
+    return v;
+}
+#define rate_shard_stamp(s,t)   ((s)->milli = (t))
+#define rate_shard_time(s)      ((s)->milli)
+#endif
+
+static uint64_t rate_merged_milli;
+
+
+void global_add_bitrates (worker_t *worker, unsigned long value, uint64_t milli)
+{
+    struct global_rate_shard *shard = &rate_shards [worker ? (worker->id+1) & (GLOBAL_RATE_SHARDS-1) : 0];
+
+    if (value)
+        rate_shard_add (shard, value);
+    if (rate_shard_time (shard) < milli)
+        rate_shard_stamp (shard, milli);
+}
+
+
+/* move the shard totals into the rate as one sample, stamped with the latest
+ * time seen so samples keep going forward. milli may be 0 if only the shard
+ * times are to be used.
+ */
+void global_merge_bitrates (struct rate_calc *rate, uint64_t milli)
+{
+    uint64_t total = 0;
+    int i;
+
+    thread_spin_lock (&rate_merge_lock);
+    for (i = 0; i < GLOBAL_RATE_SHARDS; i++)
+    {
+        struct global_rate_shard *shard = &rate_shards [i];
+        uint64_t t = rate_shard_time (shard);
+
+        total += rate_shard_take (shard);
+        if (t > milli)
+            milli = t;
+    }
+    if (milli < rate_merged_milli)
+        milli = rate_merged_milli;
+    if (milli)
+    {
+        rate_merged_milli = milli;
+        rate_add (rate, total, milli);
+    }
+    thread_spin_unlock (&rate_merge_lock);
 }
 
 void global_reduce_bitrate_sampling (struct rate_calc *rate)
 {
+    global_merge_bitrates (rate, 0);
     rate_reduce (rate, 2000);
 }
 
 unsigned long global_getrate_avg (struct rate_calc *rate)
 {
-    unsigned long avg = rate_avg (rate);
+    unsigned long avg;
+
+    global_merge_bitrates (rate, 0);
+    avg = rate_avg (rate);
     if (global.max_rate)
     {
         float ratio = avg / global.max_rate;
@@ -31,6 +31,7 @@ typedef struct ice_global_tag
     int server_sockets;
     sock_t *serversock;
     struct _listener_t **server_conn;
+    int server_sockets_gen;     /* bumped when the listening sockets change */
 
     int running;
 
@@ -61,6 +62,8 @@ typedef struct ice_global_tag
 
 extern unsigned int throttle_sends;
 
+struct _worker_t;
+
 extern void initialize_subsystems (void);
 extern void shutdown_subsystems (void);
 extern void server_process (void);
@@ -94,7 +97,8 @@ void global_initialize(void);
 void global_shutdown(void);
 void global_lock(void);
 void global_unlock(void);
-void global_add_bitrates (struct rate_calc *rate, unsigned long value, uint64_t milli);
+void global_add_bitrates (struct _worker_t *worker, unsigned long value, uint64_t milli);
+void global_merge_bitrates (struct rate_calc *rate, uint64_t milli);
 void global_reduce_bitrate_sampling (struct rate_calc *rate);
 unsigned long global_getrate_avg (struct rate_calc *rate);
 
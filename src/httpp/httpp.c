@@ -27,17 +27,71 @@
 #define strcasecmp stricmp
 #endif
 
-#define MAX_HEADERS 32
+#define MAX_HEADERS HTTPP_MAX_HEADERS
 
 /* internal functions */
 
 /* misc */
+static unsigned int _header_hash(const char *name)
+{
+    unsigned int hash = 5381;
+
+    while (*name)
+        hash = (hash * 33) ^ (unsigned char)*name++;
+    return hash;
+}
+
+static http_header_t *_find_header(http_parser_t *parser, const char *name)
+{
+    unsigned int slot, probe;
+
+    if (parser->header_count == 0)
+        return NULL;
+    slot = _header_hash(name);
+    for (probe = 0; probe < HTTPP_HEADER_SLOTS; probe++, slot++) {
+        unsigned int idx = parser->header_slot[slot & (HTTPP_HEADER_SLOTS-1)];
+
+        if (idx == 0)
+            break;
+        if (strcmp(parser->headers[idx-1].name, name) == 0)
+            return &parser->headers[idx-1];
+    }
+    return NULL;
+}
+
+/* name and value are expected to remain for the life of the parse */
+static void _add_header(http_parser_t *parser, const char *name, const char *value)
+{
+    unsigned int slot = _header_hash(name), probe;
+
+    for (probe = 0; probe < HTTPP_HEADER_SLOTS; probe++, slot++) {
+        unsigned char *p = &parser->header_slot[slot & (HTTPP_HEADER_SLOTS-1)];
+
+        if (*p == 0) {
+            if (parser->header_count >= HTTPP_MAX_HEADERS)
+                return;
+            parser->headers[parser->header_count].name = name;
+            parser->headers[parser->header_count].value = value;
+            *p = ++parser->header_count;
+            return;
+        }
+        if (strcmp(parser->headers[*p-1].name, name) == 0) {
+            parser->headers[*p-1].value = value;   /* repeated header, last one wins */
+            return;
+        }
+    }
+}
+
 static char *_lowercase(char *str);
 
 /* for avl trees */
 static int _compare_vars(void *compare_arg, void *a, void *b);
 static int _free_vars(void *key);
 
+/* header index */
+static http_header_t *_find_header(http_parser_t *parser, const char *name);
+static void _add_header(http_parser_t *parser, const char *name, const char *value);
+
 http_parser_t *httpp_create_parser(void)
 {
     return (http_parser_t *)malloc(sizeof(http_parser_t));
@@ -51,6 +105,9 @@ void httpp_initialize(http_parser_t *parser, http_varlist_t *defaults)
     parser->uri = NULL;
     parser->vars = avl_tree_new(_compare_vars, NULL);
     parser->queryvars = avl_tree_new(_compare_vars, NULL);
+    parser->data = NULL;
+    parser->header_count = 0;
+    memset(parser->header_slot, 0, sizeof(parser->header_slot));
 
     /* now insert the default variables */
     list = defaults;
@@ -97,6 +154,12 @@ static void parse_headers(http_parser_t *parser, char **line, int lines)
     char *name = NULL;
     char *value = NULL;
 
+    /* the header index refers to the data for this parse only */
+    free(parser->data);
+    parser->data = NULL;
+    parser->header_count = 0;
+    memset(parser->header_slot, 0, sizeof(parser->header_slot));
+
     /* parse the name: value lines. */
     for (l = 1; l < lines; l++) {
         whitespace = 0;
@@ -122,7 +185,7 @@ static void parse_headers(http_parser_t *parser, char **line, int lines)
         }
         
         if (name != NULL && value != NULL) {
-            httpp_setvar(parser, _lowercase(name), value);
+            _add_header(parser, _lowercase(name), value);
             name = NULL; 
             value = NULL;
         }
@@ -183,8 +246,7 @@ int httpp_parse_response(http_parser_t *parser, const char *http_data, unsigned
     httpp_setvar(parser, HTTPP_VAR_REQ_TYPE, "NONE");
 
     parse_headers(parser, line, lines);
-
-    free(data);
+    parser->data = data;
 
     return 1;
 }
@@ -432,7 +494,8 @@ int httpp_parse(http_parser_t *parser, const char *http_data, unsigned long len)
 
     parse_headers(parser, line, lines);
 
-    free(data);
+    /* header names and values refer to this copy */
+    parser->data = data;
 
     return 1;
 }
@@ -441,8 +504,13 @@ void httpp_deletevar(http_parser_t *parser, const char *name)
 {
     http_var_t var;
 
+    http_header_t *header;
+
     if (parser == NULL || name == NULL)
         return;
+    header = _find_header(parser, name);
+    if (header)
+        header->value = NULL;
     var.name = (char*)name;
     var.value = NULL;
     avl_delete(parser->vars, (void *)&var, _free_vars);
@@ -451,10 +519,15 @@ void httpp_deletevar(http_parser_t *parser, const char *name)
 void httpp_setvar(http_parser_t *parser, const char *name, const char *value)
 {
     http_var_t *var;
+    http_header_t *header;
 
     if (name == NULL || value == NULL)
         return;
 
+    header = _find_header(parser, name);
+    if (header)
+        header->value = NULL;  /* now overridden */
+
     var = (http_var_t *)malloc(sizeof(http_var_t));
     if (var == NULL) return;
 
@@ -473,11 +546,16 @@ const char *httpp_getvar(http_parser_t *parser, const char *name)
 {
     http_var_t var;
     http_var_t *found;
+    http_header_t *header;
     void *fp;
 
     if (parser == NULL || name == NULL || parser->vars == NULL)
         return NULL;
 
+    header = _find_header(parser, name);
+    if (header && header->value)
+        return header->value;
+
     fp = &found;
     var.name = (char*)name;
     var.value = NULL;
@@ -535,6 +613,19 @@ void httpp_clear(http_parser_t *parser)
     avl_tree_free(parser->queryvars, _free_vars);
     parser->vars = NULL;
     parser->queryvars = NULL;
+    free(parser->data);
+    parser->data = NULL;
+    parser->header_count = 0;
+    memset(parser->header_slot, 0, sizeof(parser->header_slot));
+}
+
+/* iterate the request headers, returns NULL once past the last. Removed or
+ * overridden headers are still returned but with a NULL value */
+const http_header_t *httpp_get_header(http_parser_t *parser, unsigned int idx)
+{
+    if (parser == NULL || idx >= parser->header_count)
+        return NULL;
+    return &parser->headers[idx];
 }
 
 void httpp_destroy(http_parser_t *parser)
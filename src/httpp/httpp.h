@@ -36,11 +36,25 @@ typedef struct http_varlist_tag {
     struct http_varlist_tag *next;
 } http_varlist_t;
 
+#define HTTPP_MAX_HEADERS   32
+#define HTTPP_HEADER_SLOTS  64      /* power of 2, twice the max headers */
+
+/* request headers as parsed, name and value refer to the parser copy of the
+ * request so no allocation is needed per header. value is NULL if removed */
+typedef struct http_header_tag {
+    const char *name;
+    const char *value;
+} http_header_t;
+
 typedef struct http_parser_tag {
     httpp_request_type_e req_type;
     char *uri;
     avl_tree *vars;
     avl_tree *queryvars;
+    char *data;
+    unsigned int header_count;
+    http_header_t headers [HTTPP_MAX_HEADERS];
+    unsigned char header_slot [HTTPP_HEADER_SLOTS]; /* open addressed, index+1 into headers */
 } http_parser_t;
 
 #ifdef _mangle
@@ -55,6 +69,7 @@ typedef struct http_parser_tag {
 # define httpp_get_query_param _mangle(httpp_get_query_param)
 # define httpp_destroy _mangle(httpp_destroy)
 # define httpp_clear _mangle(httpp_clear)
+# define httpp_get_header _mangle(httpp_get_header)
 #endif
 
 http_parser_t *httpp_create_parser(void);
@@ -69,5 +84,6 @@ void httpp_set_query_param(http_parser_t *parser, const char *name, const char *
 const char *httpp_get_query_param(http_parser_t *parser, const char *name);
 void httpp_destroy(http_parser_t *parser);
 void httpp_clear(http_parser_t *parser);
+const http_header_t *httpp_get_header(http_parser_t *parser, unsigned int idx);
  
 #endif
@@ -0,0 +1,541 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* iptrie.c
+**
+** IPv4/IPv6 address lists with CIDR prefixes, used for the ban and allow
+** files.
+**
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#else
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+
+#include "avl/avl.h"
+#include "net/sock.h"
+#include "util.h"
+#include "iptrie.h"
+
+#define CATMODULE "iptrie"
+
+#include "logging.h"
+
+/* Addresses are held as 128 bits, IPv4 being mapped as ::ffff:a.b.c.d so
+ * that both types share the one trie. Each node is a prefix, the children
+ * extend it with the next bit being 0 or 1, single child paths are skipped.
+ *
+ * Readers walk the published root without locking. A change never alters a
+ * node that is reachable, the nodes on the path are copied and the new root
+ * is published (path copying). Replaced nodes go on a retired list and are
+ * only freed once IP_LIST_GRACE seconds have passed, far longer than any
+ * walk can take. The expiry time is the one field updated in place.
+ */
+#define IP_LIST_GRACE       30
+#define IP_LIST_PURGE       60
+#define IP_PURGE_BATCH      64
+
+#ifdef __GNUC__
+#define ip_list_publish(p,v)    __atomic_store_n (&(p), (v), __ATOMIC_RELEASE)
+#define ip_list_fetch(p)        __atomic_load_n (&(p), __ATOMIC_ACQUIRE)
+#define ip_expire_set(p,v)      __atomic_store_n (&(p), (v), __ATOMIC_RELAXED)
+#define ip_expire_get(p)        __atomic_load_n (&(p), __ATOMIC_RELAXED)
+#else
+#define ip_list_publish(p,v)    ((p) = (v))
+#define ip_list_fetch(p)        (p)
+#define ip_expire_set(p,v)      ((p) = (v))
+#define ip_expire_get(p)        (p)
+#endif
+
+struct ip_node
+{
+    struct ip_node *child [2];
+    time_t expire;              /* 0 for no expiry */
+    unsigned char addr [16];
+    unsigned char bits;
+    unsigned char entry;        /* prefix is listed, else just a branch point */
+};
+
+struct ip_pattern
+{
+    struct ip_pattern *next;
+    char pattern [];
+};
+
+struct ip_retired
+{
+    struct ip_retired *next;
+    time_t when;
+    void *ptr;
+};
+
+
+static int ip_bit (const unsigned char *addr, unsigned int i)
+{
+    return (addr [i>>3] >> (7 - (i&7))) & 1;
+}
+
+
+/* length of the common prefix of a and b, up to max bits */
+static unsigned int ip_common (const unsigned char *a, const unsigned char *b, unsigned int max)
+{
+    unsigned int i = 0;
+
+    while (i < max && a [i>>3] == b [i>>3])
+        i += 8;
+    if (i > max)
+        i = max;
+    while (i < max && ip_bit (a, i) == ip_bit (b, i))
+        i++;
+    return i;
+}
+
+
+static void ip_mask (unsigned char *addr, unsigned int bits)
+{
+    unsigned int i;
+
+    for (i = bits; i < 128; i++)
+        addr [i>>3] &= ~(0x80 >> (i&7));
+}
+
+
+/* convert a.b.* or a.b.*.* style wildcards to a prefix length */
+static int ip_parse_wildcard (const char *str, unsigned char *v4)
+{
+    unsigned int octets = 0, wild = 1, value;
+
+    memset (v4, 0, 4);
+    while (octets < 4 && isdigit ((unsigned char)*str))
+    {
+        value = 0;
+        while (isdigit ((unsigned char)*str))
+            value = value * 10 + (*str++ - '0');
+        if (value > 255 || *str != '.')
+            return -1;
+        v4 [octets++] = value;
+        str++;
+    }
+    if (octets == 0 || octets > 3)
+        return -1;
+    while (strncmp (str, "*.", 2) == 0)
+    {
+        str += 2;
+        wild++;
+    }
+    if (strcmp (str, "*") != 0 || (wild > 1 && octets + wild != 4))
+        return -1;
+    return octets * 8;
+}
+
+
+/* parse an address with optional /prefix into 128 bits, returns the prefix
+ * length or -1 if not an address */
+static int ip_parse (const char *str, unsigned char *addr)
+{
+    char buf [64];
+    const char *slash;
+    unsigned char v4 [4];
+    int len, bits, base = 0, maxbits = 128;
+
+    while (isspace ((unsigned char)*str))
+        str++;
+    len = strcspn (str, "/ \t\r\n");
+    if (len == 0 || len >= sizeof buf)
+        return -1;
+    memcpy (buf, str, len);
+    buf [len] = '\0';
+    slash = str [len] == '/' ? str + len + 1 : NULL;
+
+    memset (addr, 0, 16);
+    if (inet_pton (AF_INET, buf, v4) == 1)
+    {
+        base = 96;
+        maxbits = 32;
+        bits = 32;
+    }
+    else if (inet_pton (AF_INET6, buf, addr) == 1)
+        bits = 128;
+    else
+    {
+        if (slash || (bits = ip_parse_wildcard (buf, v4)) < 0)
+            return -1;
+        base = 96;
+    }
+    if (base)
+    {
+        addr [10] = addr [11] = 0xff;
+        memcpy (addr + 12, v4, 4);
+    }
+    if (slash)
+    {
+        char *end;
+        long n = strtol (slash, &end, 10);
+        if (end == slash || n < 0 || n > maxbits)
+            return -1;
+        bits = (int)n;
+    }
+    bits += base;
+    ip_mask (addr, bits);
+    return bits;
+}
+
+
+static void ip_retire (ip_list_t *list, void *ptr, time_t now)
+{
+    struct ip_retired *r = malloc (sizeof (*r));
+
+    if (r == NULL)
+        abort();
+    r->ptr = ptr;
+    r->when = now;
+    r->next = list->retired;
+    list->retired = r;
+}
+
+
+/* free what has been retired long enough for any reader to have finished */
+static void ip_retired_free (ip_list_t *list, time_t now)
+{
+    struct ip_retired **prev = &list->retired, *r;
+
+    while ((r = *prev))
+    {
+        if (r->when + IP_LIST_GRACE <= now)
+        {
+            *prev = r->next;
+            free (r->ptr);
+            free (r);
+            continue;
+        }
+        prev = &r->next;
+    }
+}
+
+
+static struct ip_node *ip_node_new (const unsigned char *addr, unsigned int bits, int entry, time_t expire)
+{
+    struct ip_node *node = calloc (1, sizeof (*node));
+
+    if (node == NULL)
+        abort();
+    memcpy (node->addr, addr, 16);
+    ip_mask (node->addr, bits);
+    node->bits = bits;
+    node->entry = entry;
+    node->expire = expire;
+    return node;
+}
+
+
+static struct ip_node *ip_node_copy (ip_list_t *list, struct ip_node *node, time_t now)
+{
+    struct ip_node *copy = malloc (sizeof (*copy));
+
+    if (copy == NULL)
+        abort();
+    *copy = *node;
+    copy->expire = ip_expire_get (node->expire);
+    ip_retire (list, node, now);
+    return copy;
+}
+
+
+/* returns the new subtree root, *added is set if the prefix was not listed */
+static struct ip_node *ip_node_insert (ip_list_t *list, struct ip_node *node, const unsigned char *addr,
+        unsigned int bits, time_t expire, time_t now, int *added)
+{
+    unsigned int common;
+    struct ip_node *n;
+
+    if (node == NULL)
+    {
+        *added = 1;
+        return ip_node_new (addr, bits, 1, expire);
+    }
+    common = ip_common (node->addr, addr, node->bits < bits ? node->bits : bits);
+    if (common == node->bits)
+    {
+        n = ip_node_copy (list, node, now);
+        if (common == bits)
+        {
+            *added = (n->entry == 0);
+            n->entry = 1;
+            n->expire = expire;
+        }
+        else
+        {
+            int b = ip_bit (addr, common);
+            n->child [b] = ip_node_insert (list, node->child [b], addr, bits, expire, now, added);
+        }
+        return n;
+    }
+    *added = 1;
+    if (common == bits)
+    {
+        /* new prefix covers this node */
+        n = ip_node_new (addr, bits, 1, expire);
+        n->child [ip_bit (node->addr, bits)] = node;
+        return n;
+    }
+    /* paths diverge, add a branch point */
+    n = ip_node_new (addr, common, 0, 0);
+    n->child [ip_bit (addr, common)] = ip_node_new (addr, bits, 1, expire);
+    n->child [ip_bit (node->addr, common)] = node;
+    return n;
+}
+
+
+/* remove an exact prefix, returns the new subtree root */
+static struct ip_node *ip_node_remove (ip_list_t *list, struct ip_node *node, const unsigned char *addr,
+        unsigned int bits, time_t now, int *removed)
+{
+    struct ip_node *sub, *n;
+    int b;
+
+    if (node == NULL || node->bits > bits || ip_common (node->addr, addr, node->bits) < node->bits)
+        return node;
+    if (node->bits == bits)
+    {
+        if (node->entry == 0)
+            return node;
+        *removed = 1;
+        if (node->child [0] && node->child [1])
+        {
+            n = ip_node_copy (list, node, now);
+            n->entry = 0;
+            n->expire = 0;
+            return n;
+        }
+        ip_retire (list, node, now);
+        return node->child [0] ? node->child [0] : node->child [1];
+    }
+    b = ip_bit (addr, node->bits);
+    sub = ip_node_remove (list, node->child [b], addr, bits, now, removed);
+    if (sub == node->child [b])
+        return node;
+    if (node->entry == 0 && sub == NULL)
+    {
+        /* branch point no longer needed */
+        ip_retire (list, node, now);
+        return node->child [b^1];
+    }
+    n = ip_node_copy (list, node, now);
+    n->child [b] = sub;
+    return n;
+}
+
+
+static void ip_node_retire_all (ip_list_t *list, struct ip_node *node, time_t now)
+{
+    while (node)
+    {
+        struct ip_node *next = node->child [1];
+        ip_node_retire_all (list, node->child [0], now);
+        ip_retire (list, node, now);
+        node = next;
+    }
+}
+
+
+static void ip_patterns_retire (ip_list_t *list, struct ip_pattern *p, time_t now)
+{
+    while (p)
+    {
+        struct ip_pattern *next = p->next;
+        ip_retire (list, p, now);
+        p = next;
+    }
+}
+
+
+/* lookup, no locking needed. Returns -1 if there is no list loaded, 0 if not
+ * matched and 1 on a match. A matched entry with an expiry is extended so that
+ * an address that keeps trying stays listed.
+ */
+int ip_list_search (ip_list_t *list, const char *ip, time_t now)
+{
+    unsigned char addr [16];
+    struct ip_node *node;
+    struct ip_pattern *p;
+
+    if (ip_list_fetch (list->loaded) == 0)
+        return -1;
+    if (ip_parse (ip, addr) >= 0)
+    {
+        node = ip_list_fetch (list->root);
+        while (node && ip_common (node->addr, addr, node->bits) == node->bits)
+        {
+            if (node->entry)
+            {
+                time_t expire = ip_expire_get (node->expire);
+                if (expire == 0)
+                    return 1;
+                if (expire > now)
+                {
+                    if (now + 300 > expire)
+                        ip_expire_set (node->expire, now + 300);
+                    return 1;
+                }
+            }
+            if (node->bits == 128)
+                break;
+            node = node->child [ip_bit (addr, node->bits)];
+        }
+    }
+    for (p = ip_list_fetch (list->patterns); p; p = p->next)
+    {
+        if (cached_pattern_compare (ip, p->pattern) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+
+/* add an address, prefix or pattern. Caller serialises changes */
+int ip_list_add (ip_list_t *list, const char *ip, time_t expire, time_t now)
+{
+    unsigned char addr [16];
+    int bits = ip_parse (ip, addr), added = 0;
+
+    ip_retired_free (list, now);
+    if (bits < 0)
+    {
+        /* not an address or prefix so match as before, by pattern */
+        struct ip_pattern *p;
+        size_t len = strlen (ip);
+
+        p = malloc (sizeof (*p) + len + 1);
+        if (p == NULL)
+            abort();
+        memcpy (p->pattern, ip, len + 1);
+        p->next = list->patterns;
+        ip_list_publish (list->patterns, p);
+        DEBUG1 ("Adding pattern entry \"%.30s\"", ip);
+        return 0;
+    }
+    ip_list_publish (list->root, ip_node_insert (list, list->root, addr, bits, expire, now, &added));
+    if (added)
+        list->count++;
+    DEBUG1 ("Adding entry \"%.40s\"", ip);
+    return 0;
+}
+
+
+int ip_list_remove (ip_list_t *list, const char *ip, time_t now)
+{
+    unsigned char addr [16];
+    int bits = ip_parse (ip, addr), removed = 0;
+
+    ip_retired_free (list, now);
+    if (bits < 0)
+        return -1;
+    ip_list_publish (list->root, ip_node_remove (list, list->root, addr, bits, now, &removed));
+    if (removed)
+        list->count--;
+    return removed ? 0 : -1;
+}
+
+
+static void ip_collect_expired (struct ip_node *node, time_t now, struct ip_node **found, int *count)
+{
+    while (node && *count < IP_PURGE_BATCH)
+    {
+        time_t expire = ip_expire_get (node->expire);
+        if (node->entry && expire && expire <= now)
+            found [(*count)++] = node;
+        ip_collect_expired (node->child [0], now, found, count);
+        node = node->child [1];
+    }
+}
+
+
+/* remove entries that have expired, done periodically */
+void ip_list_purge (ip_list_t *list, time_t now)
+{
+    struct ip_node *found [IP_PURGE_BATCH];
+    int count = 0, i;
+
+    if (now < list->purge_time)
+        return;
+    list->purge_time = now + IP_LIST_PURGE;
+    ip_retired_free (list, now);
+    ip_collect_expired (list->root, now, found, &count);
+    for (i = 0; i < count; i++)
+    {
+        unsigned char addr [16];
+        unsigned int bits = found [i]->bits;
+        int removed = 0;
+
+        memcpy (addr, found [i]->addr, 16);    // node may be retired by a previous removal
+        ip_list_publish (list->root, ip_node_remove (list, list->root, addr, bits, now, &removed));
+        if (removed)
+            list->count--;
+    }
+    if (count)
+        INFO1 ("removed %d expired entries from list", count);
+}
+
+
+/* replace the contents from the file, or clear it if file is NULL */
+static int ip_list_load (cache_file_contents *cache, FILE *file)
+{
+    ip_list_t *list = cache->data, fresh;
+    time_t now = time (NULL);
+    char line [MAX_LINE_LEN];
+    int count = 0;
+
+    memset (&fresh, 0, sizeof (fresh));
+    fresh.loaded = (file != NULL);
+    if (file)
+    {
+        while (get_line (file, line, MAX_LINE_LEN))
+        {
+            if (!line[0] || line[0] == '#')
+                continue;
+            if (ip_list_add (&fresh, line, 0, now) == 0)
+                count++;
+        }
+        /* nothing built here has been published so free any replaced nodes now */
+        ip_retired_free (&fresh, now + IP_LIST_GRACE);
+    }
+    ip_retired_free (list, now);
+    ip_node_retire_all (list, list->root, now);
+    ip_patterns_retire (list, list->patterns, now);
+    ip_list_publish (list->patterns, fresh.patterns);
+    ip_list_publish (list->root, fresh.root);
+    ip_list_publish (list->loaded, fresh.loaded);
+    list->count = fresh.count;
+    return count;
+}
+
+
+void ip_list_init (cache_file_contents *cache, ip_list_t *list, const char *filename)
+{
+    cached_file_init (cache, filename, NULL, NULL);
+    cache->load = ip_list_load;
+    cache->data = list;
+}
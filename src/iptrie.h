@@ -0,0 +1,47 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* iptrie.h
+**
+** IPv4/IPv6 address lists with CIDR prefixes
+**
+*/
+#ifndef __IPTRIE_H__
+#define __IPTRIE_H__
+
+#include <time.h>
+
+struct _cache_contents;
+struct ip_node;
+struct ip_pattern;
+struct ip_retired;
+
+/* Lookups take no lock. Any change (add, remove, purge, load) must be
+ * serialised by the caller, global_lock is used for that currently.
+ */
+typedef struct ip_list_tag
+{
+    struct ip_node      *root;
+    struct ip_pattern   *patterns;  /* wildcard entries that are not a prefix */
+    struct ip_retired   *retired;   /* replaced, freed after a grace period */
+    unsigned int        count;
+    int                 loaded;
+    time_t              purge_time;
+} ip_list_t;
+
+void ip_list_init (struct _cache_contents *cache, ip_list_t *list, const char *filename);
+int  ip_list_search (ip_list_t *list, const char *ip, time_t now);
+int  ip_list_add (ip_list_t *list, const char *ip, time_t expire, time_t now);
+int  ip_list_remove (ip_list_t *list, const char *ip, time_t now);
+void ip_list_purge (ip_list_t *list, time_t now);
+
+#endif  /* __IPTRIE_H__ */
@@ -25,6 +25,10 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#if defined(HAVE_PTHREAD) && defined(__GNUC__)
+#include <pthread.h>
+#define LOG_RINGS 1
+#endif
 
 
 #include "log.h"
@@ -49,6 +53,42 @@ typedef struct _log_entry_t
 } log_entry_t;
 
 
+#ifdef LOG_RINGS
+/* When a commit callback is set, lines written go into a ring owned by the
+ * writing thread rather than onto the log lists, so the writer never waits
+ * on the logger lock or the disk. The commit (usually on its own thread)
+ * drains the rings in order. One writer and one reader per ring, so only the
+ * head and tail need ordering. A full ring drops a log_write line and counts
+ * it, log_write_direct lines (the access log) take the locked path instead.
+ */
+#define LOG_RING_SIZE       65536
+
+typedef struct
+{
+    int log_id;             /* -1 for padding up to the end of the ring */
+    unsigned int len;       /* of the whole record with the nul, rounded to 8 */
+} log_record_t;
+
+typedef struct log_ring_tag
+{
+    struct log_ring_tag *next;
+    unsigned long head;     /* only changed by the writer */
+    unsigned long tail;     /* only changed by the reader */
+    unsigned long dropped, reported;
+    int dead;               /* writer thread has gone */
+    int stamp_len;
+    time_t stamp_time;
+    char stamp [48];
+    char data [LOG_RING_SIZE];
+} log_ring_t;
+
+static pthread_key_t    log_ring_key;
+static log_ring_t       *log_rings;
+static int              log_wake_pending;
+static int              log_rings_usable;
+#endif
+
+
 typedef struct log_tag
 {
     int in_use;
@@ -64,6 +104,8 @@ typedef struct log_tag
     short archive_timestamp;
     time_t recheck_time;
 
+    int binary;     /* entries are written as is, no line ending */
+
     unsigned long buffer_bytes;
     unsigned int entries;
     unsigned int keep_entries;
@@ -82,6 +124,11 @@ static void _release_log_id(int log_id);
 static void _lock_logger(void);
 static void _unlock_logger(void);
 static int do_log_run (int log_id);
+static void do_purge (int log_id);
+#ifdef LOG_RINGS
+static void log_ring_release (void *arg);
+static int log_rings_drain (void);
+#endif
 
 
 static int _log_open (int id, time_t now)
@@ -174,6 +221,7 @@ static void log_init (log_t *log)
     log->buffer_bytes = 0;
     log->entries = 0;
     log->keep_entries = 5;
+    log->binary = 0;
     log->written_entry = NULL;
     log->log_head = NULL;
     log->log_tail = NULL;
@@ -190,6 +238,11 @@ void log_initialize_lib (mx_create_func mxc, mx_lock_func mxl)
     if (log_mutex_alloc)
         log_mutex_alloc (&_logger_mutex, 1);
     log_callback = NULL;
+#ifdef LOG_RINGS
+    log_rings = NULL;
+    if (log_mutex_lock && pthread_key_create (&log_ring_key, log_ring_release) == 0)
+        log_rings_usable = 1;
+#endif
     _initialized = 1;
 }
 
@@ -330,6 +383,22 @@ void log_set_lines_kept (int log_id, unsigned int count)
 }
 
 
+/* binary logs are for record data built by the caller, nothing is kept back
+ * for log_contents */
+void log_set_binary (int log_id, int binary)
+{
+    if (log_id < 0 || log_id >= LOG_MAXLOGS) return;
+    _lock_logger();
+    if (loglist[log_id].in_use)
+    {
+        loglist[log_id].binary = binary ? 1 : 0;
+        if (binary)
+            loglist[log_id].keep_entries = 1;
+    }
+    _unlock_logger();
+}
+
+
 void log_set_level(int log_id, unsigned level)
 {
     if (log_id < 0 || log_id >= LOG_MAXLOGS) return;
@@ -400,12 +469,12 @@ static void _log_close_internal (int log_id)
         log_entry_t *to_go = loglist [log_id].log_head;
         loglist [log_id].log_head = to_go->next;
         loglist [log_id].buffer_bytes -= to_go->len;
-        free (to_go->line);
         free (to_go);
         loglist [log_id].entries--;
     }
     loglist [log_id].written_entry = NULL;
     loglist [log_id].entries = 0;
+    loglist [log_id].binary = 0;
     loglist [log_id].in_use = 0;
 }
 
@@ -434,6 +503,19 @@ void log_shutdown(void)
     log_commit_entries ();
     for (log_id = 0; log_id < logs_allocated ; log_id++)
         log_close (log_id);
+#ifdef LOG_RINGS
+    if (log_rings_usable)
+    {
+        log_rings_usable = 0;
+        pthread_key_delete (log_ring_key);
+        while (log_rings)
+        {
+            log_ring_t *ring = log_rings;
+            log_rings = ring->next;
+            free (ring);
+        }
+    }
+#endif
     logs_allocated = 0;
     free (loglist);
     /* destroy mutexes */
@@ -502,7 +584,12 @@ static int do_log_run (int log_id)
         _unlock_logger ();
 
         // fprintf (stderr, "in log run, line is %s\n", next->line);
-        if (fprintf (loglist [log_id].logfile, "%s\n", next->line) >= 0)
+        if (loglist [log_id].binary)
+        {
+            if (fwrite (next->line, next->len, 1, loglist [log_id].logfile) == 1)
+                loglist [log_id].size += next->len;
+        }
+        else if (fprintf (loglist [log_id].logfile, "%s\n", next->line) >= 0)
             loglist [log_id].size += (next->len + 1);
 
         _lock_logger ();
@@ -517,10 +604,13 @@ static int do_log_run (int log_id)
 
 void log_commit_entries ()
 {
-    int count = 0, c = 0, log_id;
+    int count = 0, c = 0, log_id, limit = 1000;
 
     //fprintf (stderr, "in log commit\n");
     _lock_logger ();
+#ifdef LOG_RINGS
+    limit += log_rings_drain ();
+#endif
     for (log_id = 0; log_id < logs_allocated ; log_id++)
     {
         do
@@ -528,7 +618,9 @@ void log_commit_entries ()
             if (loglist [log_id].in_use)
                 c = do_log_run (log_id);
             if (c == 0) break;      // skip to next log
-        } while ((count += c) < 1000);
+        } while ((count += c) < limit);
+        if (loglist [log_id].in_use)
+            do_purge (log_id);
     }
     _unlock_logger ();
 }
@@ -556,7 +648,6 @@ static void do_purge (int log_id)
         if (to_go)
         {
             //fprintf (stderr, "  log purge (%d), %s\n", loglist [log_id].entries, to_go->line);
-            free (to_go->line);
             free (to_go);
             continue;
         }
@@ -565,15 +656,18 @@ static void do_purge (int log_id)
 }
 
 
-static int create_log_entry (int log_id, const char *line)
+/* append a line to the log list, assumes lock in use */
+static log_entry_t *log_entry_add (int log_id, const char *line, unsigned int len)
 {
-    log_entry_t *entry;
-    int len;
-
-    entry = calloc (1, sizeof (log_entry_t));
-    len = entry->len = strlen (line);
-    entry->line = malloc (entry->len+1);
-    snprintf (entry->line, entry->len+1, "%s", line);
+    log_entry_t *entry = malloc (sizeof (log_entry_t) + len + 1);
+
+    if (entry == NULL)
+        abort();
+    entry->next = NULL;
+    entry->len = len;
+    entry->line = (char *)(entry + 1);
+    memcpy (entry->line, line, len);
+    entry->line [len] = '\0';
     loglist [log_id].buffer_bytes += entry->len;
 
     if (loglist [log_id].log_tail)
@@ -583,6 +677,13 @@ static int create_log_entry (int log_id, const char *line)
 
     loglist [log_id].log_tail = entry;
     loglist [log_id].entries++;
+    return entry;
+}
+
+
+static int create_log_entry (int log_id, const char *line, unsigned int len)
+{
+    log_entry_add (log_id, line, len);
     if (log_callback)
         log_callback (log_id);
     else
@@ -592,6 +693,138 @@ static int create_log_entry (int log_id, const char *line)
 }
 
 
+#ifdef LOG_RINGS
+static void log_ring_release (void *arg)
+{
+    log_ring_t *ring = arg;
+
+    __atomic_store_n (&ring->dead, 1, __ATOMIC_RELEASE);
+}
+
+
+/* the calling thread's ring, created on first use. NULL if lines are to be
+ * committed directly */
+static log_ring_t *log_ring_get (void)
+{
+    log_ring_t *ring;
+
+    if (log_rings_usable == 0 || log_callback == NULL)
+        return NULL;
+    ring = pthread_getspecific (log_ring_key);
+    if (ring == NULL)
+    {
+        ring = calloc (1, sizeof (log_ring_t));
+        if (ring == NULL)
+            return NULL;
+        _lock_logger ();
+        ring->next = log_rings;
+        log_rings = ring;
+        _unlock_logger ();
+        pthread_setspecific (log_ring_key, ring);
+    }
+    return ring;
+}
+
+
+/* date prefix for log_write, only formatted again when the second changes */
+static int log_ring_stamp (log_ring_t *ring, char *buf, time_t now)
+{
+    if (ring->stamp_time != now)
+    {
+        struct tm thetime;
+
+        ring->stamp_len = strftime (ring->stamp, sizeof (ring->stamp), "[%Y-%m-%d  %H:%M:%S]", localtime_r (&now, &thetime));
+        ring->stamp_time = now;
+    }
+    memcpy (buf, ring->stamp, ring->stamp_len);
+    return ring->stamp_len;
+}
+
+
+/* returns 0 if the line was queued, -1 if the ring is full */
+static int log_ring_push (log_ring_t *ring, int log_id, const char *line, unsigned int len)
+{
+    unsigned long head = ring->head, tail = __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+    unsigned int need = (sizeof (log_record_t) + len + 8) & ~7,
+                 pos = head & (LOG_RING_SIZE-1), pad = 0;
+    log_record_t *rec;
+
+    if (pos + need > LOG_RING_SIZE)
+        pad = LOG_RING_SIZE - pos;
+    if (head + pad + need - tail > LOG_RING_SIZE)
+        return -1;
+    if (pad)
+    {
+        rec = (log_record_t *)(ring->data + pos);
+        rec->log_id = -1;
+        rec->len = pad;
+        head += pad;
+        pos = 0;
+    }
+    rec = (log_record_t *)(ring->data + pos);
+    rec->log_id = log_id;
+    rec->len = need;
+    memcpy (rec + 1, line, len);
+    ((char*)(rec + 1)) [len] = '\0';
+    __atomic_store_n (&ring->head, head + need, __ATOMIC_RELEASE);
+
+    /* only the first line since the last commit needs to wake it */
+    if (__atomic_exchange_n (&log_wake_pending, 1, __ATOMIC_ACQ_REL) == 0)
+        log_callback (log_id);
+    return 0;
+}
+
+
+/* move ring contents to the log lists, freeing rings of exited threads once
+ * empty. assumes lock in use, returns the number of lines moved */
+static int log_rings_drain (void)
+{
+    log_ring_t **trail = &log_rings;
+    int lines = 0;
+
+    __atomic_store_n (&log_wake_pending, 0, __ATOMIC_SEQ_CST);
+    while (*trail)
+    {
+        log_ring_t *ring = *trail;
+        int dead = __atomic_load_n (&ring->dead, __ATOMIC_ACQUIRE);
+        unsigned long head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE),
+                      tail = ring->tail;
+
+        while (tail != head)
+        {
+            log_record_t *rec = (log_record_t *)(ring->data + (tail & (LOG_RING_SIZE-1)));
+            int log_id = rec->log_id;
+
+            if (log_id >= 0 && log_id < LOG_MAXLOGS && loglist [log_id].in_use)
+            {
+                unsigned long dropped = __atomic_load_n (&ring->dropped, __ATOMIC_RELAXED);
+                if (dropped != ring->reported)
+                {
+                    char line [100];
+                    int len = snprintf (line, sizeof line, "%lu log lines dropped, writer too far ahead",
+                            dropped - ring->reported);
+                    log_entry_add (log_id, line, len);
+                    ring->reported = dropped;
+                }
+                log_entry_add (log_id, (char *)(rec + 1), strlen ((char *)(rec + 1)));
+                lines++;
+            }
+            tail += rec->len;
+        }
+        __atomic_store_n (&ring->tail, tail, __ATOMIC_RELEASE);
+        if (dead)
+        {
+            *trail = ring->next;
+            free (ring);
+            continue;
+        }
+        trail = &ring->next;
+    }
+    return lines;
+}
+#endif
+
+
 int log_contents (int log_id, char **_contents, unsigned int *_len)
 {
     int remain;
@@ -610,11 +843,13 @@ int log_contents (int log_id, char **_contents, unsigned int *_len)
             return -1;
         }
         *_len = loglist [log_id].buffer_bytes + loglist [log_id].entries; // add space for newlines
+        if (loglist [log_id].binary)
+            *_len = 0;
         return 1;
     }
     remain = *_len;
 
-    entry = loglist [log_id].log_head;
+    entry = loglist [log_id].binary ? NULL : loglist [log_id].log_head;
     ptr = *_contents;
     *ptr = '\0';
     while (entry && remain)
@@ -638,11 +873,13 @@ void log_write(int log_id, unsigned priority, const char *cat, const char *func,
         const char *fmt, ...)
 {
     static char *prior[] = { "EROR", "WARN", "INFO", "DBUG" };
-    int datelen;
+    int datelen, len;
     time_t now;
-    struct tm thetime;
     char line[LOG_MAXLINELEN];
     va_list ap;
+#ifdef LOG_RINGS
+    log_ring_t *ring;
+#endif
 
     if (log_id < 0 || log_id >= LOG_MAXLOGS) return; /* Bad log number */
     if (loglist[log_id].level < priority) return;
@@ -652,33 +889,83 @@ void log_write(int log_id, unsigned priority, const char *cat, const char *func,
 
     now = time(NULL);
 
-    datelen = strftime (line, sizeof (line), "[%Y-%m-%d  %H:%M:%S]", localtime_r(&now, &thetime));
+#ifdef LOG_RINGS
+    ring = log_ring_get ();
+    if (ring)
+        datelen = log_ring_stamp (ring, line, now);
+    else
+#endif
+    {
+        struct tm thetime;
+        datelen = strftime (line, sizeof (line), "[%Y-%m-%d  %H:%M:%S]", localtime_r(&now, &thetime));
+    }
 
     datelen += snprintf (line+datelen, sizeof line-datelen, " %s %s%s ", prior [priority-1], cat, func);
-    vsnprintf (line+datelen, sizeof line-datelen, fmt, ap);
+    len = vsnprintf (line+datelen, sizeof line-datelen, fmt, ap);
+    va_end(ap);
 
+#ifdef LOG_RINGS
+    if (ring)
+    {
+        len += datelen;
+        if (len < 0 || len >= (int)sizeof line)
+            len = strlen (line);
+        if (log_ring_push (ring, log_id, line, len) < 0)
+            __atomic_fetch_add (&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+#endif
     _lock_logger();
-    create_log_entry (log_id, line);
+    create_log_entry (log_id, line, strlen (line));
     _unlock_logger();
-
-    va_end(ap);
 }
 
 void log_write_direct(int log_id, const char *fmt, ...)
 {
     va_list ap;
     char line[LOG_MAXLINELEN];
+    int len;
+#ifdef LOG_RINGS
+    log_ring_t *ring;
+#endif
 
     if (log_id < 0 || log_id >= LOG_MAXLOGS) return;
     
     va_start(ap, fmt);
+    len = vsnprintf(line, LOG_MAXLINELEN, fmt, ap);
+    va_end(ap);
 
+#ifdef LOG_RINGS
+    ring = log_ring_get ();
+    if (ring)
+    {
+        if (len < 0 || len >= (int)sizeof line)
+            len = strlen (line);
+        if (log_ring_push (ring, log_id, line, len) == 0)
+            return;
+        /* ring full, lines here are not to be lost so commit it directly,
+         * after anything already queued so they stay in order */
+        _lock_logger();
+        log_rings_drain ();
+        create_log_entry (log_id, line, len);
+        _unlock_logger();
+        return;
+    }
+#endif
     _lock_logger();
-    vsnprintf(line, LOG_MAXLINELEN, fmt, ap);
-    create_log_entry (log_id, line);
+    create_log_entry (log_id, line, strlen (line));
     _unlock_logger();
+}
 
-    va_end(ap);
+/* a block of data for a binary log, written out by the commit */
+void log_write_binary (int log_id, const void *data, unsigned int len)
+{
+    if (log_id < 0 || log_id >= LOG_MAXLOGS) return;
+
+    _lock_logger();
+    if (loglist [log_id].in_use && loglist [log_id].binary)
+        create_log_entry (log_id, data, len);
+    _unlock_logger();
 }
 
 static int _get_log_id(void)
@@ -32,6 +32,7 @@ int log_open_file(FILE *file);
 int log_open(const char *filename);
 int log_open_with_buffer(const char *filename, int size);
 void log_set_level(int log_id, unsigned level);
+void log_set_binary (int log_id, int binary);
 void log_set_trigger(int id, unsigned long trigger);
 void log_set_reopen_after (int id, unsigned int trigger);
 int  log_set_filename(int id, const char *filename);
@@ -46,6 +47,7 @@ void log_shutdown(void);
 void log_write(int log_id, unsigned priority, const char *cat, const char *func, 
         const char *fmt, ...)  __attribute__ ((format (gnu_printf, 5, 6)));
 void log_write_direct(int log_id, const char *fmt, ...) __attribute__ ((format (gnu_printf, 2, 3)));
+void log_write_binary (int log_id, const void *data, unsigned int len);
 void log_set_commit_callback (log_commit_callback f);
 void log_commit_entries ();
 
@@ -0,0 +1,308 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* logconv.c
+**
+** icecast-logconv, renders a binary access log as CLF, escaped CLF or JSON
+** lines. The timezone used for CLF dates is the one the tool runs in.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "accesslog.h"
+
+#define OUT_CLF         0
+#define OUT_CLF_ESC     1
+#define OUT_JSON        2
+
+#define CHUNK_MAX       (1<<20)
+
+typedef struct
+{
+    const char *str;
+    unsigned int len;
+} conv_string;
+
+
+static const char *field_names [ACCESSLOG_FIELDS] =
+{
+    "ip", "user", "method", "uri", "protocol", "referrer", "agent"
+};
+
+
+/* as util_url_escape, only alphanumerics are left as they are */
+static void put_escaped (const char *s, unsigned int len, unsigned int max, FILE *out)
+{
+    static const char hexchars[] = "0123456789abcdef";
+    char buf [4096];
+    unsigned int i, j = 0;
+
+    for (i = 0; i < len && j < max && j < sizeof (buf) - 3; i++)
+    {
+        unsigned char c = s[i];
+        if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+            buf [j++] = c;
+        else
+        {
+            buf [j++] = '%';
+            buf [j++] = hexchars [(c >> 4) & 0xf];
+            buf [j++] = hexchars [c & 0xf];
+        }
+    }
+    if (j > max)
+        j = max;
+    fwrite (buf, 1, j, out);
+}
+
+
+static void put_json (const conv_string *s, FILE *out)
+{
+    unsigned int i;
+
+    if (s->str == NULL)
+    {
+        fputs ("null", out);
+        return;
+    }
+    fputc ('"', out);
+    for (i = 0; i < s->len; i++)
+    {
+        unsigned char c = s->str[i];
+        if (c == '"' || c == '\\')
+            fprintf (out, "\\%c", c);
+        else if (c < 0x20)
+            fprintf (out, "\\u%04x", c);
+        else
+            fputc (c, out);
+    }
+    fputc ('"', out);
+}
+
+
+static void output_record (const accesslog_record_t *rec, const conv_string *f, int format, FILE *out)
+{
+    char datebuf [50];
+    time_t t = (time_t)rec->time;
+    struct tm tm;
+
+    if (format == OUT_JSON)
+    {
+        int i;
+
+        fprintf (out, "{\"time\":%" PRId64, rec->time);
+        for (i = 0; i < ACCESSLOG_FIELDS; i++)
+        {
+            fprintf (out, ",\"%s\":", field_names [i]);
+            put_json (&f[i], out);
+        }
+        fprintf (out, ",\"status\":%d,\"bytes\":%" PRIu64 ",\"duration\":%" PRIu32 "}\n",
+                rec->status, rec->sent_bytes, rec->duration);
+        return;
+    }
+    localtime_r (&t, &tm);
+    strftime (datebuf, sizeof (datebuf), "%d/%b/%Y:%H:%M:%S %z", &tm);
+
+    fprintf (out, "%.*s - ", f[ACCESSLOG_IP].str ? (int)f[ACCESSLOG_IP].len : 1,
+            f[ACCESSLOG_IP].str ? f[ACCESSLOG_IP].str : "-");
+    if (f[ACCESSLOG_USER].str)
+        put_escaped (f[ACCESSLOG_USER].str, f[ACCESSLOG_USER].len, 4096, out);
+    else
+        fputc ('-', out);
+
+    if (format == OUT_CLF_ESC)
+    {
+        char req [300];
+        int len = snprintf (req, sizeof req, "%.*s %.*s %.*s",
+                (int)f[ACCESSLOG_METHOD].len, f[ACCESSLOG_METHOD].str ? f[ACCESSLOG_METHOD].str : "",
+                (int)f[ACCESSLOG_URI].len, f[ACCESSLOG_URI].str ? f[ACCESSLOG_URI].str : "",
+                (int)f[ACCESSLOG_PROTOCOL].len, f[ACCESSLOG_PROTOCOL].str ? f[ACCESSLOG_PROTOCOL].str : "");
+
+        fprintf (out, " %s ", datebuf);
+        put_escaped (req, len < (int)sizeof req ? len : (int)sizeof req - 1, 4096, out);
+        fprintf (out, " %d %" PRIu64 " ", rec->status, rec->sent_bytes);
+        if (f[ACCESSLOG_REFERRER].str)
+            put_escaped (f[ACCESSLOG_REFERRER].str, f[ACCESSLOG_REFERRER].len, 150, out);
+        else
+            fputc ('-', out);
+        fputc (' ', out);
+        if (f[ACCESSLOG_AGENT].str)
+            put_escaped (f[ACCESSLOG_AGENT].str, f[ACCESSLOG_AGENT].len, 150, out);
+        else
+            fputc ('-', out);
+        fprintf (out, " %" PRIu32 "\n", rec->duration);
+        return;
+    }
+    fprintf (out, " [%s] \"%.*s %.*s %.*s\" %d %" PRIu64 " \"%.*s\" \"%.*s\" %" PRIu32 "\n",
+            datebuf,
+            (int)f[ACCESSLOG_METHOD].len, f[ACCESSLOG_METHOD].str ? f[ACCESSLOG_METHOD].str : "",
+            (int)f[ACCESSLOG_URI].len, f[ACCESSLOG_URI].str ? f[ACCESSLOG_URI].str : "",
+            (int)f[ACCESSLOG_PROTOCOL].len, f[ACCESSLOG_PROTOCOL].str ? f[ACCESSLOG_PROTOCOL].str : "",
+            rec->status, rec->sent_bytes,
+            f[ACCESSLOG_REFERRER].str ? (int)f[ACCESSLOG_REFERRER].len : 1,
+            f[ACCESSLOG_REFERRER].str ? f[ACCESSLOG_REFERRER].str : "-",
+            f[ACCESSLOG_AGENT].str ? (int)f[ACCESSLOG_AGENT].len : 1,
+            f[ACCESSLOG_AGENT].str ? f[ACCESSLOG_AGENT].str : "-",
+            rec->duration);
+}
+
+
+static int convert_chunk (const accesslog_chunk_t *hdr, const char *data, int format, FILE *out)
+{
+    conv_string *strings = calloc (hdr->strings + 1, sizeof (conv_string));
+    unsigned int pos = sizeof (*hdr), i;
+
+    if (strings == NULL)
+        return -1;
+    for (i = 1; i <= hdr->strings; i++)
+    {
+        uint16_t len;
+
+        if (pos + sizeof (len) > hdr->length)
+            break;
+        memcpy (&len, data + pos, sizeof (len));
+        pos += sizeof (len);
+        if (pos + len > hdr->length)
+            break;
+        strings[i].str = data + pos;
+        strings[i].len = len;
+        pos += len;
+    }
+    pos = (pos + 7) & ~7;
+    if (i <= hdr->strings || pos + hdr->records * sizeof (accesslog_record_t) != hdr->length)
+    {
+        free (strings);
+        return -1;
+    }
+    for (i = 0; i < hdr->records; i++)
+    {
+        accesslog_record_t rec;
+        conv_string f [ACCESSLOG_FIELDS];
+        int j;
+
+        memcpy (&rec, data + pos + i * sizeof (rec), sizeof (rec));
+        for (j = 0; j < ACCESSLOG_FIELDS; j++)
+        {
+            unsigned int id = rec.field [j];
+            if (id > hdr->strings)
+                id = 0;
+            f[j] = strings [id];
+        }
+        output_record (&rec, f, format, out);
+    }
+    free (strings);
+    return 0;
+}
+
+
+static int convert_file (FILE *in, const char *name, int format, FILE *out)
+{
+    char *data = malloc (CHUNK_MAX);
+    accesslog_chunk_t hdr;
+    long offset = 0;
+    int ret = 0;
+
+    if (data == NULL)
+        return -1;
+    while (fread (&hdr, sizeof (hdr), 1, in) == 1)
+    {
+        if (hdr.magic != ACCESSLOG_MAGIC)
+        {
+            if (hdr.magic == 0x4943414c)
+                fprintf (stderr, "%s: written on a host of different byte order\n", name);
+            else
+                fprintf (stderr, "%s: not a binary access log at offset %ld\n", name, offset);
+            ret = -1;
+            break;
+        }
+        if (hdr.version != ACCESSLOG_VERSION || hdr.length < sizeof (hdr) || hdr.length > CHUNK_MAX)
+        {
+            fprintf (stderr, "%s: unsupported chunk at offset %ld\n", name, offset);
+            ret = -1;
+            break;
+        }
+        memcpy (data, &hdr, sizeof (hdr));
+        if (fread (data + sizeof (hdr), hdr.length - sizeof (hdr), 1, in) != 1)
+        {
+            fprintf (stderr, "%s: truncated chunk at offset %ld\n", name, offset);
+            ret = -1;
+            break;
+        }
+        if (convert_chunk (&hdr, data, format, out) < 0)
+        {
+            fprintf (stderr, "%s: corrupt chunk at offset %ld\n", name, offset);
+            ret = -1;
+        }
+        offset += hdr.length;
+    }
+    free (data);
+    return ret;
+}
+
+
+static void usage (const char *prog)
+{
+    fprintf (stderr, "usage: %s [-f clf|clf-esc|json] [file ...]\n"
+            "Render binary access logs, stdin if no files are named\n", prog);
+}
+
+
+int main (int argc, char **argv)
+{
+    int format = OUT_CLF, i = 1, ret = 0;
+
+    if (i + 1 < argc && strcmp (argv[i], "-f") == 0)
+    {
+        const char *f = argv [i+1];
+        if (strcmp (f, "clf") == 0)
+            format = OUT_CLF;
+        else if (strcmp (f, "clf-esc") == 0)
+            format = OUT_CLF_ESC;
+        else if (strcmp (f, "json") == 0)
+            format = OUT_JSON;
+        else
+        {
+            usage (argv[0]);
+            return 2;
+        }
+        i += 2;
+    }
+    if (i < argc && argv[i][0] == '-' && argv[i][1])
+    {
+        usage (argv[0]);
+        return 2;
+    }
+    if (i == argc)
+        return convert_file (stdin, "stdin", format, stdout) < 0 ? 1 : 0;
+    for (; i < argc; i++)
+    {
+        FILE *in = strcmp (argv[i], "-") ? fopen (argv[i], "rb") : stdin;
+        if (in == NULL)
+        {
+            perror (argv[i]);
+            ret = 1;
+            continue;
+        }
+        if (convert_file (in, argv[i], format, stdout) < 0)
+            ret = 1;
+        if (in != stdin)
+            fclose (in);
+    }
+    return ret;
+}
@@ -27,6 +27,7 @@
 
 #include "cfgfile.h"
 #include "logging.h"
+#include "accesslog.h"
 #include "util.h"
 #include "errno.h"
 #include "global.h"
@@ -39,6 +40,219 @@ void fatal_error (const char *perr);
 int errorlog = 0;
 int playlistlog = 0;
 
+
+/* Binary access log records are gathered into a chunk per log on each worker
+ * thread and passed to the log as one block when the chunk fills or has been
+ * held for a couple of seconds. Strings are stored once per chunk.
+ */
+#define ACCESS_CHUNK_RECORDS    256
+#define ACCESS_CHUNK_STRINGS    1024
+#define ACCESS_CHUNK_HASH       2048
+#define ACCESS_CHUNK_STRSPACE   32768
+#define ACCESS_CHUNK_AGE        2
+
+struct access_chunk
+{
+    struct access_chunk *next;
+    int logid;
+    time_t started;
+    unsigned int records, strings, str_used;
+    uint16_t hash [ACCESS_CHUNK_HASH];
+    uint16_t offset [ACCESS_CHUNK_STRINGS];
+    accesslog_record_t rec [ACCESS_CHUNK_RECORDS];
+    char data [sizeof (accesslog_chunk_t) + ACCESS_CHUNK_STRSPACE + 8 +
+        ACCESS_CHUNK_RECORDS * sizeof (accesslog_record_t)];
+};
+
+struct access_chunks
+{
+    struct access_chunk *head;
+};
+
+static pthread_key_t access_chunks_key;
+static int access_chunks_usable;
+
+
+static void access_chunk_flush (struct access_chunk *chunk)
+{
+    accesslog_chunk_t *hdr = (accesslog_chunk_t *)chunk->data;
+    unsigned int used = sizeof (*hdr) + chunk->str_used,
+                 pos = (used + 7) & ~7,
+                 rlen = chunk->records * sizeof (accesslog_record_t);
+
+    if (chunk->records)
+    {
+        memset (chunk->data + used, 0, pos - used);
+        memcpy (chunk->data + pos, chunk->rec, rlen);
+        hdr->magic = ACCESSLOG_MAGIC;
+        hdr->version = ACCESSLOG_VERSION;
+        hdr->strings = chunk->strings;
+        hdr->records = chunk->records;
+        hdr->length = pos + rlen;
+        log_write_binary (chunk->logid, chunk->data, hdr->length);
+    }
+    chunk->records = chunk->strings = chunk->str_used = 0;
+    memset (chunk->hash, 0, sizeof (chunk->hash));
+}
+
+
+/* number of the string in the chunk, adding it if need be. 0 for no
+ * string and -1 if the chunk has no room left */
+static int access_chunk_string (struct access_chunk *chunk, const char *str, unsigned int max)
+{
+    char *area = chunk->data + sizeof (accesslog_chunk_t);
+    unsigned int h = 5381, len, slot;
+    uint16_t slen;
+
+    if (str == NULL || str[0] == '\0')
+        return 0;
+    for (len = 0; len < max && str [len]; len++)
+        h = h * 33 + (unsigned char)str [len];
+    slot = h & (ACCESS_CHUNK_HASH-1);
+    while (chunk->hash [slot])
+    {
+        unsigned int id = chunk->hash [slot];
+        char *p = area + chunk->offset [id-1];
+
+        memcpy (&slen, p, sizeof (slen));
+        if (slen == len && memcmp (p + sizeof (slen), str, len) == 0)
+            return id;
+        slot = (slot + 1) & (ACCESS_CHUNK_HASH-1);
+    }
+    if (chunk->strings == ACCESS_CHUNK_STRINGS || chunk->str_used + sizeof (slen) + len > ACCESS_CHUNK_STRSPACE)
+        return -1;
+    slen = len;
+    memcpy (area + chunk->str_used, &slen, sizeof (slen));
+    memcpy (area + chunk->str_used + sizeof (slen), str, len);
+    chunk->offset [chunk->strings] = chunk->str_used;
+    chunk->str_used += sizeof (slen) + len;
+    chunk->hash [slot] = ++chunk->strings;
+    return chunk->strings;
+}
+
+
+static struct access_chunk *access_chunk_get (struct access_chunks *chunks, int logid, time_t now)
+{
+    struct access_chunk *chunk = chunks ? chunks->head : NULL;
+
+    while (chunk && chunk->logid != logid)
+        chunk = chunk->next;
+    if (chunk == NULL)
+    {
+        chunk = calloc (1, sizeof (*chunk));
+        if (chunk == NULL)
+            abort();
+        chunk->logid = logid;
+        if (chunks)
+        {
+            chunk->next = chunks->head;
+            chunks->head = chunk;
+        }
+    }
+    if (chunk->records == 0)
+        chunk->started = now;
+    return chunk;
+}
+
+
+static void logging_access_binary (access_log *accesslog, client_t *client, const char *req, time_t now)
+{
+    struct access_chunks *chunks = access_chunks_usable ? pthread_getspecific (access_chunks_key) : NULL;
+    struct access_chunk *chunk = access_chunk_get (chunks, accesslog->logid, now);
+    const char *str [ACCESSLOG_FIELDS];
+    unsigned int max [ACCESSLOG_FIELDS] = { 100, 100, 10, 235, 20, 150, 150 };
+    accesslog_record_t *rec;
+    char protocol [20];
+    int i, attempt;
+
+    snprintf (protocol, sizeof protocol, "%.5s/%s",
+            httpp_getvar (client->parser, HTTPP_VAR_PROTOCOL),
+            httpp_getvar (client->parser, HTTPP_VAR_VERSION));
+    str [ACCESSLOG_IP] = accesslog->log_ip ? client->connection.ip : NULL;
+    str [ACCESSLOG_USER] = client->username;
+    str [ACCESSLOG_METHOD] = httpp_getvar (client->parser, HTTPP_VAR_REQ_TYPE);
+    str [ACCESSLOG_URI] = req;
+    str [ACCESSLOG_PROTOCOL] = protocol;
+    str [ACCESSLOG_REFERRER] = httpp_getvar (client->parser, "referer");
+    str [ACCESSLOG_AGENT] = httpp_getvar (client->parser, "user-agent");
+
+    rec = &chunk->rec [chunk->records];
+    for (attempt = 0; attempt < 2; attempt++)
+    {
+        for (i = 0; i < ACCESSLOG_FIELDS; i++)
+        {
+            int id = access_chunk_string (chunk, str [i], max [i]);
+            if (id < 0)
+                break;
+            rec->field [i] = id;
+        }
+        if (i == ACCESSLOG_FIELDS)
+            break;
+        access_chunk_flush (chunk);     // out of string space, start afresh
+        chunk->started = now;
+        rec = &chunk->rec [0];
+    }
+    rec->time = now;
+    rec->sent_bytes = client->connection.sent_bytes;
+    rec->duration = (client->connection.con_time > now) ? 0 : (now - client->connection.con_time);
+    rec->status = client->respcode;
+    chunk->records++;
+
+    if (chunks == NULL)
+    {
+        access_chunk_flush (chunk);
+        free (chunk);
+    }
+    else if (chunk->records == ACCESS_CHUNK_RECORDS)
+        access_chunk_flush (chunk);
+}
+
+
+static void access_chunks_release (void *arg)
+{
+    struct access_chunks *chunks = arg;
+
+    while (chunks->head)
+    {
+        struct access_chunk *chunk = chunks->head;
+        chunks->head = chunk->next;
+        access_chunk_flush (chunk);
+        free (chunk);
+    }
+    free (chunks);
+}
+
+
+/* give the calling thread its own binary access log chunks, which need
+ * logging_access_flush calling periodically */
+void logging_access_buffer_create (void)
+{
+    struct access_chunks *chunks;
+
+    if (access_chunks_usable == 0 || pthread_getspecific (access_chunks_key))
+        return;
+    chunks = calloc (1, sizeof (*chunks));
+    if (chunks)
+        pthread_setspecific (access_chunks_key, chunks);
+}
+
+
+/* pass on any records held by this thread for long enough, or all of them */
+void logging_access_flush (time_t now, int all)
+{
+    struct access_chunks *chunks;
+    struct access_chunk *chunk;
+
+    if (access_chunks_usable == 0 || (chunks = pthread_getspecific (access_chunks_key)) == NULL)
+        return;
+    for (chunk = chunks->head; chunk; chunk = chunk->next)
+    {
+        if (chunk->records && (all || chunk->started + ACCESS_CHUNK_AGE <= now))
+            access_chunk_flush (chunk);
+    }
+}
+
+
 /* 
 ** ADDR IDENT USER DATE REQUEST CODE BYTES REFERER AGENT [TIME]
 **
@@ -67,12 +281,19 @@ void logging_access_id (access_log *accesslog, client_t *client)
 
     now = time(NULL);
 
-    /* build the data */
-    util_get_clf_time (datebuf, sizeof(datebuf), now);
     if (accesslog->qstr)
         req = httpp_getvar (client->parser, HTTPP_VAR_RAWURI);
     if (req == NULL)
         req = httpp_getvar (client->parser, HTTPP_VAR_URI);
+    if (accesslog->type == LOG_ACCESS_BINARY)
+    {
+        logging_access_binary (accesslog, client, req, now);
+        client->respcode = -1;
+        return;
+    }
+
+    /* build the data */
+    util_get_clf_time (datebuf, sizeof(datebuf), now);
     /* build the request */
     snprintf (reqbuf, sizeof(reqbuf), "%.10s %.235s %.5s/%s",
             httpp_getvar (client->parser, HTTPP_VAR_REQ_TYPE), req,
@@ -216,7 +437,8 @@ static int recheck_access_log (ice_config_t *config, struct access_log *access)
     long max_size = (access->size > 10000) ? access->size : config->access_log.size;
     log_set_trigger (access->logid, max_size);
     log_set_reopen_after (access->logid, access->duration);
-    if (access->display > 0)
+    log_set_binary (access->logid, access->type == LOG_ACCESS_BINARY);
+    if (access->display > 0 && access->type != LOG_ACCESS_BINARY)
         log_set_lines_kept (access->logid, access->display);
     int archive = (access->archive == -1) ? config->access_log.archive : access->archive;
     log_set_archive_timestamp (access->logid, archive);
@@ -309,6 +531,8 @@ int restart_logging (ice_config_t *config)
 int init_logging (ice_config_t *config)
 {
     worker_logger_init();
+    if (access_chunks_usable == 0 && pthread_key_create (&access_chunks_key, access_chunks_release) == 0)
+        access_chunks_usable = 1;
 
     if (strcmp (config->error_log.name, "-") == 0)
         config->error_log.logid = log_open_file (stderr);
@@ -87,6 +87,8 @@ extern int errorlog;
 
 void logging_access_id (struct access_log *accesslog, client_t *client);
 void logging_access(client_t *client);
+void logging_access_buffer_create (void);
+void logging_access_flush (time_t now, int all);
 void logging_playlist(const char *mount, const char *metadata, long listeners);
 void logging_preroll (int log_id, const char *intro_name, client_t *client);
 int  restart_logging (ice_config_t *config);
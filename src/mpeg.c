@@ -876,13 +876,11 @@ int mpeg_complete_frames_cb (mpeg_sync *mp, sync_callback_t *cb, refbuf_t *new_b
             offset -= mp->surplus->len;
         else
         {
-            int new_len = mp->surplus->len + new_block->len;
-            unsigned char *p = realloc (mp->surplus->data, new_len);
+            unsigned int len = new_block->len;
 
-            memcpy (p+mp->surplus->len, new_block->data, new_block->len);
-            mp->surplus->data = new_block->data;
-            new_block->data = (void*)p;
-            new_block->len = new_len;
+            refbuf_resize (new_block, mp->surplus->len + len);
+            memmove (new_block->data + mp->surplus->len, new_block->data, len);
+            memcpy (new_block->data, mp->surplus->data, mp->surplus->len);
         }
         refbuf_release (mp->surplus);
         mp->surplus = NULL;
@@ -905,9 +903,7 @@ int mpeg_complete_frames_cb (mpeg_sync *mp, sync_callback_t *cb, refbuf_t *new_b
                 {
                     unsigned old_len = new_block->len;
                     unsigned new_len = old_len - remaining + (mp->sample_count ? mp->sample_count : 5000);
-                    unsigned char *p = realloc (new_block->data, new_len);
-                    new_block->data = (void*)p;
-                    new_block->len = new_len;
+                    refbuf_resize (new_block, new_len);
                     mp->settings &= ~SYNC_CHK_TAG;
                     return old_len;
                 }
@@ -983,9 +979,7 @@ int mpeg_complete_frames_cb (mpeg_sync *mp, sync_callback_t *cb, refbuf_t *new_b
                 if ((new_block->flags & REFBUF_SHARED) == 0 && (mp->settings & SYNC_RESIZE))
                 {
                     unsigned new_len = mp->sample_count ? mp->sample_count : new_block->len + 5000;
-                    unsigned char *p = realloc (new_block->data, new_len);
-                    new_block->data = (void*)p;
-                    new_block->len = new_len;
+                    refbuf_resize (new_block, new_len);
                 }
                 else
                     new_block->len = offset;
@@ -998,10 +992,7 @@ int mpeg_complete_frames_cb (mpeg_sync *mp, sync_callback_t *cb, refbuf_t *new_b
                 if ((mp->settings & SYNC_RESIZE) && mp->sample_count < 2000000)
                 {
                     unsigned new_len = mp->sample_count + (new_block->len - remaining);
-                    unsigned char *p = realloc (new_block->data, new_len);
-
-                    new_block->data = (void*)p;
-                    new_block->len = new_len;
+                    refbuf_resize (new_block, new_len);
                     return remaining;
                 }
             }
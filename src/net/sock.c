@@ -57,6 +57,10 @@
 #ifdef HAVE_NETDB_H
 #include <netdb.h>
 #endif
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#endif
 
 #ifndef EINPROGRESS
 #define EINPROGRESS WSAEINPROGRESS
@@ -730,6 +734,7 @@ struct _server_sockets
 {
     struct addrinfo *res;
     struct addrinfo *next;
+    int reuseport;
 };
 
 
@@ -877,6 +882,20 @@ static int sock_alloc_sockets (struct _server_sockets *s, int port, const char *
 }
 
 
+/* allow several sockets to bind to the same address, the kernel then
+ * spreads incoming connections across them */
+int sock_server_reuseport (sock_server_t _s)
+{
+#ifdef SO_REUSEPORT
+    struct _server_sockets *s = _s;
+    if (s == NULL) return -1;
+    s->reuseport = 1;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
 void sock_free_server_sockets (sock_server_t _s)
 {
     struct _server_sockets *s = _s;
@@ -906,6 +925,10 @@ int sock_get_next_server_socket (sock_server_t _s, sock_t *serversock)
         /* reuse it if we can */
         setsockopt (sock, SOL_SOCKET, SO_REUSEADDR, (void *)&on, sizeof(on));
 #endif
+#ifdef SO_REUSEPORT
+        if (s->reuseport)
+            setsockopt (sock, SOL_SOCKET, SO_REUSEPORT, (void *)&on, sizeof(on));
+#endif
 #ifdef IPV6_V6ONLY
         on = 1;
         setsockopt (sock, IPPROTO_IPV6, IPV6_V6ONLY, (void*)&on, sizeof on);
@@ -1093,6 +1116,11 @@ int sock_get_next_server_socket (sock_server_t _s, sock_t *serversock)
     return 0;
 }
 
+int sock_server_reuseport (sock_server_t _s)
+{
+    return -1;
+}
+
 void sock_free_server_sockets (sock_server_t _s)
 {
     struct _server_sockets *s = _s;
@@ -1144,6 +1172,42 @@ void sock_set_send_buffer (sock_t sock, int win_size)
     setsockopt (sock, SOL_SOCKET, SO_SNDBUF, (char *) &win_size, sizeof(win_size));
 }
 
+/* limit the amount of unsent data in the socket buffer before the socket is
+ * no longer writable. Accepted sockets inherit it from the listening socket */
+int sock_set_notsent_lowat (sock_t sock, int bytes)
+{
+#ifdef TCP_NOTSENT_LOWAT
+    return setsockopt (sock, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (char *) &bytes, sizeof(bytes));
+#else
+    return -1;
+#endif
+}
+
+/* have the kernel spread out what is written to at most rate bytes per
+ * second, 0 removes any limit. Returns -1 if not supported */
+int sock_set_pacing_rate (sock_t sock, unsigned int rate)
+{
+#ifdef SO_MAX_PACING_RATE
+    if (rate == 0)
+        rate = ~0U;
+    return setsockopt (sock, SOL_SOCKET, SO_MAX_PACING_RATE, (char *) &rate, sizeof(rate));
+#else
+    return -1;
+#endif
+}
+
+/* return the number of bytes in the socket buffer not yet sent, or -1 if
+ * that cannot be determined */
+int sock_unsent_bytes (sock_t sock)
+{
+#ifdef SIOCOUTQNSD
+    int bytes = 0;
+    if (ioctl (sock, SIOCOUTQNSD, &bytes) == 0)
+        return bytes;
+#endif
+    return -1;
+}
+
 int sock_listen(sock_t serversock, int backlog)
 {
     if (!sock_valid_socket(serversock))
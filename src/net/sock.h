@@ -101,6 +101,9 @@ ssize_t sock_writev (sock_t sock, WSABUF *iov, size_t count);
 # define sock_listen _mangle(sock_listen)
 # define sock_set_send_buffer _mangle(sock_set_send_buffer)
 # define sock_set_mss _mangle(sock_set_mss)
+# define sock_set_notsent_lowat _mangle(sock_set_notsent_lowat)
+# define sock_unsent_bytes _mangle(sock_unsent_bytes)
+# define sock_set_pacing_rate _mangle(sock_set_pacing_rate)
 # define sock_accept _mangle(sock_accept)
 # define sock_create_pipe_emulation _mangle(sock_create_pipe_emulation)
 #endif
@@ -126,6 +129,9 @@ int sock_set_delay(sock_t sock);
 void sock_set_error(int val);
 int sock_close(sock_t  sock);
 void sock_set_mss (sock_t sock, int mss_size);
+int sock_set_notsent_lowat (sock_t sock, int bytes);
+int sock_unsent_bytes (sock_t sock);
+int sock_set_pacing_rate (sock_t sock, unsigned int rate);
 
 /* Connection related socket functions */
 sock_t sock_connect_wto(const char *hostname, int port, int timeout);
@@ -149,6 +155,7 @@ int sock_read_pending(sock_t sock, unsigned timeout);
 /* server socket functions */
 sock_server_t sock_get_server_sockets (int port, const char *sinterface);
 int sock_get_next_server_socket (sock_server_t, sock_t *socket);
+int sock_server_reuseport (sock_server_t);
 void sock_free_server_sockets (sock_server_t);
 
 sock_t sock_get_server_socket(int port, const char *sinterface);
@@ -0,0 +1,315 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* rate_bench.c
+**
+** Compares the sample ring of rate_calc in util.c with the linked list it
+** replaced, kept here, by timing rate_add_sum from several threads at once
+** on one rate. Built with "make rate-bench", which also runs it.
+**
+** usage: rate_bench [adds per thread]
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "thread/thread.h"
+#include "timing/timing.h"
+
+#include "cfgfile.h"
+#include "util.h"
+#include "global.h"
+
+/* the rest of the server is not used by the rate code, util.c only needs
+ * these to link */
+int errorlog;
+ice_config_t *config_get_config (void) { return NULL; }
+void config_release_config (void) { }
+void global_lock (void) { }
+void global_unlock (void) { }
+
+
+/* the linked list version of rate_calc as it was before the ring */
+struct list_rate_node
+{
+    int64_t index;
+    uint64_t value;
+    struct list_rate_node *next;
+};
+
+struct list_rate
+{
+    int64_t total;
+    uint64_t cycle_till;
+    struct list_rate_node *current;
+    spin_t lock;
+    unsigned int samples;
+    unsigned int ssec;
+    unsigned int blocks;
+};
+
+
+static struct list_rate *list_rate_setup (unsigned int samples, unsigned int ssec)
+{
+    struct list_rate *calc = calloc (1, sizeof (struct list_rate));
+
+    if (calc == NULL || samples < 2 || ssec == 0)
+    {
+        free (calc);
+        return NULL;
+    }
+    thread_spin_create (&calc->lock);
+    calc->samples = samples;
+    calc->ssec = ssec;
+    return calc;
+}
+
+static void list_rate_purge_entries (struct list_rate *calc, uint64_t cutoff)
+{
+    struct list_rate_node *node = calc->current->next, *to_free = NULL;
+    int count = calc->blocks;
+
+    while (count && node->index <= cutoff)
+    {
+        struct list_rate_node *to_go = node;
+        if (node == NULL || node->next == NULL)
+            abort();
+        count--;
+        if (count)
+        {
+            node = node->next;
+            calc->current->next = node;
+            calc->total -= to_go->value;
+        }
+        else
+        {
+             calc->current = NULL;
+             calc->total = 0;
+        }
+        to_go->next = to_free;
+        to_free = to_go;
+    }
+    calc->blocks = count;
+    thread_spin_unlock (&calc->lock);
+    while (to_free)
+    {
+        struct list_rate_node *to_go = to_free;
+        to_free = to_go->next;
+        free (to_go);
+    }
+}
+
+static void list_rate_add_sum (struct list_rate *calc, long value, uint64_t sid, uint64_t *sum)
+{
+    uint64_t cutoff;
+
+    thread_spin_lock (&calc->lock);
+    cutoff = sid - calc->samples;
+    if (calc->cycle_till)
+    {
+        do {
+            if (calc->current)
+            {
+                struct list_rate_node *next = calc->current->next;
+                if (next->index < calc->cycle_till)
+                {
+                    cutoff = next->index + 1;
+                    break;
+                }
+            }
+            calc->cycle_till = 0;
+        } while (0);
+    }
+    if (value == 0 && calc->current && calc->current->value == 0)
+    {
+        calc->current->index = sid; /* update the timestamp if 0 already present */
+        list_rate_purge_entries (calc, cutoff);
+        return;
+    }
+    if (sum)
+        *sum += value;
+    while (1)
+    {
+        struct list_rate_node *next = NULL, *node;
+        int to_insert = 1;
+        if (calc->current)
+        {
+            if (sid == calc->current->index)
+            {
+                if (value)
+                {
+                    calc->current->value += value;
+                    calc->total += value;
+                }
+                thread_spin_unlock (&calc->lock);
+                return;
+            }
+            next = calc->current->next;
+            if (cutoff > next->index)
+                to_insert = 0;
+        }
+        if (to_insert)
+        {
+            thread_spin_unlock (&calc->lock);
+            node = calloc (1, sizeof (*node));
+
+            node->index = sid;
+            thread_spin_lock (&calc->lock);
+            if ((calc->current && calc->current->next != next) ||
+                    (calc->current == NULL && next != NULL))
+            {
+                thread_spin_unlock (&calc->lock);
+                free (node);
+                thread_spin_lock (&calc->lock);
+                continue;
+            }
+            node->next = next ? next : node;
+            if (calc->current)  calc->current->next = node;
+            calc->current = node;
+            calc->blocks++;
+        }
+        else
+        {
+            calc->current = next;
+            calc->total -= next->value;
+            next->index = sid;
+        }
+        calc->current->value = value;
+        break;
+    }
+    calc->total += value;
+    list_rate_purge_entries (calc, cutoff);
+}
+
+static long list_rate_avg (struct list_rate *calc)
+{
+    long total = 0, ssec = 1;
+    float range = 1.0;
+
+    thread_spin_lock (&calc->lock);
+    if (calc->blocks > 1)
+    {
+        range = (float)(calc->current->index - calc->current->next->index);
+        if (range < 1)
+            range = 1;
+        total = calc->total;
+        ssec = calc->ssec;
+    }
+    thread_spin_unlock (&calc->lock);
+    return (long)(total / range * ssec);
+}
+
+static void list_rate_free (struct list_rate *calc)
+{
+    if (calc->current)
+    {
+        struct list_rate_node *node = calc->current->next;
+        calc->current->next = NULL;
+        while (node)
+        {
+            struct list_rate_node *to_go = node;
+            node = node->next;
+            free (to_go);
+        }
+    }
+    thread_spin_destroy (&calc->lock);
+    free (calc);
+}
+
+
+#define BENCH_THREADS_MAX   8
+
+struct bench_thread
+{
+    void *calc;
+    int use_list;
+    long adds;
+};
+
+/* each thread has its own clock, as each worker does, moving on a
+ * millisecond every 16 adds */
+static void *bench_run (void *arg)
+{
+    struct bench_thread *b = arg;
+    uint64_t sum = 0;
+    long i;
+
+    for (i = 0; i < b->adds; i++)
+    {
+        uint64_t t = 1000000 + i/16;
+
+        if (b->use_list)
+            list_rate_add_sum (b->calc, 1400, t, &sum);
+        else
+            rate_add_sum (b->calc, 1400, t, &sum);
+    }
+    return NULL;
+}
+
+static void bench (int use_list, int threads, long adds)
+{
+    struct bench_thread b;
+    thread_type *thr [BENCH_THREADS_MAX];
+    uint64_t start, elapsed;
+    long avg;
+    int i;
+
+    b.use_list = use_list;
+    b.adds = adds;
+    b.calc = use_list ? (void*)list_rate_setup (20000, 1000) : (void*)rate_setup (20000, 1000);
+
+    start = timing_get_time();
+    for (i = 0; i < threads; i++)
+        thr [i] = thread_create ("rate bench", bench_run, &b, THREAD_ATTACHED);
+    for (i = 0; i < threads; i++)
+        thread_join (thr [i]);
+    elapsed = timing_get_time() - start;
+
+    if (use_list)
+    {
+        avg = list_rate_avg (b.calc);
+        list_rate_free (b.calc);
+    }
+    else
+    {
+        avg = rate_avg (b.calc);
+        rate_free (b.calc);
+    }
+    printf ("%-4s %d threads: %6.1f ns per add, average %ld\n", use_list ? "list" : "ring",
+            threads, elapsed * 1e6 / ((double)adds * threads), avg);
+}
+
+
+int main (int argc, char **argv)
+{
+    long adds = argc > 1 ? atol (argv[1]) : 2000000;
+    int threads;
+
+    if (adds <= 0)
+    {
+        fprintf (stderr, "usage: %s [adds per thread]\n", argv[0]);
+        return 2;
+    }
+    thread_initialize();
+    for (threads = 1; threads <= BENCH_THREADS_MAX; threads *= 2)
+    {
+        bench (1, threads, adds);
+        bench (0, threads, adds);
+    }
+    thread_shutdown();
+    return 0;
+}
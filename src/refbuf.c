@@ -29,14 +29,252 @@
 
 #include "logging.h"
 #include "global.h"
+#include "thread/thread.h"
+
+/* Pooled refbufs. Sizes up to 32k are rounded up to a size class, 4 per power
+ * of 2, and the header and data come from one allocation with the data inline
+ * after the header. Released blocks go back on a free list for the class,
+ * worker threads keep their own lists and overflow into a shared locked one.
+ * Other sizes are allocated as before.
+ */
+#define REFBUF_MIN_SHIFT        7
+#define REFBUF_MAX_SHIFT        15
+#define REFBUF_CLASSES          (((REFBUF_MAX_SHIFT-REFBUF_MIN_SHIFT)<<2) + 1)
+#define REFBUF_CACHE_BYTES      (256*1024)
+#define REFBUF_POOL_BYTES       (4*1024*1024)
+#define REFBUF_BATCH            16
+
+#define refbuf_inline(r)        ((char *)((r) + 1))
+
+struct refbuf_cache
+{
+    refbuf_t *free [REFBUF_CLASSES];
+    unsigned int count [REFBUF_CLASSES];
+};
+
+static struct
+{
+    spin_t lock;
+    refbuf_t *free;
+    unsigned int count;
+} refbuf_pool [REFBUF_CLASSES];
+
+static int refbuf_pooling;
+static pthread_key_t refbuf_cache_key;
+
+
+static unsigned int refbuf_class_size (int cls)
+{
+    unsigned int base = 1 << (REFBUF_MIN_SHIFT + (cls >> 2));
+    return base + (cls & 3) * (base >> 2);
+}
+
+
+/* smallest class that can hold size bytes or -1 if too big */
+static int refbuf_size_class (unsigned int size)
+{
+    unsigned int base = 1 << REFBUF_MIN_SHIFT;
+    int cls = 0;
+
+    if (size > (1 << REFBUF_MAX_SHIFT))
+        return -1;
+    if (size <= base)
+        return 0;
+    while (size > (base << 1))
+    {
+        base <<= 1;
+        cls += 4;
+    }
+    return cls + ((size - base) * 4 + base - 1) / base;
+}
+
+
+static unsigned int refbuf_class_limit (int cls, unsigned int bytes)
+{
+    unsigned int limit = bytes / refbuf_class_size (cls);
+    return limit < REFBUF_BATCH ? REFBUF_BATCH : limit;
+}
+
+
+/* move up to count blocks from one free list to another */
+static unsigned int refbuf_move_blocks (refbuf_t **from, refbuf_t **to, unsigned int count)
+{
+    unsigned int moved = 0;
+
+    while (*from && moved < count)
+    {
+        refbuf_t *r = *from;
+        *from = r->next;
+        r->next = *to;
+        *to = r;
+        moved++;
+    }
+    return moved;
+}
+
+
+static void refbuf_pool_drop (refbuf_t *list)
+{
+    while (list)
+    {
+        refbuf_t *r = list;
+        list = r->next;
+        free (r);
+    }
+}
+
+
+static void refbuf_cache_release (void *arg)
+{
+    struct refbuf_cache *cache = arg;
+    int cls;
+
+    for (cls = 0; cls < REFBUF_CLASSES; cls++)
+    {
+        if (cache->free [cls] == NULL)
+            continue;
+        if (refbuf_pooling)
+        {
+            thread_spin_lock (&refbuf_pool [cls].lock);
+            refbuf_pool [cls].count += refbuf_move_blocks (&cache->free [cls], &refbuf_pool [cls].free, cache->count [cls]);
+            thread_spin_unlock (&refbuf_pool [cls].lock);
+        }
+        refbuf_pool_drop (cache->free [cls]);
+    }
+    free (cache);
+}
+
+
+/* give the calling thread its own free lists, returned when the thread exits */
+void refbuf_cache_create (void)
+{
+    struct refbuf_cache *cache;
+
+    if (refbuf_pooling == 0 || pthread_getspecific (refbuf_cache_key))
+        return;
+    cache = calloc (1, sizeof (*cache));
+    if (cache)
+        pthread_setspecific (refbuf_cache_key, cache);
+}
+
+
+static refbuf_t *refbuf_pool_get (int cls)
+{
+    struct refbuf_cache *cache = pthread_getspecific (refbuf_cache_key);
+    refbuf_t *refbuf = NULL;
+
+    if (cache)
+    {
+        if (cache->free [cls] == NULL && refbuf_pool [cls].free)
+        {
+            unsigned int moved;
+
+            thread_spin_lock (&refbuf_pool [cls].lock);
+            moved = refbuf_move_blocks (&refbuf_pool [cls].free, &cache->free [cls], REFBUF_BATCH);
+            refbuf_pool [cls].count -= moved;
+            thread_spin_unlock (&refbuf_pool [cls].lock);
+            cache->count [cls] += moved;
+        }
+        refbuf = cache->free [cls];
+        if (refbuf)
+        {
+            cache->free [cls] = refbuf->next;
+            cache->count [cls]--;
+        }
+    }
+    else if (refbuf_pool [cls].free)
+    {
+        thread_spin_lock (&refbuf_pool [cls].lock);
+        refbuf = refbuf_pool [cls].free;
+        if (refbuf)
+        {
+            refbuf_pool [cls].free = refbuf->next;
+            refbuf_pool [cls].count--;
+        }
+        thread_spin_unlock (&refbuf_pool [cls].lock);
+    }
+    if (refbuf == NULL)
+    {
+        refbuf = malloc (sizeof (refbuf_t) + refbuf_class_size (cls));
+        if (refbuf == NULL)
+            abort();
+    }
+    memset (refbuf, 0, sizeof (refbuf_t));
+    refbuf->data = refbuf_inline (refbuf);
+    refbuf->_pool = cls + 1;
+    return refbuf;
+}
+
+
+static void refbuf_pool_put (refbuf_t *refbuf)
+{
+    int cls = refbuf->_pool - 1;
+    struct refbuf_cache *cache;
+
+    if (refbuf_pooling == 0)
+    {
+        free (refbuf);
+        return;
+    }
+    cache = pthread_getspecific (refbuf_cache_key);
+    if (cache)
+    {
+        unsigned int moved;
+
+        refbuf->next = cache->free [cls];
+        cache->free [cls] = refbuf;
+        if (++cache->count [cls] <= refbuf_class_limit (cls, REFBUF_CACHE_BYTES))
+            return;
+        // too many held by this thread, pass some back
+        thread_spin_lock (&refbuf_pool [cls].lock);
+        moved = refbuf_move_blocks (&cache->free [cls], &refbuf_pool [cls].free, REFBUF_BATCH);
+        refbuf_pool [cls].count += moved;
+        refbuf = NULL;
+        if (refbuf_pool [cls].count > refbuf_class_limit (cls, REFBUF_POOL_BYTES))
+            refbuf_pool [cls].count -= refbuf_move_blocks (&refbuf_pool [cls].free, &refbuf, REFBUF_BATCH);
+        thread_spin_unlock (&refbuf_pool [cls].lock);
+        cache->count [cls] -= moved;
+        refbuf_pool_drop (refbuf);
+        return;
+    }
+    thread_spin_lock (&refbuf_pool [cls].lock);
+    if (refbuf_pool [cls].count < refbuf_class_limit (cls, REFBUF_POOL_BYTES))
+    {
+        refbuf->next = refbuf_pool [cls].free;
+        refbuf_pool [cls].free = refbuf;
+        refbuf_pool [cls].count++;
+        refbuf = NULL;
+    }
+    thread_spin_unlock (&refbuf_pool [cls].lock);
+    free (refbuf);
+}
 
 
 void refbuf_initialize(void)
 {
+    int cls;
+
+    for (cls = 0; cls < REFBUF_CLASSES; cls++)
+        thread_spin_create (&refbuf_pool [cls].lock);
+    if (pthread_key_create (&refbuf_cache_key, refbuf_cache_release) == 0)
+        refbuf_pooling = 1;
 }
 
 void refbuf_shutdown(void)
 {
+    int cls;
+
+    if (refbuf_pooling == 0)
+        return;
+    refbuf_pooling = 0;
+    for (cls = 0; cls < REFBUF_CLASSES; cls++)
+    {
+        thread_spin_lock (&refbuf_pool [cls].lock);
+        refbuf_pool_drop (refbuf_pool [cls].free);
+        refbuf_pool [cls].free = NULL;
+        refbuf_pool [cls].count = 0;
+        thread_spin_unlock (&refbuf_pool [cls].lock);
+    }
 }
 
 #ifdef MY_ALLOC
@@ -66,6 +304,17 @@ refbuf_t *refbuf_new (unsigned int size)
 {
     refbuf_t *refbuf;
 
+    if (size && refbuf_pooling)
+    {
+        int cls = refbuf_size_class (size);
+        if (cls >= 0)
+        {
+            refbuf = refbuf_pool_get (cls);
+            refbuf->len = size;
+            refbuf->_count = 1;
+            return refbuf;
+        }
+    }
     refbuf = (refbuf_t *)calloc(1, sizeof(refbuf_t));
     if (refbuf == NULL)
         abort();
@@ -86,11 +335,71 @@ refbuf_t *refbuf_new (unsigned int size)
 #endif
 
 
+/* change the size of the data held, contents are kept up to the smaller of
+ * the sizes. Use this instead of realloc as the data may be inline */
+void refbuf_resize (refbuf_t *self, unsigned int len)
+{
+    char *p;
+
+    if (self->_pool && self->data == refbuf_inline (self))
+    {
+        if (len <= refbuf_class_size (self->_pool - 1))
+        {
+            self->len = len;
+            return;
+        }
+        p = malloc (len);
+        if (p)
+            memcpy (p, self->data, self->len < len ? self->len : len);
+    }
+    else
+        p = realloc (self->data, len);
+    if (p == NULL)
+        abort();
+    self->data = p;
+    self->len = len;
+}
+
+
+/* The reference count is updated atomically so that a block can be released
+ * by a thread that does not hold the lock protecting where it was found.
+ *
+ * addref is relaxed, the caller already holds a reference so the block cannot
+ * go away and nothing needs ordering against the increment. release uses
+ * release ordering on the decrement so all accesses made through that
+ * reference happen before it, and the thread dropping the last reference
+ * issues an acquire fence before tearing the block down so that it sees the
+ * accesses made by every other holder. A count of 0 going into either call
+ * means the block is already freed or about to be, treated as fatal.
+ */
+#ifdef __GNUC__
+#define refbuf_count_inc(r)     __atomic_fetch_add (&(r)->_count, 1, __ATOMIC_RELAXED)
+#define refbuf_count_dec(r)     __atomic_fetch_sub (&(r)->_count, 1, __ATOMIC_RELEASE)
+#define refbuf_count_fence()    __atomic_thread_fence (__ATOMIC_ACQUIRE)
+#define refbuf_count_get(r)     __atomic_load_n (&(r)->_count, __ATOMIC_RELAXED)
+#else
+#define refbuf_count_inc(r)     ((r)->_count++)
+#define refbuf_count_dec(r)     ((r)->_count--)
+#define refbuf_count_fence()
+#define refbuf_count_get(r)     ((r)->_count)
+#endif
+
+
+unsigned int refbuf_count (refbuf_t *self)
+{
+    return self ? refbuf_count_get (self) : 0;
+}
+
+
 void refbuf_addref(refbuf_t *self)
 {
     if (self == NULL)
         return;
-    self->_count++;
+    if (refbuf_count_inc (self) == 0)
+    {
+        ERROR1 ("reference added to released block %p", self);
+        abort(); // trap
+    }
 }
 
 
@@ -125,7 +434,7 @@ static void refbuf_release_associated (refbuf_t *ref)
     {
         refbuf_t *to_go = ref;
         ref = to_go->next;
-        if (to_go->_count == 1)
+        if (refbuf_count_get (to_go) == 1)
             to_go->next = NULL;
         refbuf_release (to_go);
     }
@@ -133,14 +442,29 @@ static void refbuf_release_associated (refbuf_t *ref)
 
 void refbuf_release(refbuf_t *self)
 {
+    unsigned int count;
+
     if (self == NULL)
         return;
-    self->_count--;
-    if (self->_count == 0)
+    count = refbuf_count_dec (self);
+    if (count == 0)
+    {
+        ERROR1 ("reference count underflow on block %p", self);
+        abort(); // trap
+    }
+    if (count == 1)
     {
+        refbuf_count_fence();
         refbuf_release_associated (self->associated);
         if (self->next)
             DEBUG0 ("next not null");
+        if (self->_pool)
+        {
+            if (self->data != refbuf_inline (self))
+                free (self->data);  // replaced since allocation
+            refbuf_pool_put (self);
+            return;
+        }
         free(self->data);
         free(self);
     }
@@ -23,11 +23,12 @@
 typedef struct _refbuf_tag
 {
     unsigned int flags;
-    unsigned int _count;
+    unsigned int _count;    /* atomic, use refbuf_addref/refbuf_release */
     struct _refbuf_tag *next;
     void *associated;
     char *data;
     unsigned int len;
+    unsigned int _pool;     /* size class + 1 if from the pool, data follows header */
 
 } refbuf_t;
 
@@ -40,8 +41,11 @@ refbuf_t *refbuf_new_s(unsigned int size, const char *file, int line);
 #else
 refbuf_t *refbuf_new(unsigned int size);
 #endif
+void refbuf_cache_create (void);
+void refbuf_resize (refbuf_t *self, unsigned int len);
 void refbuf_addref(refbuf_t *self);
 void refbuf_release(refbuf_t *self);
+unsigned int refbuf_count (refbuf_t *self);
 refbuf_t *refbuf_copy(refbuf_t *orig);
 refbuf_t *refbuf_copy_default (refbuf_t *orig);
 
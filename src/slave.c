@@ -645,6 +645,8 @@ static int _drop_relay (void *a)
     {
         client_t *client = r->source->client;
         client->schedule_ms = 0;
+        if (client->worker)
+            worker_wakeup (client->worker);
     }
     r->flags &= ~RELAY_IN_LIST;
     DEBUG2 ("dropped relay %s (%p)", r->localmount, r);
@@ -1173,7 +1175,7 @@ static void _slave_thread(void)
 
         global_unlock();
 
-        global_add_bitrates (global.out_bitrate, 0L, THREAD_TIME_MS(&current));
+        global_merge_bitrates (global.out_bitrate, THREAD_TIME_MS(&current));
         if (do_reread)
             event_config_read ();
 
@@ -1456,7 +1458,7 @@ static int relay_read (client_t *client)
             return 1;
         if (source_running (source))
         {
-            thread_rwlock_unlock (&source->lock);
+            source_read_unlock (source);
             return 0;
         }
     }
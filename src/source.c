@@ -74,6 +74,8 @@ static int  source_client_shutdown (client_t *client);
 static int  source_client_http_send (client_t *client);
 static int  send_to_listener (client_t *client);
 static int  send_listener (source_t *source, client_t *client);
+static int  listener_fanout (client_t **clients, int count);
+static long send_listener_data (source_t *source, client_t *client, int loop, int *ret);
 static int  wait_for_restart (client_t *client);
 static int  wait_for_other_listeners (client_t *client);
 
@@ -107,7 +109,8 @@ struct _client_functions source_client_halt_ops =
 struct _client_functions listener_client_ops = 
 {
     send_to_listener,
-    client_destroy
+    client_destroy,
+    listener_fanout
 };
 
 struct _client_functions listener_pause_ops = 
@@ -277,8 +280,11 @@ void source_clear_source (source_t *source)
             source->format->detach_queue_block (source, to_go);
         refbuf_release (to_go);
     }
+    while (source->released_count)
+        refbuf_release (source->released [--source->released_count]);
     source->min_queue_point = NULL;
     source->stream_data_tail = NULL;
+    source->qindex_head = source->qindex_count = 0;
 
     source->min_queue_size = 0;
     source->min_queue_offset = 0;
@@ -332,6 +338,7 @@ static int _free_source (void *p)
     free (source->intro_ipcache);
     source->intro_ipcache = NULL;
 
+    free (source->qindex);
     free (source->format);
     free (source->mount);
     free (source);
@@ -463,6 +470,12 @@ static void update_source_stats (source_t *source)
     stats_set_args (source->stats, "total_mbytes_sent",
             "%"PRIu64, source->format->sent_bytes/(1024*1024));
     stats_set_args (source->stats, "queue_size", "%u", source->queue_size);
+    if (source->fanout_batches)
+    {
+        stats_set_args (source->stats, "listeners_per_batch", "%.1f",
+                (double)source->fanout_listeners / source->fanout_batches);
+        source->fanout_batches = source->fanout_listeners = 0;
+    }
     if (source->client->connection.con_time)
     {
         worker_t *worker = source->client->worker;
@@ -520,6 +533,78 @@ static void update_source_stats (source_t *source)
 }
 
 
+/* The queue index mirrors the block list in a ring sorted by stream position
+ * so that burst and sync point lookups do not have to walk the list. Sync
+ * flags can be set after a block is queued (theora) so they are read from
+ * the block rather than recorded here.
+ */
+#define source_qindex_at(s,i)   (&(s)->qindex [((s)->qindex_head + (i)) & ((s)->qindex_size - 1)])
+
+static void source_qindex_add (source_t *source, refbuf_t *r)
+{
+    struct source_qindex *entry;
+    uint64_t pos = 0;
+
+    if (source->qindex_count == source->qindex_size)
+    {
+        unsigned int i, size = source->qindex_size ? source->qindex_size << 1 : 256;
+        struct source_qindex *ring = malloc (size * sizeof (struct source_qindex));
+
+        if (ring == NULL)
+            abort();
+        for (i = 0; i < source->qindex_count; i++)
+            ring [i] = *source_qindex_at (source, i);
+        free (source->qindex);
+        source->qindex = ring;
+        source->qindex_size = size;
+        source->qindex_head = 0;
+    }
+    if (source->qindex_count)
+    {
+        entry = source_qindex_at (source, source->qindex_count - 1);
+        pos = entry->pos + entry->block->len;
+    }
+    entry = source_qindex_at (source, source->qindex_count);
+    entry->block = r;
+    entry->pos = pos;
+    source->qindex_count++;
+}
+
+
+static void source_qindex_drop (source_t *source, refbuf_t *r)
+{
+    if (source->qindex_count == 0 || source_qindex_at (source, 0)->block != r)
+        abort(); // trap
+    source->qindex_head = (source->qindex_head + 1) & (source->qindex_size - 1);
+    source->qindex_count--;
+}
+
+
+/* stream offset of the end of the queue */
+static uint64_t source_qindex_end (source_t *source)
+{
+    struct source_qindex *tail = source_qindex_at (source, source->qindex_count - 1);
+    return tail->pos + tail->block->len;
+}
+
+
+/* index of the last block starting at or before pos */
+static unsigned int source_qindex_find (source_t *source, uint64_t pos)
+{
+    unsigned int lo = 0, hi = source->qindex_count - 1;
+
+    while (lo < hi)
+    {
+        unsigned int mid = (lo + hi + 1) >> 1;
+        if (source_qindex_at (source, mid)->pos <= pos)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+
 void source_add_queue_buffer (source_t *source, refbuf_t *r)
 {
     source->bytes_read_since_update += r->len;
@@ -543,6 +628,7 @@ void source_add_queue_buffer (source_t *source, refbuf_t *r)
     }
     if (source->stream_data_tail)
         source->stream_data_tail->next = r;
+    source_qindex_add (source, r);
     source->buffer_count++;
 
     source->stream_data_tail = r;
@@ -608,7 +694,7 @@ int source_read (source_t *source)
             source->flags &= ~SOURCE_LISTENERS_SYNC;
         }
         rate_add (source->out_bitrate, 0, client->worker->time_ms);
-        global_add_bitrates (global.out_bitrate, 0, client->worker->time_ms);
+        global_add_bitrates (client->worker, 0, client->worker->time_ms);
 
         if (source->prev_listeners != source->listeners)
         {
@@ -685,26 +771,26 @@ int source_read (source_t *source)
 
         if (source->queue_size != prev_qsize)
         {
-            uint64_t sync_off = source->min_queue_offset, off = sync_off;
-            refbuf_t *sync_point = source->min_queue_point, *ref = sync_point;
-            while (off > source->min_queue_size)
+            if (source->min_queue_offset > source->min_queue_size && source->qindex_count > 1)
             {
-                refbuf_t *to_release = ref;
-                if (to_release && to_release->next)
+                // latest sync block (not the tail) with more than min_queue_size after it
+                uint64_t end = source_qindex_end (source);
+                int first = source_qindex_find (source, end - source->min_queue_offset);
+                int i = source_qindex_find (source, end - source->min_queue_size - 1);
+
+                if (i > (int)source->qindex_count - 2)
+                    i = source->qindex_count - 2;
+                for (; i >= first; i--)
                 {
-                    if (to_release->flags & SOURCE_BLOCK_SYNC)
+                    struct source_qindex *entry = source_qindex_at (source, i);
+                    if (entry->block->flags & SOURCE_BLOCK_SYNC)
                     {
-                        sync_off = off;
-                        sync_point = ref;
+                        source->min_queue_offset = end - entry->pos;
+                        source->min_queue_point = entry->block;
+                        break;
                     }
-                    off -= to_release->len;
-                    ref = to_release->next;
-                    continue;
                 }
-                break;
             }
-            source->min_queue_offset = sync_off;
-            source->min_queue_point = sync_point;
             source->skip_duration = (long)(source->skip_duration * 0.9);
         }
 
@@ -735,10 +821,14 @@ int source_read (source_t *source)
                 source->min_queue_offset -= to_go->len;
                 source->min_queue_point = to_go->next;
             }
-            to_go->next = NULL;
+            source_qindex_drop (source, to_go);
             if (source->format->detach_queue_block)
                 source->format->detach_queue_block (source, to_go);
-            refbuf_release (to_go);
+            to_go->next = NULL;
+            if (source->released_count < SOURCE_RELEASED_MAX)
+                source->released [source->released_count++] = to_go; // free after the lock is dropped
+            else
+                refbuf_release (to_go);
             loop--;
         }
     } while (0);
@@ -749,9 +839,25 @@ int source_read (source_t *source)
 }
 
 
+/* drop the source lock held for source_read, then release the blocks trimmed
+ * from the queue. They are unlinked so listeners cannot reach them */
+void source_read_unlock (source_t *source)
+{
+    refbuf_t *released [SOURCE_RELEASED_MAX];
+    unsigned int i, count = source->released_count;
+
+    memcpy (released, source->released, count * sizeof (refbuf_t *));
+    source->released_count = 0;
+    thread_rwlock_unlock (&source->lock);
+    for (i = 0; i < count; i++)
+        refbuf_release (released [i]);
+}
+
+
 void source_listeners_wakeup (source_t *source)
 {
     client_t *s = source->client;
+    worker_t *last = NULL;
     avl_node *node = avl_get_first (source->clients);
     while (node)
     {
@@ -759,6 +865,11 @@ void source_listeners_wakeup (source_t *source)
         if (s->schedule_ms + 100 < client->schedule_ms)
             DEBUG2 ("listener on %s was ahead by %ld", source->mount, (long)(client->schedule_ms - s->schedule_ms));
         client->schedule_ms = 0;
+        if (client->worker && client->worker != last)
+        {
+            last = client->worker;
+            worker_wakeup (last);
+        }
         node = avl_get_next (node);
     }
 }
@@ -798,7 +909,7 @@ static int source_client_read (client_t *client)
             return 1;
         if (source_running (source))
         {
-            thread_rwlock_unlock (&source->lock);
+            source_read_unlock (source);
             return 0;
         }
     }
@@ -866,10 +977,10 @@ static int source_client_read (client_t *client)
 }
 
 
-void source_add_bytes_sent (struct rate_calc *out_bitrate, unsigned long written, uint64_t milli, uint64_t *sent_bytes)
+void source_add_bytes_sent (struct rate_calc *out_bitrate, unsigned long written, worker_t *worker, uint64_t *sent_bytes)
 {
-    rate_add_sum (out_bitrate, written, milli, sent_bytes);
-    global_add_bitrates (global.out_bitrate, written, milli);
+    rate_add_sum (out_bitrate, written, worker->time_ms, sent_bytes);
+    global_add_bitrates (worker, written, worker->time_ms);
 }
 
 
@@ -963,7 +1074,7 @@ static int source_queue_advance (client_t *client)
         break;
     }
     if (written)
-        source_add_bytes_sent (source->out_bitrate, written, client->worker->time_ms, &source->format->sent_bytes);
+        source_add_bytes_sent (source->out_bitrate, written, client->worker, &source->format->sent_bytes);
     return -1;
 }
 
@@ -971,6 +1082,8 @@ static int source_queue_advance (client_t *client)
 static int locate_start_on_queue (source_t *source, client_t *client)
 {
     refbuf_t *refbuf;
+    unsigned int i;
+    uint64_t end;
     long lag = 0;
 
     /* we only want to attempt a burst at connection time, not midstream
@@ -979,6 +1092,8 @@ static int locate_start_on_queue (source_t *source, client_t *client)
     if (client->connection.error || source->stream_data_tail == NULL)
         return -1;
     refbuf = source->stream_data_tail;
+    end = source_qindex_end (source);
+    i = source->qindex_count - 1;
     if (client->connection.sent_bytes > source->min_queue_offset && (refbuf->flags & SOURCE_BLOCK_SYNC))
     {
         lag = refbuf->len;
@@ -1007,16 +1122,19 @@ static int locate_start_on_queue (source_t *source, client_t *client)
 
         if (v > client->connection.sent_bytes)
         {
+            uint64_t pos = end - source->min_queue_offset;
+
             v -= client->connection.sent_bytes; /* have we sent data already */
-            refbuf = source->min_queue_point;
-            lag = source->min_queue_offset;
-            // DEBUG3 ("size %lld, v %lld, lag %ld", size, v, lag);
-            while (size > v && refbuf && refbuf->next)
+            i = source_qindex_find (source, pos);
+            if (size > v)
             {
-                size -= refbuf->len;
-                lag -= refbuf->len;
-                refbuf = refbuf->next;
+                // first block at least size-v past the burst point, tail at most
+                pos += size - v;
+                i = source_qindex_find (source, pos);
+                if (source_qindex_at (source, i)->pos < pos && i < source->qindex_count - 1)
+                    i++;
             }
+            lag = (long)(end - source_qindex_at (source, i)->pos);
             if (lag < 0)
                 ERROR1 ("Odd, lag is negative %ld", lag);
         }
@@ -1024,8 +1142,12 @@ static int locate_start_on_queue (source_t *source, client_t *client)
             lag = refbuf->len;
     }
 
-    while (refbuf)
+    for (; i < source->qindex_count; i++)
     {
+        struct source_qindex *entry = source_qindex_at (source, i);
+
+        refbuf = entry->block;
+        lag = (long)(end - entry->pos);
         if (refbuf->flags & SOURCE_BLOCK_SYNC)
         {
             client_set_queue (client, NULL);
@@ -1038,8 +1160,6 @@ static int locate_start_on_queue (source_t *source, client_t *client)
             DEBUG4 ("%s Joining queue on %s (%"PRIu64 ", %"PRIu64 ")", &client->connection.ip[0], source->mount, source->client->queue_pos, client->queue_pos);
             return 0;
         }
-        lag -= refbuf->len;
-        refbuf = refbuf->next;
     }
     client->schedule_ms += 150;
     return -1;
@@ -1295,6 +1415,94 @@ static int wait_for_other_listeners (client_t *client)
 }
 
 
+/* while the queue is to be shrunk, note how far back this listener is */
+static void listener_shrink_check (source_t *source, client_t *client)
+{
+    int lag;
+
+    if (source->shrink_time == 0)
+        return;
+    lag = source->client->queue_pos - client->queue_pos;
+    if (lag > source->queue_size_limit)
+        lag = source->queue_size_limit; // impose a higher lag value
+    thread_spin_lock (&source->shrink_lock);
+    if (client->queue_pos < source->shrink_pos)
+        source->shrink_pos = source->client->queue_pos - lag;
+    thread_spin_unlock (&source->shrink_lock);
+}
+
+
+/* Listeners sitting at the end of the queue are woken together when a block
+ * arrives. Those at the same point on the same worker are sent to here in
+ * one pass under a single lock, skipping the per listener checks that do
+ * not apply to them. Those sent to are rescheduled here, even on a short
+ * write. Anything out of the ordinary is left to send_to_listener, as are
+ * those that failed so they can be dropped.
+ */
+static int listener_fanout (client_t **clients, int count)
+{
+    source_t *source = clients[0]->shared_data;
+    worker_t *worker = clients[0]->worker;
+    long total_written = 0;
+    uint64_t queue_pos = 0;
+    int i, handled = 0, throttle;
+
+    if (source == NULL || thread_rwlock_tryrlock (&source->lock) != 0)
+        return 0;
+    if (source_running (source) == 0 || global.max_rate || source->fallback.mount ||
+            (source->flags & (SOURCE_LISTENERS_SYNC|SOURCE_TERMINATING)))
+    {
+        thread_rwlock_unlock (&source->lock);
+        return 0;
+    }
+    throttle = source->incoming_adj > 25 ? 25 : (source->incoming_adj > 0 ? source->incoming_adj : 1);
+    for (i = 0; i < count; i++)
+    {
+        client_t *client = clients [i];
+        long written;
+        int ret = 0;
+
+        if (client->shared_data != source || client->ops != &listener_client_ops ||
+                client->check_buffer != source_queue_advance || client->refbuf == NULL ||
+                (client->flags & (CLIENT_ACTIVE|CLIENT_RANGE_END)) != CLIENT_ACTIVE ||
+                client->connection.error || client->connection.discon.time)
+            continue;
+        if (handled == 0)
+            queue_pos = client->queue_pos;
+        else if (client->queue_pos != queue_pos)
+            continue;
+        client->schedule_ms = worker->time_ms;
+        client->throttle = throttle;
+        client->connection.wouldblock = 0;
+        written = send_listener_data (source, client, 40, &ret);
+        total_written += written;
+        if (ret < 0 || client->connection.error)
+            continue;   // send_listener drops it
+        listener_shrink_check (source, client);
+        clients [i] = clients [handled];
+        clients [handled] = client;
+        handled++;
+    }
+    if (total_written)
+    {
+        rate_add_sum (source->out_bitrate, total_written, worker->time_ms, &source->format->sent_bytes);
+        global_add_bitrates (worker, total_written, worker->time_ms);
+    }
+    if (handled)
+    {
+#ifdef __GNUC__
+        __sync_fetch_and_add (&source->fanout_batches, 1);
+        __sync_fetch_and_add (&source->fanout_listeners, handled);
+#else
+        source->fanout_batches++;
+        source->fanout_listeners += handled;
+#endif
+    }
+    thread_rwlock_unlock (&source->lock);
+    return handled;
+}
+
+
 /* general send routine per listener.
  */
 static int send_to_listener (client_t *client)
@@ -1380,17 +1588,75 @@ int listener_waiting_on_source (source_t *source, client_t *client)
 }
 
 
+/* A listener with a full socket buffer is retried once the kernel has
+ * had time to pass on about half of what is still unsent, assuming the
+ * listener takes it at no less than the stream rate.
+ */
+static int listener_backlog_delay (source_t *source, client_t *client)
+{
+    long rate = source->incoming_rate;
+    int unsent = sock_unsent_bytes (client->connection.sock), delay;
+
+    if (unsent < 0 || rate <= 0)
+        return 15;
+    delay = (int)((unsent * 500L) / rate);
+    if (delay < 15)
+        return 15;
+    return delay > 500 ? 500 : delay;
+}
+
+
+/* write queued data to the listener, returns the amount written */
+static long send_listener_data (source_t *source, client_t *client, int loop, int *ret)
+{
+    long total_written = 0, limiter = source->listener_send_trigger;
+
+    while (1)
+    {
+        int bytes;
+
+        /* lets not send too much to one client in one go, but don't
+           sleep for too long if more data can be sent */
+        if (loop == 0 || total_written > limiter)
+        {
+            client->schedule_ms += 25;
+            break;
+        }
+        bytes = client->check_buffer (client);
+        if (bytes < 0)
+        {
+            if (client->connection.error || (total_written == 0 && connection_unreadable (&client->connection)))
+            {
+                *ret = -1;
+                break;
+            }
+            /* caught up or a short write, only the latter has data unsent */
+            if (client->connection.wouldblock)
+                client->schedule_ms += listener_backlog_delay (source, client);
+            else
+                client->schedule_ms += 15;
+            break;  /* can't write any more */
+        }
+
+        total_written += bytes;
+        loop--;
+    }
+    return total_written;
+}
+
+
 static int send_listener (source_t *source, client_t *client)
 {
-    int bytes;
     int loop = 40;   /* max number of iterations in one go */
-    long total_written = 0, limiter = source->listener_send_trigger;
+    long total_written = 0;
     int ret = 0, lag;
     worker_t *worker = client->worker;
     time_t now = worker->current_time.tv_sec;
 
     client->schedule_ms = worker->time_ms;
 
+    if (client->connection.error)
+        return -1;  // eg failed in listener_fanout, no need to write again
     if (source->flags & SOURCE_LISTENERS_SYNC)
         return listener_waiting_on_source (source, client);
 
@@ -1441,46 +1707,15 @@ static int send_listener (source_t *source, client_t *client)
     }
     // set between 1 and 25
     client->throttle = source->incoming_adj > 25 ? 25 : (source->incoming_adj > 0 ? source->incoming_adj : 1);
-    while (1)
-    {
-        /* lets not send too much to one client in one go, but don't
-           sleep for too long if more data can be sent */
-        if (loop == 0 || total_written > limiter)
-        {
-            client->schedule_ms += 25;
-            break;
-        }
-        bytes = client->check_buffer (client);
-        if (bytes < 0)
-        {
-            if (client->connection.error || (total_written == 0 && connection_unreadable (&client->connection)))
-            {
-                ret = -1;
-                break;
-            }
-            client->schedule_ms += 15;
-            break;  /* can't write any more */
-        }
-
-        total_written += bytes;
-        loop--;
-    }
+    total_written = send_listener_data (source, client, loop, &ret);
     if (total_written)
     {
         rate_add_sum (source->out_bitrate, total_written, worker->time_ms, &source->format->sent_bytes);
-        global_add_bitrates (global.out_bitrate, total_written, worker->time_ms);
+        global_add_bitrates (worker, total_written, worker->time_ms);
     }
 
-    if (source->shrink_time && client->connection.error == 0)
-    {
-        lag = source->client->queue_pos - client->queue_pos;
-        if (lag > source->queue_size_limit)
-            lag = source->queue_size_limit; // impose a higher lag value
-        thread_spin_lock (&source->shrink_lock);
-        if (client->queue_pos < source->shrink_pos)
-            source->shrink_pos = source->client->queue_pos - lag;
-        thread_spin_unlock (&source->shrink_lock);
-    }
+    if (client->connection.error == 0)
+        listener_shrink_check (source, client);
     return ret;
 }
 
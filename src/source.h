@@ -21,6 +21,16 @@
 
 #include <stdio.h>
 
+/* entry in the position index over the queued blocks */
+struct source_qindex
+{
+    refbuf_t *block;
+    uint64_t pos;       /* offset of the start of the block within the stream */
+};
+
+/* most blocks held for release after the source lock is dropped */
+#define SOURCE_RELEASED_MAX         64
+
 typedef struct source_tag
 {
     char *mount;
@@ -93,6 +103,16 @@ typedef struct source_tag
 
     refbuf_t *stream_data;
     refbuf_t *stream_data_tail;
+    refbuf_t *released [SOURCE_RELEASED_MAX];  /* trimmed from the queue, released once the lock is dropped */
+    unsigned int released_count;
+    unsigned long fanout_batches;   /* listener batches and listeners in them since stats update */
+    unsigned long fanout_listeners;
+
+    /* ring of queued blocks, oldest first, for position lookups */
+    struct source_qindex *qindex;
+    unsigned int qindex_size;
+    unsigned int qindex_head;
+    unsigned int qindex_count;
 
     util_dict *audio_info;
 
@@ -126,6 +146,7 @@ void source_main(source_t *source);
 void source_recheck_mounts (int update_all);
 int  source_add_listener (const char *mount, mount_proxy *mountinfo, client_t *client);
 int  source_read (source_t *source);
+void source_read_unlock (source_t *source);
 void source_setup_listener (source_t *source, client_t *client);
 void source_init (source_t *source);
 void source_shutdown (source_t *source, int with_fallback);
@@ -207,7 +207,11 @@ void stats_clients_wakeup (void)
     {
         client_t *client = listener->client;
         if (client)
+        {
             client->schedule_ms = 0;
+            if (client->worker)
+                worker_wakeup (client->worker);
+        }
         listener = listener->next;
     }
     thread_mutex_unlock (&_stats.listeners_lock);
@@ -756,7 +760,7 @@ static void clear_stats_queue (client_t *client)
     {
         refbuf_t *to_go = refbuf;
         refbuf = to_go->next;
-        if (to_go->_count != 1) DEBUG1 ("odd count for stats %d", to_go->_count);
+        if (refbuf_count (to_go) != 1) DEBUG1 ("odd count for stats %u", refbuf_count (to_go));
         to_go->next = NULL;
         refbuf_release (to_go);
     }
@@ -53,22 +53,28 @@
 
 #include "logging.h"
 
-struct rate_calc_node
-{
-    int64_t index;
-    uint64_t value;
-    struct rate_calc_node *next;
-};
+/* samples are kept in a fixed ring of buckets, each covering width units
+ * of the time passed in (ms or seconds depending on the caller), enough
+ * buckets to cover the samples range plus the one currently filling.
+ */
+#define RATE_BUCKETS_PER_SSEC   10
 
 struct rate_calc
 {
     int64_t total;
-    uint64_t cycle_till;
-    struct rate_calc_node *current;
+    uint64_t latest;        /* most recent time passed in */
+    uint64_t bucket;        /* bucket latest is in */
+    uint64_t first;         /* earliest bucket to count */
+    uint64_t cycle_till;    /* drop faster until first reaches here */
+    uint64_t bucket_start;  /* first time in the latest bucket */
+    unsigned int current;   /* slot of the latest bucket */
     spin_t lock;
     unsigned int samples;
     unsigned int ssec;
-    unsigned int blocks;
+    unsigned int width;
+    unsigned int count;
+    int started;
+    int64_t *slots;
 };
 
 
@@ -749,142 +755,135 @@ char *util_conv_string (const char *string, const char *in_charset, const char *
  */
 struct rate_calc *rate_setup (unsigned int samples, unsigned int ssec)
 {
-    struct rate_calc *calc = calloc (1, sizeof (struct rate_calc));
+    struct rate_calc *calc;
+    unsigned int width, count;
 
-    if (calc == NULL || samples < 2 || ssec == 0)
-    {
-        free (calc);
+    if (samples < 2 || ssec == 0)
+        return NULL;
+    width = ssec / RATE_BUCKETS_PER_SSEC;
+    if (width == 0)
+        width = 1;
+    count = (samples + width - 1) / width + 1;
+    calc = calloc (1, sizeof (struct rate_calc) + count * sizeof (int64_t));
+    if (calc == NULL)
         return NULL;
-    }
     thread_spin_create (&calc->lock);
     calc->samples = samples;
     calc->ssec = ssec;
+    calc->width = width;
+    calc->count = count;
+    calc->slots = (int64_t *)(calc + 1);
     return calc;
 }
 
-static void rate_purge_entries (struct rate_calc *calc, uint64_t cutoff)
+
+static uint64_t rate_oldest (struct rate_calc *calc)
+{
+    uint64_t low = 0;
+
+    if (calc->bucket >= calc->count)
+        low = calc->bucket - calc->count + 1;
+    return low > calc->first ? low : calc->first;
+}
+
+
+/* drop the buckets before the one specified, never past the latest */
+static void rate_drop_to (struct rate_calc *calc, uint64_t bucket)
 {
-    struct rate_calc_node *node = calc->current->next, *to_free = NULL;
-    int count = calc->blocks;
+    uint64_t b = rate_oldest (calc);
 
-    while (count && node->index <= cutoff)
+    if (bucket > calc->bucket)
+        bucket = calc->bucket;
+    for (; b < bucket; b++)
     {
-        struct rate_calc_node *to_go = node;
-        if (node == NULL || node->next == NULL)
-            abort();
-        count--;
-        if (count)
-        {
-            node = node->next;
-            calc->current->next = node;
-            calc->total -= to_go->value;
-        }
-        else
+        int64_t *slot = &calc->slots [b % calc->count];
+        calc->total -= *slot;
+        *slot = 0;
+    }
+    if (bucket > calc->first)
+        calc->first = bucket;
+}
+
+
+/* move the latest bucket on, clearing those that have slipped out of range */
+static void rate_advance (struct rate_calc *calc, uint64_t bucket)
+{
+    uint64_t steps = bucket - calc->bucket;
+
+    if (steps >= calc->count)
+    {
+        memset (calc->slots, 0, calc->count * sizeof (int64_t));
+        calc->total = 0;
+    }
+    else
+    {
+        uint64_t b;
+        for (b = calc->bucket + 1; b <= bucket; b++)
         {
-             calc->current = NULL;
-             calc->total = 0;
+            int64_t *slot = &calc->slots [b % calc->count];
+            calc->total -= *slot;
+            *slot = 0;
         }
-        to_go->next = to_free;
-        to_free = to_go;
     }
-    calc->blocks = count;
-    thread_spin_unlock (&calc->lock);
-    while (to_free)
+    calc->bucket = bucket;
+    if (calc->cycle_till)
     {
-        struct rate_calc_node *to_go = to_free;
-        to_free = to_go->next;
-        free (to_go);
+        /* after a reduce, lose one extra old bucket for each new one */
+        uint64_t to = rate_oldest (calc) + steps;
+        if (to >= calc->cycle_till)
+        {
+            to = calc->cycle_till;
+            calc->cycle_till = 0;
+        }
+        rate_drop_to (calc, to);
     }
 }
 
+
 /* add a value to sampled data, t is used to determine which sample
  * block the sample goes into.
  */
 void rate_add_sum (struct rate_calc *calc, long value, uint64_t sid, uint64_t *sum)
 {
-    uint64_t cutoff;
+    unsigned int slot;
 
     thread_spin_lock (&calc->lock);
-    cutoff = sid - calc->samples;
-    if (calc->cycle_till)
-    {
-        do {
-            if (calc->current)
-            {
-                struct rate_calc_node *next = calc->current->next;
-                if (next->index < calc->cycle_till)
-                {
-                    cutoff = next->index + 1;
-                    break;
-                }
-            }
-            calc->cycle_till = 0;
-        } while (0);
-    }
-    if (value == 0 && calc->current && calc->current->value == 0)
-    {
-        calc->current->index = sid; /* update the timestamp if 0 already present */
-        rate_purge_entries (calc, cutoff);
-        return;
-    }
-    if (sum)
-        *sum += value;
-    while (1)
+    slot = calc->current;
+    if (calc->started == 0 || sid - calc->bucket_start >= calc->width)
     {
-        struct rate_calc_node *next = NULL, *node;
-        int to_insert = 1;
-        if (calc->current)
-        {
-            if (sid == calc->current->index)
-            {
-                if (value)
-                {
-                    calc->current->value += value;
-                    calc->total += value;
-                }
-                thread_spin_unlock (&calc->lock);
-                return;
-            }
-            next = calc->current->next;
-            if (cutoff > next->index)
-                to_insert = 0;
-        }
-        if (to_insert)
-        {
-            thread_spin_unlock (&calc->lock);
-            node = calloc (1, sizeof (*node));
+        uint64_t bucket = sid / calc->width;
 
-            node->index = sid;
-            thread_spin_lock (&calc->lock);
-            if ((calc->current && calc->current->next != next) ||
-                    (calc->current == NULL && next != NULL))
-            {
-                thread_spin_unlock (&calc->lock);
-                free (node);
-                thread_spin_lock (&calc->lock);
-                continue;
-            }
-            node->next = next ? next : node;
-            if (calc->current)  calc->current->next = node;
-            calc->current = node;
-            calc->blocks++;
+        if (calc->started == 0)
+        {
+            calc->started = 1;
+            calc->bucket = calc->first = bucket;
+            calc->bucket_start = bucket * calc->width;
+            slot = calc->current = bucket % calc->count;
         }
-        else
+        if (bucket > calc->bucket)
         {
-            calc->current = next;
-            calc->total -= next->value;
-            next->index = sid;
+            rate_advance (calc, bucket);
+            calc->bucket_start = bucket * calc->width;
+            slot = calc->current = bucket % calc->count;
         }
-        calc->current->value = value;
-        break;
+        else if (bucket < calc->bucket && bucket >= rate_oldest (calc))
+            slot = bucket % calc->count;    /* late but still in range */
+    }
+    if (sid > calc->latest)
+        calc->latest = sid;
+    if (value)
+    {
+        calc->slots [slot] += value;
+        calc->total += value;
+        if (sum)
+            *sum += value;
     }
-    calc->total += value;
-    rate_purge_entries (calc, cutoff);
+    thread_spin_unlock (&calc->lock);
 }
 
 
-/* return the average sample value over all the blocks except the 
- * current one, as that may be incomplete. t to reduce the duration
+/* return the average sample value over the range of buckets held, up to
+ * the latest time. t to reduce the duration
  */
 long rate_avg_shorten (struct rate_calc *calc, unsigned int t)
 {
@@ -894,9 +893,9 @@ long rate_avg_shorten (struct rate_calc *calc, unsigned int t)
     if (calc == NULL)
         return total;
     thread_spin_lock (&calc->lock);
-    if (calc && calc->blocks > 1)
+    if (calc->started && calc->bucket > rate_oldest (calc))
     {
-        range = (float)(calc->current->index - calc->current->next->index);
+        range = (float)(calc->latest - rate_oldest (calc) * calc->width);
         if (range < 1)
             range = 1;
         total = calc->total;
@@ -918,13 +917,13 @@ void rate_reduce (struct rate_calc *calc, unsigned int range)
     if (calc == NULL)
         return;
     thread_spin_lock (&calc->lock);
-    if (range && calc->blocks > 1)
+    if (range && calc->started && calc->bucket > rate_oldest (calc))
     {
-        calc->cycle_till = calc->current->index;
-        rate_purge_entries (calc, calc->current->index - range);
+        calc->cycle_till = calc->bucket;
+        if (calc->latest > range)
+            rate_drop_to (calc, (calc->latest - range) / calc->width);
     }
-    else
-        thread_spin_unlock (&calc->lock);
+    thread_spin_unlock (&calc->lock);
 }
 
 
@@ -932,17 +931,6 @@ void rate_free (struct rate_calc *calc)
 {
     if (calc == NULL)
         return;
-    if (calc->current)
-    {
-        struct rate_calc_node *node = calc->current->next;
-        calc->current->next = NULL;
-        while (node)
-        {
-            struct rate_calc_node *to_go = node;
-            node = node->next;
-            free (to_go);
-        }
-    }
     thread_spin_destroy (&calc->lock);
     free (calc);
 }
@@ -1025,6 +1013,8 @@ void cached_prune (cache_file_contents *cache)
 {
     if (cache == NULL)
         return;
+    if (cache->load)
+        cache->load (cache, NULL);
     if (cache->contents)
     {
         avl_tree_free (cache->contents, cached_treenode_free);
@@ -1082,14 +1072,19 @@ void cached_file_recheck (cache_file_contents *cache, time_t now)
             break;
         }
 
-        cached_prune (cache);
-        cache->contents = avl_tree_new (cache->compare, &cache->file_recheck);
-        while (get_line (file, line, MAX_LINE_LEN))
+        if (cache->load)
+            count = cache->load (cache, file);
+        else
         {
-            if(!line[0] || line[0] == '#')
-                continue;
-            count++;
-            cache->add( cache, line, 0);
+            cached_prune (cache);
+            cache->contents = avl_tree_new (cache->compare, &cache->file_recheck);
+            while (get_line (file, line, MAX_LINE_LEN))
+            {
+                if(!line[0] || line[0] == '#')
+                    continue;
+                count++;
+                cache->add( cache, line, 0);
+            }
         }
         fclose (file);
         INFO2 ("%d entries read from file \"%s\"", count, cache->filename);
@@ -67,6 +67,7 @@ struct cache_list_node
 struct _cache_contents;
 typedef void (*cachefile_add_func)(struct _cache_contents *, const void *ip, time_t now);
 typedef int  (*cachefile_compare_func)(void *, void *, void *);
+typedef int  (*cachefile_load_func)(struct _cache_contents *, FILE *);
 
 typedef struct _cache_contents
 {
@@ -77,6 +78,9 @@ typedef struct _cache_contents
     // callback routines key insert and comparison
     cachefile_compare_func  compare;
     cachefile_add_func      add;
+    // if set, loads (or clears when passed NULL) the file contents instead
+    cachefile_load_func     load;
+    void                    *data;
 
     void *deletions[9];
     int  deletions_count;
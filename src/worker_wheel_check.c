@@ -0,0 +1,194 @@
+/* Icecast
+ *
+ * This program is distributed under the GNU General Public License, version 2.
+ * A copy of this license is included with this source.
+ *
+ * Copyright 2000-2004, Jack Moffitt <jack@xiph.org,
+ *                      Michael Smith <msmith@xiph.org>,
+ *                      oddsock <oddsock@xiph.org>,
+ *                      Karl Heyes <karl@xiph.org>
+ *                      and others (see AUTHORS for details).
+ */
+
+/* worker_wheel_check.c
+**
+** Checks the run list a worker builds from its timing wheel and wake groups,
+** run by "make check". Clients are filed as the worker does, then the wheel
+** and groups are checked as at the start of a worker pass, no client is run.
+** Each client due must be in the run list once only.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "client.c"
+
+#define CHECK_CLIENTS       3
+#define CHECK_RUN_MAX       16
+
+
+/* the worker loop is not run here, these are just enough for client.c to link */
+int errorlog;
+ice_global_t global;
+worker_t *workers;
+rwlock_t workers_lock;
+static ice_config_t check_config;
+ice_config_t *config_get_config (void) { return &check_config; }
+ice_config_t *config_get_config_unlocked (void) { return &check_config; }
+void config_release_config (void) { }
+listener_t *config_clear_listener (listener_t *listener) { return NULL; }
+void global_lock (void) { }
+void global_unlock (void) { }
+struct _client_functions http_request_ops;
+int  connection_worker_sockets (struct _worker_t *worker) { return 0; }
+void connection_worker_sockets_close (struct _worker_t *worker) { }
+struct _client_tag *connection_worker_accept (struct _worker_t *worker, int idx) { return NULL; }
+void connection_reset (connection_t *con, uint64_t time_ms) { }
+void connection_close (connection_t *con) { }
+void connection_release_banned_ip (const char *ip) { }
+int  connection_read_ssl (connection_t *con, void *buf, size_t len) { return -1; }
+int  connection_send_ssl (connection_t *con, const void *buf, size_t len) { return -1; }
+int  connection_read (connection_t *con, void *buf, size_t len) { return -1; }
+int  connection_send (connection_t *con, const void *buf, size_t len) { return -1; }
+int  fserve_setup_client (client_t *client) { return -1; }
+void logging_access (client_t *client) { }
+void logging_access_buffer_create (void) { }
+void logging_access_flush (time_t now, int all) { }
+int  redirect_client (const char *mountpoint, client_t *client) { return 0; }
+void stats_event (const char *source, const char *name, const char *value) { }
+void stats_event_flags (const char *source, const char *name, const char *value, int flags) { }
+int  util_timed_wait_for_fd (sock_t fd, int timeout) { return 0; }
+
+
+static struct _client_functions check_ops, check_fanout_ops;
+static char check_flag;
+static int check_fanout_seen [CHECK_CLIENTS];
+static client_t *check_clients;
+
+
+/* sends nothing so the whole batch is left to run, just notes who was in it */
+static int check_fanout (client_t **clients, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+        check_fanout_seen [clients[i] - check_clients]++;
+    return 0;
+}
+
+
+/* walk the run list, failing if a client shows up twice or was missed */
+static int check_run_list (const char *name, client_t *run, client_t *clients)
+{
+    int seen [CHECK_CLIENTS] = { 0 }, i, count = 0;
+
+    for (; run && count < CHECK_RUN_MAX; run = run->wheel_next, count++)
+    {
+        if (run < clients || run >= clients + CHECK_CLIENTS)
+        {
+            printf ("%s: unknown client in the run list\n", name);
+            return 1;
+        }
+        seen [run - clients]++;
+    }
+    for (i = 0; i < CHECK_CLIENTS; i++)
+    {
+        if (seen [i] != 1)
+        {
+            printf ("%s: client %d in the run list %d times\n", name, i, seen [i]);
+            return 1;
+        }
+    }
+    printf ("%s: ok\n", name);
+    return 0;
+}
+
+
+/* all clients due on the same tick, the first also waiting on a flag which
+ * is set before the groups are checked */
+static int check_due_and_flagged (void)
+{
+    worker_t *worker = calloc (1, sizeof (worker_t));
+    client_t *clients = calloc (CHECK_CLIENTS, sizeof (client_t));
+    client_t *run = NULL, **run_tail = &run;
+    int i, ret;
+
+    worker->wheel_ms = 1000;
+    check_flag = 0;
+    for (i = 0; i < CHECK_CLIENTS; i++)
+    {
+        clients [i].ops = &check_ops;
+        clients [i].flags = CLIENT_ACTIVE;
+        clients [i].schedule_ms = 1005;
+        clients [i].worker = worker;
+        if (i == 0)
+            clients [i].wakeup = &check_flag;
+        worker_client_refile (worker, &clients [i]);
+    }
+    check_flag = 1;
+    worker_wheel_expire (worker, 1010, &run_tail);
+    worker_groups_check (worker, &run_tail);
+
+    ret = check_run_list ("due and flagged", run, clients);
+    if (ret == 0 && (worker->wheel_count || clients[0].wake_prevp))
+    {
+        printf ("due and flagged: clients left filed\n");
+        ret = 1;
+    }
+    worker_wheel_reset (worker);
+    free (clients);
+    free (worker);
+    return ret;
+}
+
+
+/* all clients in a fanout group, the first already queued to run but left
+ * in the group, it must not go in a fanout batch or be queued again */
+static int check_fanout_queued (void)
+{
+    worker_t *worker = calloc (1, sizeof (worker_t));
+    client_t *clients = calloc (CHECK_CLIENTS, sizeof (client_t));
+    client_t *run = NULL, **run_tail = &run;
+    int i, ret;
+
+    worker->wheel_ms = 1000;
+    check_flag = 0;
+    check_fanout_ops.fanout = check_fanout;
+    check_clients = clients;
+    memset (check_fanout_seen, 0, sizeof (check_fanout_seen));
+    for (i = 0; i < CHECK_CLIENTS; i++)
+    {
+        clients [i].ops = &check_fanout_ops;
+        clients [i].flags = CLIENT_ACTIVE;
+        clients [i].schedule_ms = 2000;
+        clients [i].worker = worker;
+        clients [i].wakeup = &check_flag;
+        worker_client_refile (worker, &clients [i]);
+    }
+    worker_wheel_del (worker, &clients [0]);
+    worker_run_append (&run_tail, &clients [0]);
+    check_flag = 1;
+    worker_groups_check (worker, &run_tail);
+
+    ret = check_run_list ("fanout with one queued", run, clients);
+    if (ret == 0 && (check_fanout_seen [0] || check_fanout_seen [1] != 1 || check_fanout_seen [2] != 1))
+    {
+        printf ("fanout with one queued: wrong clients in the batch\n");
+        ret = 1;
+    }
+    worker_wheel_reset (worker);
+    free (clients);
+    free (worker);
+    return ret;
+}
+
+
+int main (void)
+{
+    int ret = 0;
+
+    ret |= check_due_and_flagged ();
+    ret |= check_fanout_queued ();
+    return ret;
+}